@@ -102,14 +102,14 @@ static void on_connect(ble_cmd_t * p_cmd, ble_evt_t const * p_ble_evt)
         p_ble_evt->evt.gap_evt.conn_handle);
   }
 
-  /* Check the hosts CCCD value to inform of readiness to send data using the RX characteristic */
+  /* Check the hosts CCCD value, restored for a bonded host, to inform of readiness to send data using the TX characteristic */
   memset(&gatts_val, 0, sizeof(ble_gatts_value_t));
   gatts_val.p_value = cccd_value;
   gatts_val.len     = sizeof(cccd_value);
   gatts_val.offset  = 0;
 
   err_code = sd_ble_gatts_value_get(p_ble_evt->evt.gap_evt.conn_handle,
-      p_cmd->rx_handles.cccd_handle,
+      p_cmd->tx_handles.cccd_handle,
       &gatts_val);
 
   if ((err_code == NRF_SUCCESS)     &&
@@ -0,0 +1,126 @@
+/*!
+ * @file argPool.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Size-classed block pool for command argument data
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "app_error.h"
+#include "app_util_platform.h"
+#include "nrf_balloc.h"
+
+#include "argPool.h"
+
+NRF_BALLOC_DEF(m_argPoolSmall, COMMAND_ARG_POOL_SMALL_SIZE, COMMAND_ARG_POOL_SMALL_COUNT);
+NRF_BALLOC_DEF(m_argPoolMedium, COMMAND_ARG_POOL_MEDIUM_SIZE, COMMAND_ARG_POOL_MEDIUM_COUNT);
+NRF_BALLOC_DEF(m_argPoolLarge, COMMAND_ARG_POOL_LARGE_SIZE, COMMAND_ARG_POOL_LARGE_COUNT);
+
+static nrf_balloc_t const * const m_argPools[ARG_POOL_CLASSES] =
+{
+  &m_argPoolSmall,
+  &m_argPoolMedium,
+  &m_argPoolLarge
+};
+
+static arg_pool_stats_t m_argPoolStats[ARG_POOL_CLASSES] =
+{
+  { .blockSize = COMMAND_ARG_POOL_SMALL_SIZE,  .blockCount = COMMAND_ARG_POOL_SMALL_COUNT },
+  { .blockSize = COMMAND_ARG_POOL_MEDIUM_SIZE, .blockCount = COMMAND_ARG_POOL_MEDIUM_COUNT },
+  { .blockSize = COMMAND_ARG_POOL_LARGE_SIZE,  .blockCount = COMMAND_ARG_POOL_LARGE_COUNT }
+};
+
+void
+argPoolInit(void)
+{
+  for (uint8_t i = 0; i < ARG_POOL_CLASSES; i++)
+  {
+    APP_ERROR_CHECK(nrf_balloc_init(m_argPools[i]));
+    m_argPoolStats[i].inUse = 0;
+    m_argPoolStats[i].highWater = 0;
+    m_argPoolStats[i].failures = 0;
+  }
+}
+
+uint8_t *
+argPoolAlloc(uint16_t length, uint8_t *sizeClass)
+{
+  uint8_t *block = NULL;
+
+  *sizeClass = ARG_POOL_NO_CLASS;
+
+  CRITICAL_REGION_ENTER();
+  for (uint8_t i = 0; i < ARG_POOL_CLASSES && block == NULL; i++)
+  {
+    arg_pool_stats_t *stats = &m_argPoolStats[i];
+    if (length > stats->blockSize)
+      continue;
+
+    block = nrf_balloc_alloc(m_argPools[i]);
+    if (block == NULL)
+    {
+      stats->failures++;
+      continue;
+    }
+
+    *sizeClass = i;
+    if (++stats->inUse > stats->highWater)
+      stats->highWater = stats->inUse;
+  }
+  CRITICAL_REGION_EXIT();
+
+  return block;
+}
+
+void
+argPoolFree(uint8_t sizeClass, uint8_t *block)
+{
+  if (sizeClass >= ARG_POOL_CLASSES || block == NULL)
+    return;
+
+  CRITICAL_REGION_ENTER();
+  nrf_balloc_free(m_argPools[sizeClass], block);
+  m_argPoolStats[sizeClass].inUse--;
+  CRITICAL_REGION_EXIT();
+}
+
+uint16_t
+argPoolMaxLength(void)
+{
+  return m_argPoolStats[ARG_POOL_CLASSES - 1].blockSize;
+}
+
+uint8_t
+argPoolAvailable(void)
+{
+  uint8_t available = 0;
+
+  CRITICAL_REGION_ENTER();
+  for (uint8_t i = 0; i < ARG_POOL_CLASSES; i++)
+    available += m_argPoolStats[i].blockCount - m_argPoolStats[i].inUse;
+  CRITICAL_REGION_EXIT();
+
+  return available;
+}
+
+bool
+argPoolStats(uint8_t sizeClass, arg_pool_stats_t *stats)
+{
+  if (sizeClass >= ARG_POOL_CLASSES)
+    return false;
+
+  CRITICAL_REGION_ENTER();
+  *stats = m_argPoolStats[sizeClass];
+  CRITICAL_REGION_EXIT();
+  return true;
+}
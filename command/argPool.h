@@ -0,0 +1,105 @@
+/*!
+ * @file argPool.h
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Size-classed block pool for command argument data
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#ifndef _ARG_POOL_H
+#define _ARG_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdk_config.h"
+
+/*!
+ * @brief The number of block size classes.
+ *
+ * @details Block sizes and counts for each class are set per board in
+ * sdk_config.h by COMMAND_ARG_POOL_{SMALL,MEDIUM,LARGE}_{SIZE,COUNT}. The
+ * large block size is the longest argument the board accepts.
+ */
+#define ARG_POOL_CLASSES 3
+
+/*!
+ * @brief Marks a command with no argument block.
+ */
+#define ARG_POOL_NO_CLASS 0xFF
+
+/*!
+ * @brief Occupancy of one size class.
+ *
+ * @field blockSize  - the usable bytes in each block
+ * @field blockCount - the number of blocks in the class
+ * @field inUse      - the number of blocks currently allocated
+ * @field highWater  - the most blocks allocated at once since initialization
+ * @field failures   - the allocations that found the class exhausted
+ */
+typedef struct
+{
+  uint16_t blockSize;
+  uint8_t  blockCount;
+  uint8_t  inUse;
+  uint8_t  highWater;
+  uint32_t failures;
+} arg_pool_stats_t;
+
+/*!
+ * @brief Initialize the pools.
+ */
+void argPoolInit(void);
+
+/*!
+ * @brief Allocate a block for an argument.
+ *
+ * @details The block comes from the smallest class that holds the argument;
+ * if that class is exhausted the next larger class is tried.
+ *
+ * @param length    - the argument length, greater than 0
+ * @param sizeClass - the class the block came from, for argPoolFree()
+ * @return the block, or NULL if no class could provide one
+ */
+uint8_t *argPoolAlloc(uint16_t length, uint8_t *sizeClass);
+
+/*!
+ * @brief Return a block to its pool.
+ *
+ * @param sizeClass - the class argPoolAlloc() reported; ARG_POOL_NO_CLASS is
+ *                    ignored
+ * @param block     - the block
+ */
+void argPoolFree(uint8_t sizeClass, uint8_t *block);
+
+/*!
+ * @brief The longest argument the pools can hold.
+ */
+uint16_t argPoolMaxLength(void);
+
+/*!
+ * @brief Count the blocks free.
+ *
+ * @details Every class holds at least COMMAND_ARG_POOL_SMALL_SIZE bytes, so
+ * each free block can take an argument of that length.
+ *
+ * @return the number of blocks free in all classes
+ */
+uint8_t argPoolAvailable(void);
+
+/*!
+ * @brief Get the occupancy of a size class.
+ *
+ * @param sizeClass - the class, smallest first, [0,ARG_POOL_CLASSES)
+ * @param stats     - the class's occupancy
+ * @return true if @p sizeClass is valid, false otherwise
+ */
+bool argPoolStats(uint8_t sizeClass, arg_pool_stats_t *stats);
+
+#endif // _ARG_POOL_H
@@ -14,250 +14,2740 @@
 
 
 #include <stdint.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include "app_error.h"
 #include "app_timer.h"
-#include "nrf_delay.h"
+#include "app_util_platform.h"
 #include "nrf_log.h"
 #include "mem_manager.h"
+#include "crc32.h"
 #include "nrf_sdm.h"
+#include "nrf_soc.h"
 
 #include "ble_cmd.h"
 
 #include "command.h"
 #include "commandInternal.h"
+#include "timeSync.h"
+#include "subscription.h"
+#include "param.h"
+#include "journal.h"
+#include "upload.h"
+#include "retain.h"
+#include "response.h"
+#include "responseBuilder.h"
 
 // declare and initialize a reader command instance
 command_t m_command;
 
+// Host time base estimate, and whether responses are stamped with it
+static time_sync_t m_timeSync;
+static bool m_timeStamping = false;
+
+// The app_timer RTC is 24 bits; extend it in software
+APP_TIMER_DEF(m_clockTimer);
+static uint32_t m_clockLastTicks;
+static uint64_t m_clockHighTicks;
+
+// The command most recently run, in either tier
+static volatile command_id_t m_lastCommand = NO_COMMAND;
+
+// COMMAND_ERROR_ flags and a count of status record changes
+static volatile uint8_t m_statusErrors;
+static volatile uint8_t m_statusChanges;
+
+// Event subscriptions, and the counters they can report
+static subscriptions_t m_subscriptions;
+static volatile uint32_t m_eventCounters[SUBSCRIPTION_COUNTER_COUNT];
+APP_TIMER_DEF(m_subscriptionTimer);
+
 #define SIMPLE_COMMAND_DEBUG 1
 
-#define BLE_MTU 20
+#define BLE_MTU 20
+
+#define THROUGHPUT_TEST_COUNT_DIGITS 6
+#define THROUGHPUT_TEST_ARG_LENGTH   (THROUGHPUT_TEST_COUNT_DIGITS + 1)
+// The 'I' counter skips the bytes that mark notices (see command.h)
+#define THROUGHPUT_TEST_COUNTER_FIRST 0x20
+
+#define STREAM_TEST_COUNT_DIGITS     8
+#define STREAM_TEST_ARG_LENGTH       (STREAM_TEST_COUNT_DIGITS + 1)
+
+// RTC ticks are 24 bits, so eight digits
+#define ECHO_TICKS_DIGITS            8
+#define ECHO_STAMPS_LENGTH           (sizeof("echo:rx=,dispatch=,queued=") - 1 + 3 * ECHO_TICKS_DIGITS)
+
+#define TIME_SYNC_TIME_DIGITS        16
+#define TIME_SYNC_DELAY_DIGITS       8
+
+#define COALESCE_DELAY_DIGITS        2
+
+#define RESUME_TOKEN_DIGITS          8
+
+#define SUBSCRIBE_TYPE_DIGITS        2
+#define SUBSCRIBE_INTERVAL_DIGITS    4
+#define SUBSCRIBE_GROUP_LENGTH       (SUBSCRIBE_TYPE_DIGITS + SUBSCRIBE_INTERVAL_DIGITS)
+#define SUBSCRIBE_INTERVAL_OFF       0xFFFF
+
+#define PARAMETER_ID_DIGITS          2
+#define PARAMETER_VALUE_DIGITS       8
+
+#define JOURNAL_SEQUENCE_DIGITS      8
+
+#define UPLOAD_OP_START              'S'
+#define UPLOAD_OP_BLOCK              'B'
+#define UPLOAD_OP_FINISH             'F'
+#define UPLOAD_VALUE_DIGITS          8
+#define UPLOAD_HEADER_LENGTH         (1 + 2 * UPLOAD_VALUE_DIGITS)
+// One block is received while the one before it is written
+#define UPLOAD_BLOCKS                2
+
+// SUBSCRIPTION_COUNTERS, in the order reported
+#define EVENT_COUNTER_COMMANDS_RUN   0
+#define EVENT_COUNTER_WRITES         1
+#define EVENT_COUNTER_ERRORS         2
+
+// A waiting command runs after at most this many of higher classes
+#define COMMAND_CLASS_PASS_LIMIT     8
+
+// Must be well under the 512 s it takes the 24-bit RTC to wrap
+#define CLOCK_EXTEND_INTERVAL        APP_TIMER_TICKS(60000)
+
+#define RTC_TICKS_PER_SECOND         (APP_TIMER_CLOCK_FREQ / (APP_TIMER_CONFIG_RTC_FREQUENCY + 1))
+
+// Capture of received writes for replay; set to 0 to save the RAM
+#define COMMAND_RX_CAPTURE_ENABLED   1
+#define COMMAND_RX_CAPTURE_SLOTS     64
+#define COMMAND_RX_CAPTURE_PAYLOAD   BLE_MTU
+
+#if COMMAND_RX_CAPTURE_ENABLED
+/*!
+ * @brief A captured write.
+ *
+ * @field ticks  - app_timer RTC ticks when the write arrived
+ * @field length - the number of bytes kept
+ * @field data   - the first COMMAND_RX_CAPTURE_PAYLOAD bytes of the write
+ */
+typedef struct
+{
+  uint32_t ticks;
+  uint8_t  length;
+  uint8_t  data[COMMAND_RX_CAPTURE_PAYLOAD];
+} rx_capture_record_t;
+
+static rx_capture_record_t m_rxCapture[COMMAND_RX_CAPTURE_SLOTS];
+static uint8_t m_rxCaptureNext;
+static uint8_t m_rxCaptureCount;
+static bool m_rxCapturing = false;
+#endif
+
+/*!
+ * @brief Read the RTC extended to 64 bits.
+ *
+ * @details Each read carries the RTC wrap into the high bits, so this must be
+ * called at least once per RTC period; the clock timer guarantees that.
+ */
+static uint64_t
+deviceTicks()
+{
+  uint64_t ticks;
+
+  CRITICAL_REGION_ENTER();
+  uint32_t now = app_timer_cnt_get();
+  if (now < m_clockLastTicks)
+    m_clockHighTicks += 1UL << 24;
+  m_clockLastTicks = now;
+  ticks = m_clockHighTicks | now;
+  CRITICAL_REGION_EXIT();
+
+  return ticks;
+}
+
+static void
+clockTimeoutHandler(void * p_context)
+{
+  (void) deviceTicks();
+}
+
+/*!
+ * @brief Device time in microseconds of a recent raw app_timer tick count.
+ *
+ * @param ticks - an app_timer_cnt_get() value less than one RTC period old
+ * @return the device time in microseconds since the clock started
+ */
+static int64_t
+deviceTimeUsAt(uint32_t ticks)
+{
+  uint64_t now = deviceTicks();
+  uint32_t age = app_timer_cnt_diff_compute((uint32_t) (now & 0xFFFFFF), ticks);
+  return (int64_t) (((now - age) * 1000000ULL) / RTC_TICKS_PER_SECOND);
+}
+
+/*!
+ * @brief Supply the stamp notice that precedes each response while time
+ * stamping is on.
+ */
+static uint16_t
+responseStamp(uint8_t *buffer, uint16_t size)
+{
+  int64_t sentAt;
+
+  if (size < 9 || !m_timeStamping ||
+      !timeSyncToHost(&m_timeSync, deviceTimeUsAt(app_timer_cnt_get()), &sentAt))
+    return 0;
+
+  buffer[0] = COMMAND_STAMP_MARK;
+  for (uint8_t i = 0; i < 8; i++)
+    buffer[1 + i] = ((uint64_t) sentAt >> (8 * i)) & 0xFF;
+  return 9;
+}
+
+/*!
+ * @brief What the event types report now.
+ */
+static subscription_values_t
+subscriptionValues()
+{
+  subscription_values_t values;
+
+  values.command = m_lastCommand;
+  values.errors = m_statusErrors;
+  for (uint8_t i = 0; i < SUBSCRIPTION_COUNTER_COUNT; i++)
+    values.counters[i] = m_eventCounters[i];
+  return values;
+}
+
+/*!
+ * @brief Supply an event notice once one can be sent.
+ */
+static uint16_t
+eventNoticeBuild(uint8_t *buffer, uint16_t size)
+{
+  subscription_values_t values = subscriptionValues();
+  uint16_t length;
+
+  if (size < 1)
+    return 0;
+  buffer[0] = COMMAND_EVENT_MARK;
+  length = subscriptionsEncode(&m_subscriptions, &values, deviceTicks(), buffer + 1, size - 1);
+  return (length == 0) ? 0 : length + 1;
+}
+
+/*!
+ * @brief Request an event notice if one is due, or wake when one will be.
+ *
+ * @details Call whenever a value an event type reports changes.
+ */
+static void
+subscriptionsKick()
+{
+  CRITICAL_REGION_ENTER();
+  if (subscriptionsActive(&m_subscriptions) != 0)
+  {
+    subscription_values_t values = subscriptionValues();
+    uint64_t waitTicks;
+
+    if (subscriptionsDue(&m_subscriptions, &values, deviceTicks(), &waitTicks))
+      responseRequestNotice(eventNoticeBuild);
+    else if (waitTicks != SUBSCRIPTION_OFF)
+    {
+      if (waitTicks < APP_TIMER_MIN_TIMEOUT_TICKS)
+        waitTicks = APP_TIMER_MIN_TIMEOUT_TICKS;
+      (void) app_timer_stop(m_subscriptionTimer);
+      APP_ERROR_CHECK(app_timer_start(m_subscriptionTimer, (uint32_t) waitTicks, NULL));
+    }
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+static void
+subscriptionTimeoutHandler(void * p_context)
+{
+  subscriptionsKick();
+}
+
+/*!
+ * @brief Count an event for SUBSCRIPTION_COUNTERS.
+ */
+static void
+eventCount(uint8_t counter)
+{
+  CRITICAL_REGION_ENTER();
+  m_eventCounters[counter]++;
+  CRITICAL_REGION_EXIT();
+  subscriptionsKick();
+}
+
+/*!
+ * @brief Note the command most recently run, counting a change.
+ */
+static void
+statusCommand(command_id_t commandID)
+{
+  CRITICAL_REGION_ENTER();
+  if (commandID != m_lastCommand)
+  {
+    m_lastCommand = commandID;
+    m_statusChanges++;
+#if COMMAND_RETAIN_ENABLED
+    retainCommand(commandID);
+#endif
+  }
+  CRITICAL_REGION_EXIT();
+  subscriptionsKick();
+}
+
+/*!
+ * @brief Note an error, counting a change the first time it is flagged.
+ */
+static void
+statusError(uint8_t error)
+{
+  CRITICAL_REGION_ENTER();
+  if ((m_statusErrors & error) == 0)
+  {
+    m_statusErrors |= error;
+    m_statusChanges++;
+  }
+  CRITICAL_REGION_EXIT();
+  eventCount(EVENT_COUNTER_ERRORS);
+}
+
+/*!
+ * @brief Note a response handed to the TX path for the current command.
+ *
+ * @param queued - true if the response was queued, false if it was dropped
+ */
+static void
+responseQueuedForCommand(bool queued)
+{
+  if (!queued)
+    statusError(COMMAND_ERROR_RESPONSE_DROPPED);
+}
+
+/*!
+ * @brief Queue a response of known length.
+ *
+ * @param message   - the response bytes, not necessarily NUL-terminated
+ * @param msgLength - the number of bytes in @p message
+ */
+static void
+bleEventSend(char const *message, uint16_t msgLength)
+{
+  responseQueuedForCommand(responseSend(message, msgLength));
+}
+
+/*!
+ * @brief Queue a response defined with RESPONSE_CONST_DEF().
+ */
+#define bleEventSendConst(_response) \
+  responseQueuedForCommand(responseSendStatic((_response).header, (_response).text, \
+      sizeof((_response).text), NULL, NULL))
+
+/*!
+ * @brief Send what a response builder holds.
+ */
+static void
+bleEventSendBuilt(response_builder_t const *builder)
+{
+  bleEventSend(builder->buffer, builder->length);
+}
+
+void
+bleEventInitiate(char *message)
+{
+  // Determine how much data and send notification
+  bleEventSend(message, strlen(message));
+}
+
+/*!
+ * @brief The commands of one class waiting to run, oldest first.
+ *
+ * @field entries - indexes into m_rxEntries
+ * @field head    - where the oldest is in @p entries
+ * @field count   - the number waiting
+ * @field passed  - commands of higher classes run since one of these last ran
+ */
+typedef struct
+{
+  uint8_t entries[COMMAND_RX_QUEUE_SIZE];
+  uint8_t head;
+  uint8_t count;
+  uint8_t passed;
+} command_class_queue_t;
+
+// RX queue entries, shared by the queues and the command being received
+static command_rx_t m_rxEntries[COMMAND_RX_QUEUE_SIZE];
+static command_rx_t *m_receiving;
+static command_class_queue_t m_urgentQueue;
+static command_class_queue_t m_classQueues[COMMAND_CLASSES];
+static uint8_t m_rxQueueCount;
+
+// How urgent commands get run, and response buffers promised to commands running
+static command_pend_t m_urgentPend;
+static uint8_t m_responsesReserved;
+
+// Set between a radio notification before a connection event and its end
+static volatile bool m_radioActive;
+
+/*!
+ * @brief RX credits granted to the central.
+ *
+ * @field active  - true once notifications are enabled
+ * @field started - the commands seen to start, mod 2^16
+ * @field limit   - the Limit last granted
+ */
+static struct
+{
+  bool active;
+  uint16_t started;
+  uint16_t limit;
+} m_credit;
+
+/*!
+ * @brief Where the session stands, as the link comes and goes.
+ */
+typedef enum
+{
+  SESSION_ACTIVE,   // the session is the link's own
+  SESSION_DETACHED, // the link dropped with work carried over
+  SESSION_OFFERED,  // a new link is up and the central may resume
+  SESSION_RESUMING  // resumed; carried responses are going out
+} session_state_t;
+
+/*!
+ * @brief The session requests are numbered in.
+ *
+ * @field state           - where the session stands
+ * @field token           - identifies the session to the central
+ * @field requests        - the commands seen to start in the session, mod 2^16
+ * @field carriedCommands - commands from before the link dropped still to run
+ * @field threadRunning   - true while the thread tier runs a command
+ * @field paused          - true while the central has notifications off
+ *                          without disconnecting
+ */
+static struct
+{
+  session_state_t state;
+  uint32_t token;
+  uint16_t requests;
+  uint8_t carriedCommands;
+  volatile bool threadRunning;
+  bool paused;
+} m_session;
+
+// Boot notice times are 3 bytes; later ones are capped
+#define BOOT_TIME_BYTES 3
+#define BOOT_TIME_MAX   0xFFFFFF
+
+/*!
+ * @brief The start up profile, reported over the first connection.
+ *
+ * @field stageUs - when each stage was done, or NULL until start up is
+ * @field next    - the next stage to report; BOOT_STAGES once all have been
+ */
+static struct
+{
+  uint32_t const *stageUs;
+  uint8_t next;
+} m_boot;
+
+/*!
+ * @brief Grant the central more credits if it is running short.
+ *
+ * @details Each credit is an RX queue entry and an arg block, so it covers a
+ * command with up to COMMAND_ARG_POOL_SMALL_SIZE bytes of arg data. Waiting
+ * until the central is down to half what it could be granted saves a grant
+ * per command.
+ */
+static void
+creditCheck()
+{
+  uint16_t argMax = argPoolMaxLength();
+  uint8_t blocks = argPoolAvailable();
+  uint8_t entries = COMMAND_RX_QUEUE_SIZE - m_rxQueueCount - ((m_receiving == NULL) ? 0 : 1);
+  uint16_t limit = m_credit.started + ((blocks < entries) ? blocks : entries);
+  int16_t remaining = (int16_t) (m_credit.limit - m_credit.started);
+
+  if (!m_credit.active || (int16_t) (limit - m_credit.limit) <= 0 ||
+      remaining > (uint16_t) (limit - m_credit.started) / 2)
+    return;
+
+  uint8_t const grant[] =
+  {
+    COMMAND_CREDIT_MARK,
+    limit & 0xFF, limit >> 8,
+    m_credit.started & 0xFF, m_credit.started >> 8,
+    COMMAND_ARG_POOL_SMALL_SIZE & 0xFF, COMMAND_ARG_POOL_SMALL_SIZE >> 8,
+    argMax & 0xFF, argMax >> 8
+  };
+  m_credit.limit = limit;
+  responseSendNotice(grant, sizeof(grant));
+}
+
+static void
+creditUpdate()
+{
+  // The queues are shared by the RX path and both tiers
+  CRITICAL_REGION_ENTER();
+  creditCheck();
+  CRITICAL_REGION_EXIT();
+}
+
+/*!
+ * @brief Supply the session notice.
+ */
+static uint16_t
+sessionNoticeBuild(uint8_t *buffer, uint16_t size)
+{
+  if (size < 6)
+    return 0;
+
+  buffer[0] = COMMAND_SESSION_MARK;
+  buffer[1] = m_session.token & 0xFF;
+  buffer[2] = (m_session.token >> 8) & 0xFF;
+  buffer[3] = (m_session.token >> 16) & 0xFF;
+  buffer[4] = m_session.token >> 24;
+  buffer[5] = (m_session.state == SESSION_OFFERED || m_session.state == SESSION_RESUMING) ? 1 : 0;
+  return 6;
+}
+
+/*!
+ * @brief Supply the notification that follows the last carried response.
+ */
+static uint16_t
+sessionResumedBuild(uint8_t *buffer, uint16_t size)
+{
+  buffer[0] = RESPONSE_CARRIED;
+  return 1;
+}
+
+/*!
+ * @brief Supply the next boot notice.
+ *
+ * @details Asks for another while stages remain.
+ */
+static uint16_t
+bootNoticeBuild(uint8_t *buffer, uint16_t size)
+{
+  uint16_t length = 2;
+
+  if (size < length + BOOT_TIME_BYTES || m_boot.stageUs == NULL)
+    return 0;
+
+  buffer[0] = COMMAND_BOOT_MARK;
+  buffer[1] = m_boot.next;
+  while (m_boot.next < BOOT_STAGES && length + BOOT_TIME_BYTES <= size)
+  {
+    uint32_t us = m_boot.stageUs[m_boot.next++];
+    if (us > BOOT_TIME_MAX)
+      us = BOOT_TIME_MAX;
+    buffer[length++] = us & 0xFF;
+    buffer[length++] = (us >> 8) & 0xFF;
+    buffer[length++] = us >> 16;
+  }
+
+  if (m_boot.next < BOOT_STAGES)
+    responseRequestNotice(bootNoticeBuild);
+  return length;
+}
+
+/*!
+ * @brief Return a command's arg data block to the pool.
+ */
+static void
+releaseArgData(command_packet_t *command)
+{
+  argPoolFree(command->argClass, command->argData);
+  command->argClass = ARG_POOL_NO_CLASS;
+  command->argData = NULL;
+}
+
+/*!
+ * @brief Drop the commands from a link that dropped still waiting to run.
+ *
+ * @details A new session's central sends again whatever it still wants, so
+ * running them would only run them twice.
+ */
+static void
+dropCarriedCommands()
+{
+  for (uint8_t q = 0; q <= COMMAND_CLASSES; q++)
+  {
+    command_class_queue_t *queue = (q == COMMAND_CLASSES) ? &m_urgentQueue : &m_classQueues[q];
+    uint8_t kept = 0;
+
+    for (uint8_t i = 0; i < queue->count; i++)
+    {
+      uint8_t index = queue->entries[(queue->head + i) % COMMAND_RX_QUEUE_SIZE];
+      command_rx_t *rx = &m_rxEntries[index];
+
+      if (!rx->carried)
+      {
+        queue->entries[(queue->head + kept++) % COMMAND_RX_QUEUE_SIZE] = index;
+        continue;
+      }
+      // A stream's state is given up as if the command had run
+      releaseArgData(&rx->command);
+      if (rx->argStream->drop != NULL)
+        rx->argStream->drop(rx->argSlot);
+      rx->inUse = false;
+      m_rxQueueCount--;
+      m_session.carriedCommands--;
+    }
+    queue->count = kept;
+  }
+}
+
+/*!
+ * @brief Start a new session, dropping anything carried over.
+ */
+static void
+sessionNew()
+{
+  CRITICAL_REGION_ENTER();
+  m_session.state = SESSION_ACTIVE;
+  // Not a secret, only different from the sessions before it
+  m_session.token += (uint32_t) deviceTicks() | 1;
+#if COMMAND_RETAIN_ENABLED
+  retainSession(m_session.token);
+#endif
+  m_session.requests = 0;
+  dropCarriedCommands();
+  responseCarry(false);
+  responseRequestNotice(sessionNoticeBuild);
+  CRITICAL_REGION_EXIT();
+}
+
+/*!
+ * @brief Once a resumed session's carried responses have all gone, say so.
+ */
+static void
+sessionResumeCheck()
+{
+  CRITICAL_REGION_ENTER();
+  if (m_session.state == SESSION_RESUMING && m_session.carriedCommands == 0 &&
+      responseCarriedCount() == 0)
+  {
+    m_session.state = SESSION_ACTIVE;
+    responseRequestNotice(sessionResumedBuild);
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+// THROUGHPUT_TEST state; an urgent ABORT stops the test between blocks, and
+// BLE_CMD_EVT_TX_RDY or the link dropping wakes it to send again
+static struct
+{
+  volatile bool running;
+  volatile bool abort;
+  volatile bool txReady;
+} m_throughputTest;
+
+/*!
+ * @brief Wake the throughput test if it is waiting for room to send.
+ */
+static void
+throughputTestWake()
+{
+  m_throughputTest.txReady = true;
+}
+
+void
+commandTxReady()
+{
+  responseTxReady();
+  throughputTestWake();
+  sessionResumeCheck();
+
+  // Run commands that were waiting for a response buffer
+  if (validCommandReceived())
+    executeCommand();
+  else
+    creditUpdate();
+}
+
+/*!
+ * @brief Start the state that lasts for a connection afresh.
+ *
+ * @details Clears the error flags, subscriptions and event counters, and
+ * offers a session kept when the last link dropped or starts a new one.
+ */
+static void
+connectionStart()
+{
+  if (m_statusErrors != 0)
+  {
+    m_statusErrors = 0;
+    m_statusChanges++;
+  }
+
+  // Subscriptions and their counters last for the connection
+  subscriptionsInit(&m_subscriptions);
+  for (uint8_t i = 0; i < SUBSCRIPTION_COUNTER_COUNT; i++)
+    m_eventCounters[i] = 0;
+  (void) app_timer_stop(m_subscriptionTimer);
+
+  // A session kept when the link dropped waits for the central to resume it
+  if (m_session.state == SESSION_DETACHED &&
+      (m_session.carriedCommands > 0 || responseCarriedCount() > 0))
+  {
+    m_session.state = SESSION_OFFERED;
+    responseRequestNotice(sessionNoticeBuild);
+  }
+  else
+    sessionNew();
+
+  // Until every stage has gone out, however many links that takes
+  if (m_boot.stageUs != NULL && m_boot.next < BOOT_STAGES)
+  {
+    m_boot.next = 0;
+    responseRequestNotice(bootNoticeBuild);
+  }
+}
+
+void
+commandCommStarted()
+{
+  // After a pause the central counts on from the requests it has sent, and
+  // needs a grant afresh
+  m_credit.active = true;
+  if (!m_session.paused)
+    m_credit.started = 0;
+  m_credit.limit = m_credit.started;
+  creditUpdate();
+
+  CRITICAL_REGION_ENTER();
+  // A paused session carries on where it was, keeping the connection's
+  // subscriptions, counters and errors
+  if (m_session.paused)
+  {
+    m_session.paused = false;
+    responseRequestNotice(sessionNoticeBuild);
+    responsePause(false);
+  }
+  else
+    connectionStart();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+commandCommPaused()
+{
+  // Nothing can reach the central until it turns notifications back on, but
+  // the link and the session stay up
+  m_credit.active = false;
+  throughputTestWake();
+
+  CRITICAL_REGION_ENTER();
+  m_session.paused = true;
+  responsePause(true);
+  CRITICAL_REGION_EXIT();
+}
+
+void
+commandBootProfile(uint32_t const *stageUs)
+{
+  CRITICAL_REGION_ENTER();
+  m_boot.stageUs = stageUs;
+  m_boot.next = 0;
+  CRITICAL_REGION_EXIT();
+}
+
+void
+commandInit(command_pend_t urgentPend)
+{
+  m_urgentPend = urgentPend;
+  m_responsesReserved = 0;
+  m_radioActive = false;
+  m_command.initialized = true;
+  m_command.commandState = READY_FOR_COMMAND;
+  m_command.command.argClass = ARG_POOL_NO_CLASS;
+  m_command.command.argData = NULL;
+  for (uint8_t i = 0; i < COMMAND_RX_QUEUE_SIZE; i++)
+    m_rxEntries[i].inUse = false;
+  memset(&m_urgentQueue, 0, sizeof(m_urgentQueue));
+  memset(m_classQueues, 0, sizeof(m_classQueues));
+  m_receiving = NULL;
+  m_rxQueueCount = 0;
+
+  argPoolInit();
+  responseInit(responseStamp);
+  timeSyncInit(&m_timeSync);
+  subscriptionsInit(&m_subscriptions);
+
+#if COMMAND_RETAIN_ENABLED
+  // Carry on as before a warm reset. The command was taken up already, as
+  // setCurrentCommand(); the time sync is lost with the RTC, so stamping
+  // waits for the host to sync again
+  if (retainResumed())
+  {
+    retain_state_t state = retainState();
+    m_timeStamping = state.timeStamping;
+    responseCoalesce(state.coalescing, state.coalesceDelayMs);
+    m_session.token = state.sessionToken;
+  }
+#endif
+
+  ret_code_t err_code = app_timer_create(&m_clockTimer, APP_TIMER_MODE_REPEATED, clockTimeoutHandler);
+  APP_ERROR_CHECK(err_code);
+  err_code = app_timer_start(m_clockTimer, CLOCK_EXTEND_INTERVAL, NULL);
+  APP_ERROR_CHECK(err_code);
+  err_code = app_timer_create(&m_subscriptionTimer, APP_TIMER_MODE_SINGLE_SHOT, subscriptionTimeoutHandler);
+  APP_ERROR_CHECK(err_code);
+}
+
+/*!
+ * @brief The command being received.
+ */
+static command_rx_t *
+receivingCommand()
+{
+  return m_receiving;
+}
+
+/*!
+ * @brief Take a free RX queue entry to receive a command into.
+ *
+ * @return the entry, or NULL if every entry is in use
+ */
+static command_rx_t *
+rxEntryTake()
+{
+  for (uint8_t i = 0; i < COMMAND_RX_QUEUE_SIZE; i++)
+  {
+    if (!m_rxEntries[i].inUse)
+    {
+      m_rxEntries[i].inUse = true;
+      return &m_rxEntries[i];
+    }
+  }
+  return NULL;
+}
+
+/*!
+ * @brief Give back the entry of a command that will not run.
+ */
+static void
+rxEntryRelease()
+{
+  m_receiving->inUse = false;
+  m_receiving = NULL;
+}
+
+/*!
+ * @brief Buffer the whole arg for commands that take it all at once.
+ */
+static bool
+bufferArgBegin(uint16_t argLength)
+{
+  command_packet_t *command = &receivingCommand()->command;
+
+  if (argLength == 0)
+    return true;
+
+  if (argLength <= argPoolMaxLength())
+    command->argData = argPoolAlloc(argLength, &command->argClass);
+  if (command->argData == NULL)
+  {
+    NRF_LOG_INFO("No arg buffer for %d bytes", argLength);
+    return false;
+  }
+  return true;
+}
+
+static void
+bufferArgChunk(uint8_t const *data, uint16_t length)
+{
+  command_rx_t *rx = receivingCommand();
+
+  memcpy(rx->command.argData + rx->argReceived, data, length);
+}
+
+static void
+bufferArgAbandon()
+{
+  releaseArgData(&receivingCommand()->command);
+}
+
+static command_arg_stream_t const m_bufferedArg =
+{
+  .begin   = bufferArgBegin,
+  .chunk   = bufferArgChunk,
+  .end     = NULL,
+  .abandon = bufferArgAbandon,
+  .drop    = NULL
+};
+
+// ARG_CHECKSUM state; one checksum at a time from the first write until it runs
+static uint32_t m_checksumSum1;
+static uint32_t m_checksumSum2;
+static uint32_t m_checksumLastTicks;   // when the last arg data arrived
+static bool m_checksumBusy;
+
+static bool
+argChecksumBegin(uint16_t argLength)
+{
+  if (m_checksumBusy)
+  {
+    NRF_LOG_INFO("Checksum refused, one is already outstanding");
+    return false;
+  }
+
+  m_checksumBusy = true;
+  m_checksumSum1 = 0xFFFF;
+  m_checksumSum2 = 0xFFFF;
+  m_checksumLastTicks = app_timer_cnt_get();
+  return true;
+}
+
+static void
+argChecksumChunk(uint8_t const *data, uint16_t length)
+{
+  // Fletcher-32 over bytes; reducing every 256 bytes keeps the sums in range
+  for (uint16_t i = 0; i < length; i++)
+  {
+    m_checksumSum1 += data[i];
+    m_checksumSum2 += m_checksumSum1;
+    if ((i & 0xFF) == 0xFF)
+    {
+      m_checksumSum1 %= 0xFFFF;
+      m_checksumSum2 %= 0xFFFF;
+    }
+  }
+  m_checksumSum1 %= 0xFFFF;
+  m_checksumSum2 %= 0xFFFF;
+  m_checksumLastTicks = app_timer_cnt_get();
+}
+
+static void
+argChecksumAbandon()
+{
+  m_checksumBusy = false;
+}
+
+static void
+argChecksumDrop(uint8_t argSlot)
+{
+  m_checksumBusy = false;
+}
+
+static command_arg_stream_t const m_argChecksumStream =
+{
+  .begin   = argChecksumBegin,
+  .chunk   = argChecksumChunk,
+  .end     = argChecksum,
+  .abandon = argChecksumAbandon,
+  .drop    = argChecksumDrop
+};
+
+#if COMMAND_UPLOAD_ENABLED
+/*!
+ * @brief An UPLOAD command, taken as it arrives.
+ *
+ * @field inUse     - true from the command's first write until it has run
+ *                   or been dropped
+ * @field header    - the op and its two fields
+ * @field argLength - the command's arg length
+ * @field received  - the arg bytes taken so far
+ */
+typedef struct
+{
+  bool inUse;
+  uint8_t header[UPLOAD_HEADER_LENGTH];
+  uint16_t argLength;
+  uint16_t received;
+} upload_slot_t;
+
+// UPLOAD state; each command takes a free slot as it arrives, noted in its
+// argSlot, and frees it once it has run or been dropped, a block staying in
+// its slot until it is written
+static struct
+{
+  upload_slot_t slots[UPLOAD_BLOCKS];
+  uint32_t blocks[UPLOAD_BLOCKS][COMMAND_UPLOAD_BLOCK_SIZE / sizeof(uint32_t)];
+  uint8_t count;
+} m_upload;
+
+static void
+uploadSlotRelease(uint8_t index)
+{
+  CRITICAL_REGION_ENTER();
+  if (m_upload.slots[index].inUse)
+  {
+    m_upload.slots[index].inUse = false;
+    m_upload.count--;
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+static bool
+uploadArgBegin(uint16_t argLength)
+{
+  if (argLength == 0 || argLength > UPLOAD_HEADER_LENGTH + COMMAND_UPLOAD_BLOCK_SIZE)
+    return false;
+
+  if (m_upload.count == UPLOAD_BLOCKS)
+  {
+    NRF_LOG_INFO("Upload refused, %d already outstanding", UPLOAD_BLOCKS);
+    return false;
+  }
+
+  uint8_t index = 0;
+  while (m_upload.slots[index].inUse)
+    index++;
+  upload_slot_t *slot = &m_upload.slots[index];
+  slot->inUse = true;
+  slot->argLength = argLength;
+  slot->received = 0;
+  m_upload.count++;
+  receivingCommand()->argSlot = index;
+  return true;
+}
+
+static void
+uploadArgChunk(uint8_t const *data, uint16_t length)
+{
+  uint8_t index = receivingCommand()->argSlot;
+  upload_slot_t *slot = &m_upload.slots[index];
+
+  // The header, then the block straight into its buffer
+  while (length > 0 && slot->received < UPLOAD_HEADER_LENGTH)
+  {
+    slot->header[slot->received++] = *data++;
+    length--;
+  }
+  if (length == 0)
+    return;
+  memcpy((uint8_t *) m_upload.blocks[index] + slot->received - UPLOAD_HEADER_LENGTH, data, length);
+  slot->received += length;
+}
+
+static void
+uploadArgAbandon()
+{
+  uploadSlotRelease(receivingCommand()->argSlot);
+}
+
+static command_arg_stream_t const m_uploadStream =
+{
+  .begin   = uploadArgBegin,
+  .chunk   = uploadArgChunk,
+  .end     = upload,
+  .abandon = uploadArgAbandon,
+  .drop    = uploadSlotRelease
+};
+#endif
+
+// Commands that take their arg data as it arrives
+static struct
+{
+  command_id_t commandID;
+  command_arg_stream_t const *stream;
+} const m_argStreams[] =
+{
+  { ARG_CHECKSUM, &m_argChecksumStream },
+#if COMMAND_UPLOAD_ENABLED
+  { UPLOAD,       &m_uploadStream }
+#endif
+};
+
+static command_arg_stream_t const *
+argStreamFor(command_id_t commandID)
+{
+  for (uint8_t i = 0; i < sizeof(m_argStreams) / sizeof(m_argStreams[0]); i++)
+    if (m_argStreams[i].commandID == commandID)
+      return m_argStreams[i].stream;
+  return &m_bufferedArg;
+}
+
+// Commands not scheduled as interactive commands of the thread tier
+static struct
+{
+  command_id_t commandID;
+  command_class_t commandClass;
+  command_tier_t tier;
+} const m_commandClasses[] =
+{
+  { FAST_BLINK,         COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_URGENT },
+  { SLOW_BLINK,         COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_URGENT },
+  { ALT_BLINK,          COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_URGENT },
+  { OFF,                COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_URGENT },
+  { TIME_SYNC,          COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { TIME_STAMPING,      COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { COALESCE_RESPONSES, COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { SUBSCRIBE,          COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { RESUME,             COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { PARAMETERS,         COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { ABORT,              COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { THROUGHPUT_TEST,    COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { RX_CAPTURE,         COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { ARG_CHECKSUM,       COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { STREAM_TEST,        COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { JOURNAL_READ,       COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { UPLOAD,             COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD }
+};
+
+/*!
+ * @brief The class a command is scheduled in, and where it runs.
+ *
+ * @details Any command whose arg does not fit a small arg block is bulk,
+ * and runs in the thread tier.
+ */
+static command_class_t
+commandClassFor(command_id_t commandID, uint16_t argLength, command_tier_t *tier)
+{
+  *tier = COMMAND_TIER_THREAD;
+  if (argLength > COMMAND_ARG_POOL_SMALL_SIZE)
+    return COMMAND_CLASS_BULK;
+
+  for (uint8_t i = 0; i < sizeof(m_commandClasses) / sizeof(m_commandClasses[0]); i++)
+  {
+    if (m_commandClasses[i].commandID == commandID)
+    {
+      *tier = m_commandClasses[i].tier;
+      return m_commandClasses[i].commandClass;
+    }
+  }
+  return COMMAND_CLASS_INTERACTIVE;
+}
+
+/*!
+ * @brief Pass arg data to the receiving command's stream.
+ */
+static void
+takeArgData(uint8_t const *data, uint16_t length)
+{
+  command_rx_t *rx = receivingCommand();
+
+  if (length == 0)
+    return;
+
+  rx->argStream->chunk(data, length);
+  rx->argReceived += length;
+}
+
+/*!
+ * @brief Drop a partially received command.
+ */
+static void
+abandonCommand()
+{
+  command_rx_t *rx = receivingCommand();
+
+  NRF_LOG_INFO("Incomplete command 0x%02x dropped", rx->command.commandID);
+  statusError(COMMAND_ERROR_COMMAND_INCOMPLETE);
+  m_command.commandState = READY_FOR_COMMAND;
+  if (rx->argStream->abandon != NULL)
+    rx->argStream->abandon();
+  rxEntryRelease();
+}
+
+/*!
+ * @brief Queue the receiving command to run, behind others of its tier and
+ * class.
+ */
+static void
+commandReceived()
+{
+  command_rx_t *rx = receivingCommand();
+  command_class_queue_t *queue = (rx->tier == COMMAND_TIER_URGENT) ?
+      &m_urgentQueue : &m_classQueues[rx->commandClass];
+
+#if SIMPLE_COMMAND_DEBUG
+  command_packet_t const *command = &rx->command;
+
+  NRF_LOG_INFO("Received command:");
+  NRF_LOG_INFO("  command ID  = 0x%02x",command->commandID);
+  NRF_LOG_INFO("  arg length  = %d",command->argLength);
+  if (command->argData != NULL)
+  {
+    char argString[COMMAND_ARG_DATA_FIELD_MAX_LENGTH + 1];
+    memcpy(argString, command->argData, command->argLength);
+    argString[command->argLength] = '\0';
+    NRF_LOG_INFO("  argData = %s",argString);
+  }
+#endif
+
+  CRITICAL_REGION_ENTER();
+  queue->entries[(queue->head + queue->count) % COMMAND_RX_QUEUE_SIZE] = rx - m_rxEntries;
+  queue->count++;
+  m_rxQueueCount++;
+  CRITICAL_REGION_EXIT();
+  m_receiving = NULL;
+  m_command.commandState = READY_FOR_COMMAND;
+}
+
+/*!
+ * @brief Start receiving a command from its first write.
+ */
+static void
+receiveCommandStart(uint8_t const *raw, uint16_t rawLength)
+{
+  // Any command but RESUME first over a new link starts a new session
+  if (m_session.state == SESSION_OFFERED && raw[0] != RESUME)
+    sessionNew();
+
+  // Every command start uses a credit and a request number, whether or not
+  // it is accepted
+  m_credit.started++;
+  uint16_t request = m_session.requests++;
+
+  if (!isValidCommandID(raw[0]))
+  {
+    NRF_LOG_INFO("Invalid command ID");
+    statusError(COMMAND_ERROR_INVALID_COMMAND);
+    return;
+  }
+
+  // Command length is base-16 and passed to us as an ASCII-encoded 3-digit int
+  //
+  // Bounds check
+  uint32_t len;
+  if (rawLength < COMMAND_ID_FIELD_LENGTH + COMMAND_ARG_LENGTH_FIELD_LENGTH ||
+      !parseHexField(raw + COMMAND_ID_FIELD_LENGTH, COMMAND_ARG_LENGTH_FIELD_LENGTH, &len))
+  {
+    statusError(COMMAND_ERROR_INVALID_COMMAND);
+    return;
+  }
+
+  command_rx_t *rx = rxEntryTake();
+  if (rx == NULL)
+  {
+    NRF_LOG_INFO("Command dropped, RX queue full");
+    statusError(COMMAND_ERROR_COMMAND_DROPPED);
+    return;
+  }
+
+  m_receiving = rx;
+  m_command.commandState = DECODING_COMMAND;
+  rx->rxTicks = app_timer_cnt_get();
+  rx->command.commandID = raw[0];
+  rx->command.argClass = ARG_POOL_NO_CLASS;
+  rx->command.argData = NULL;
+  rx->command.argLength = len;
+  rx->commandClass = commandClassFor(rx->command.commandID, len, &rx->tier);
+  rx->argReceived = 0;
+  rx->argStream = argStreamFor(rx->command.commandID);
+  rx->request = request;
+  rx->carried = false;
+
+  if (!rx->argStream->begin(len))
+  {
+    statusError(COMMAND_ERROR_COMMAND_DROPPED);
+    rxEntryRelease();
+    m_command.commandState = READY_FOR_COMMAND;
+    return;
+  }
+
+  // Take what arg data came with the command; the rest follows in
+  // MORE_ARG_DATA writes.
+  uint16_t received = rawLength - COMMAND_ID_FIELD_LENGTH - COMMAND_ARG_LENGTH_FIELD_LENGTH;
+  if (received > len)
+    received = len;
+  takeArgData(raw + COMMAND_ID_FIELD_LENGTH + COMMAND_ARG_LENGTH_FIELD_LENGTH, received);
+
+  // TODO could check the length against that expected for a given command ID
+
+  if (received < len)
+  {
+    m_command.commandState = ACCEPT_ARG_DATA;
+    return;
+  }
+
+  commandReceived();
+}
+
+/*!
+ * @brief Whether a command arriving while another's arg data is still
+ * coming can be taken alongside it.
+ *
+ * @details It can if it arrives whole in one write and is of a higher class
+ * than the one being received, e.g. an interactive command in the middle of
+ * a bulk upload.
+ */
+static bool
+commandInterjects(uint8_t const *raw, uint16_t rawLength)
+{
+  uint32_t len;
+
+  if (!isValidCommandID(raw[0]) ||
+      rawLength < COMMAND_ID_FIELD_LENGTH + COMMAND_ARG_LENGTH_FIELD_LENGTH ||
+      !parseHexField(raw + COMMAND_ID_FIELD_LENGTH, COMMAND_ARG_LENGTH_FIELD_LENGTH, &len) ||
+      rawLength - COMMAND_ID_FIELD_LENGTH - COMMAND_ARG_LENGTH_FIELD_LENGTH < len)
+    return false;
+
+  command_tier_t tier;
+  return commandClassFor(raw[0], len, &tier) < receivingCommand()->commandClass;
+}
+
+/*!
+ * @brief Take a write from the central.
+ */
+static void
+receiveWrite(uint8_t const *raw, uint16_t rawLength)
+{
+  if (m_command.commandState == ACCEPT_ARG_DATA)
+  {
+    if (raw[0] == MORE_ARG_DATA)
+    {
+      command_rx_t *rx = receivingCommand();
+      uint16_t remaining = rx->command.argLength - rx->argReceived;
+      uint16_t len = rawLength - COMMAND_ID_FIELD_LENGTH;
+      if (len > remaining)
+        len = remaining;
+      takeArgData(raw + COMMAND_ID_FIELD_LENGTH, len);
+
+      if (rx->argReceived == rx->command.argLength)
+        commandReceived();
+      return;
+    }
+
+    if (commandInterjects(raw, rawLength))
+    {
+      command_rx_t *receiving = m_receiving;
+
+      m_receiving = NULL;
+      m_command.commandState = READY_FOR_COMMAND;
+      receiveCommandStart(raw, rawLength);
+      m_receiving = receiving;
+      m_command.commandState = ACCEPT_ARG_DATA;
+      return;
+    }
+
+    // Any other new command abandons the partially received one
+    abandonCommand();
+  }
+
+  // TODO just drop the command? Maybe, eventually notify the app the command failed
+  if (m_command.commandState != READY_FOR_COMMAND || raw[0] == MORE_ARG_DATA)
+    return;
+
+  receiveCommandStart(raw, rawLength);
+}
+
+void
+receiveRawCommand(uint8_t const *raw, uint16_t rawLength)
+{
+  if (rawLength == 0)
+    return;
+
+#if COMMAND_RX_CAPTURE_ENABLED
+  if (m_rxCapturing)
+  {
+    // Oldest records are overwritten once the ring is full
+    rx_capture_record_t *record = &m_rxCapture[m_rxCaptureNext];
+    record->ticks = app_timer_cnt_get();
+    record->length = (rawLength < COMMAND_RX_CAPTURE_PAYLOAD) ? rawLength : COMMAND_RX_CAPTURE_PAYLOAD;
+    memcpy(record->data, raw, record->length);
+    m_rxCaptureNext = (m_rxCaptureNext + 1) % COMMAND_RX_CAPTURE_SLOTS;
+    if (m_rxCaptureCount < COMMAND_RX_CAPTURE_SLOTS)
+      m_rxCaptureCount++;
+  }
+#endif
+
+  receiveWrite(raw, rawLength);
+  eventCount(EVENT_COUNTER_WRITES);
+
+  // A refused or abandoned command returns its credit
+  creditUpdate();
+}
+
+void
+commandCommStopped()
+{
+  m_credit.active = false;
+  // A throughput test waiting for room finds the link gone
+  throughputTestWake();
+
+  CRITICAL_REGION_ENTER();
+  // The rest of a command being received will not come
+  if (m_receiving != NULL)
+    abandonCommand();
+
+  // Everything queued or running came over the link that dropped
+  m_session.carriedCommands = 0;
+  for (uint8_t i = 0; i < COMMAND_RX_QUEUE_SIZE; i++)
+    if (m_rxEntries[i].inUse)
+    {
+      m_rxEntries[i].carried = true;
+      m_session.carriedCommands++;
+    }
+  // Urgent commands and BLE events do not preempt each other, so only a
+  // thread tier command can be caught running
+  if (m_session.threadRunning)
+  {
+    m_command.carried = true;
+    m_session.carriedCommands++;
+    responseRequest(m_command.request, true);
+  }
+
+  responseDetach();
+  m_session.state = SESSION_DETACHED;
+  m_session.paused = false;
+  CRITICAL_REGION_EXIT();
+
+#if COMMAND_JOURNAL_ENABLED
+  // So the journal survives a reset before the next connection
+  journalFlush();
+#endif
+}
+
+/*!
+ * @brief The number of responses a command queues.
+ */
+static uint8_t
+responsesNeeded(command_id_t commandID)
+{
+  switch (commandID)
+  {
+    case ECHO:
+      return 2;
+    case RESUME:
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+bool
+validCommandReceived()
+{
+  return m_rxQueueCount > 0;
+}
+
+/*!
+ * @brief The class queue to run a command from next.
+ *
+ * @details The highest priority class with a command waiting, unless a lower
+ * class has been passed over COMMAND_CLASS_PASS_LIMIT times, so a stream of
+ * interactive commands cannot hold bulk transfers off for good.
+ */
+static command_class_queue_t *
+nextClassQueue()
+{
+  command_class_queue_t *next = NULL;
+
+  for (uint8_t i = 0; i < COMMAND_CLASSES; i++)
+  {
+    command_class_queue_t *queue = &m_classQueues[i];
+    if (queue->count == 0)
+      continue;
+    if (next == NULL)
+      next = queue;
+    else if (queue->passed >= COMMAND_CLASS_PASS_LIMIT)
+      return queue;
+  }
+  return next;
+}
+
+/*!
+ * @brief Take the next command for a tier off its queue, if there is room for
+ * its responses.
+ *
+ * @details The response buffers it needs are reserved until it has run, so
+ * an urgent command preempting it cannot take them.
+ *
+ * @param tier - the tier to take a command for
+ * @param rx   - set to the command
+ * @return true if a command was taken, false otherwise
+ */
+static bool
+commandTake(command_tier_t tier, command_rx_t *rx)
+{
+  bool taken = false;
+
+  CRITICAL_REGION_ENTER();
+  command_class_queue_t *queue = (tier == COMMAND_TIER_URGENT) ? &m_urgentQueue : nextClassQueue();
+  if (queue != NULL && queue->count > 0)
+  {
+    command_rx_t *entry = &m_rxEntries[queue->entries[queue->head]];
+    uint8_t needed = responsesNeeded(entry->command.commandID);
+
+    // Earlier responses are still going out; commandTxReady() runs the
+    // command once a response buffer frees up.
+    if (responseSlotsFree() >= m_responsesReserved + needed)
+    {
+      *rx = *entry;
+      entry->inUse = false;
+      queue->head = (queue->head + 1) % COMMAND_RX_QUEUE_SIZE;
+      queue->count--;
+      queue->passed = 0;
+      m_rxQueueCount--;
+      m_responsesReserved += needed;
+
+      for (uint8_t i = rx->commandClass + 1; tier == COMMAND_TIER_THREAD && i < COMMAND_CLASSES; i++)
+        if (m_classQueues[i].count > 0 && m_classQueues[i].passed < UINT8_MAX)
+          m_classQueues[i].passed++;
+
+      taken = true;
+    }
+  }
+  CRITICAL_REGION_EXIT();
+
+  return taken;
+}
+
+/*!
+ * @brief Run a command taken off its queue.
+ */
+static void
+commandRun(command_rx_t const *rx)
+{
+  int status = COMMAND_FAILURE;
+
+  m_command.command = rx->command;
+  m_command.commandClass = rx->commandClass;
+  m_command.argStream = rx->argStream;
+  m_command.argReceived = rx->argReceived;
+  m_command.argSlot = rx->argSlot;
+  m_command.rxTicks = rx->rxTicks;
+  m_command.dispatchTicks = app_timer_cnt_get();
+  m_command.request = rx->request;
+  m_command.carried = rx->carried;
+  statusCommand(rx->command.commandID);
+  eventCount(EVENT_COUNTER_COMMANDS_RUN);
+
+  // Responses go out at the command's priority; bulk ones can be cut into
+  responsePriority(rx->commandClass, rx->commandClass == COMMAND_CLASS_BULK);
+  responseRequest(rx->request, rx->carried);
+
+  if (m_command.argStream != NULL && m_command.argStream->end != NULL)
+    status = m_command.argStream->end();
+  else switch(m_command.command.commandID)
+  {
+    case NO_COMMAND:
+      status = noCommand();
+    break;
+    case FAST_BLINK:
+      status = fastBlink();
+    break;
+    case SLOW_BLINK:
+      status = slowBlink();
+    break;
+    case ALT_BLINK:
+      status = altBlink();
+    break;
+    case OFF:
+      status = off();
+    break;
+    case THROUGHPUT_TEST:
+      status = throughputTest();
+    break;
+    case ECHO:
+      status = echo();
+    break;
+    case TIME_SYNC:
+      status = timeSync();
+    break;
+    case TIME_STAMPING:
+      status = timeStamping();
+    break;
+    case RX_CAPTURE:
+      status = rxCapture();
+    break;
+    case ARG_POOL_STATUS:
+      status = argPoolStatus();
+    break;
+    case STREAM_TEST:
+      status = streamTest();
+    break;
+    case COALESCE_RESPONSES:
+      status = coalesceResponses();
+    break;
+    case SUBSCRIBE:
+      status = subscribe();
+    break;
+    case RESUME:
+      status = resume();
+    break;
+    case PARAMETERS:
+      status = parameters();
+    break;
+    case JOURNAL_READ:
+      status = journalRead();
+    break;
+    case UPLOAD:
+      status = upload();
+    break;
+    case ABORT:
+      status = abortCommand();
+    break;
+    default:
+    break;
+  }
+
+  NRF_LOG_INFO("readerCommandExecute done");
+  releaseArgData(&m_command.command);
+
+#if COMMAND_JOURNAL_ENABLED
+  uint32_t runTicks = app_timer_cnt_diff_compute(app_timer_cnt_get(), m_command.dispatchTicks);
+  journalRecord(rx->command.commandID, (uint8_t) status, rx->request,
+                (uint32_t) (deviceTimeUsAt(m_command.dispatchTicks) / 1000),
+                (uint32_t) (((uint64_t) runTicks * 1000000) / RTC_TICKS_PER_SECOND));
+#else
+  (void) status;
+#endif
+
+  CRITICAL_REGION_ENTER();
+  m_responsesReserved -= responsesNeeded(rx->command.commandID);
+  // The link may have dropped while it ran
+  if (m_command.carried)
+    m_session.carriedCommands--;
+  CRITICAL_REGION_EXIT();
+
+  sessionResumeCheck();
+}
+
+void
+executeCommand()
+{
+  if (m_urgentQueue.count == 0)
+    return;
+
+  if (m_urgentPend != NULL)
+    m_urgentPend();
+  else
+    commandUrgentRun();
+}
+
+void
+commandUrgentRun()
+{
+  command_t preempted = m_command;
+  command_rx_t rx;
+
+  while (commandTake(COMMAND_TIER_URGENT, &rx))
+    commandRun(&rx);
+
+  // Put back the thread tier command this preempted, keeping the RX state
+  CRITICAL_REGION_ENTER();
+  preempted.commandState = m_command.commandState;
+  m_command = preempted;
+  CRITICAL_REGION_EXIT();
+  responsePriority(m_command.commandClass, m_command.commandClass == COMMAND_CLASS_BULK);
+  responseRequest(m_command.request, m_command.carried);
+
+  creditUpdate();
+}
+
+void
+commandThreadRun()
+{
+  command_rx_t rx;
+  bool ran = false;
+
+  // Commands waiting once the radio is active start after the event
+  while (!m_radioActive && commandTake(COMMAND_TIER_THREAD, &rx))
+  {
+    m_session.threadRunning = true;
+    commandRun(&rx);
+    m_session.threadRunning = false;
+    ran = true;
+  }
+
+  if (ran)
+    creditUpdate();
+}
+
+void
+commandRadioNotification(bool radioActive)
+{
+  m_radioActive = radioActive;
+
+  // Get held back responses into the SoftDevice before the anchor point
+  if (radioActive)
+    responseEventDue();
+#if COMMAND_JOURNAL_ENABLED
+  // and journal entries into flash right after the event
+  else
+    journalRadioIdle();
+#endif
+}
+
+command_id_t
+currentCommand()
+{
+  return m_lastCommand;
+}
+
+void
+setCurrentCommand(command_id_t commandID)
+{
+  statusCommand(commandID);
+}
+
+command_status_record_t
+commandStatusRecord()
+{
+  command_status_record_t record;
+
+  CRITICAL_REGION_ENTER();
+  record.command = m_lastCommand;
+  record.errors = m_statusErrors;
+  record.changes = m_statusChanges;
+  CRITICAL_REGION_EXIT();
+  return record;
+}
+
+// Constant responses, framed at compile time
+RESPONSE_CONST_DEF(m_noCommandResponse, "No Command received");
+RESPONSE_CONST_DEF(m_fastBlinkResponse, "LED blinking quickly");
+RESPONSE_CONST_DEF(m_slowBlinkResponse, "LED blinking slowly");
+RESPONSE_CONST_DEF(m_altBlinkResponse, "Alternating LEDs");
+RESPONSE_CONST_DEF(m_offResponse, "LEDs are off");
+RESPONSE_CONST_DEF(m_timeStampingOffResponse, "Time stamping off");
+RESPONSE_CONST_DEF(m_timeStampingOnResponse, "Time stamping on");
+#if COMMAND_RX_CAPTURE_ENABLED
+RESPONSE_CONST_DEF(m_rxCaptureOnResponse, "RX capture on");
+RESPONSE_CONST_DEF(m_rxCaptureOffResponse, "RX capture off");
+#else
+RESPONSE_CONST_DEF(m_rxCaptureUnavailableResponse, "RX capture not available");
+#endif
+#if !COMMAND_JOURNAL_ENABLED
+RESPONSE_CONST_DEF(m_journalUnavailableResponse, "Journal not available");
+#endif
+#if !COMMAND_UPLOAD_ENABLED
+RESPONSE_CONST_DEF(m_uploadUnavailableResponse, "Upload not available");
+#endif
+RESPONSE_CONST_DEF(m_coalescingOffResponse, "Coalescing off");
+RESPONSE_CONST_DEF(m_coalescingOnResponse, "Coalescing on");
+RESPONSE_CONST_DEF(m_abortedResponse, "Aborted response");
+RESPONSE_CONST_DEF(m_abortResponse, "Aborting (just pretending...)");
+
+int
+noCommand()
+{
+  // Check the argLength
+  if (m_command.command.argLength != 0)
+    return COMMAND_FAILURE;
+
+  // This could be anything, like data from a sensor...
+  bleEventSendConst(m_noCommandResponse);
+
+  return COMMAND_SUCCESS;
+}
+
+
+int
+fastBlink()
+{
+  // Check the argLength
+  if (m_command.command.argLength != 0)
+    return COMMAND_FAILURE;
+
+  // This could be anything, like data from a sensor...
+  bleEventSendConst(m_fastBlinkResponse);
+
+  return COMMAND_SUCCESS;
+}
+
+int
+slowBlink()
+{
+  // Check the argLength
+  if (m_command.command.argLength != 0)
+    return COMMAND_FAILURE;
+
+  // This could be anything, like data from a sensor...
+  bleEventSendConst(m_slowBlinkResponse);
+
+  return COMMAND_SUCCESS;
+}
+
+int
+altBlink()
+{
+  // Check the argLength
+  if (m_command.command.argLength != 0)
+    return COMMAND_FAILURE;
+
+  // This could be anything, like data from a sensor...
+  bleEventSendConst(m_altBlinkResponse);
+
+  return COMMAND_SUCCESS;
+}
+
+int
+off()
+{
+  // Check the argLength
+  if (m_command.command.argLength != 0)
+    return COMMAND_FAILURE;
+
+  // This could be anything, like data from a sensor...
+  bleEventSendConst(m_offResponse);
+
+  return COMMAND_SUCCESS;
+}
+
+/*!
+ * @brief Send one block of data, waiting for room while the SoftDevice
+ * notification queue is full.
+ *
+ * @details Sleeps until a notification has gone out rather than spinning on
+ * the SoftDevice, so the retry comes with BLE_CMD_EVT_TX_RDY.
+ *
+ * @param data    - the data to send
+ * @param length  - the number of bytes in @p data
+ * @param retries - incremented for each NRF_ERROR_RESOURCES refusal
+ * @return the result of the final ble_cmd_data_send(); NRF_ERROR_RESOURCES
+ *         only if the test was aborted while waiting
+ */
+static uint32_t
+sendWithRetry(char *data, uint16_t length, uint32_t *retries)
+{
+  uint32_t sendError;
+  uint16_t len;
+
+  for (;;)
+  {
+    // Cleared before sending, so a TX_RDY that comes meanwhile is not missed
+    m_throughputTest.txReady = false;
+    len = length;
+    sendError = ble_cmd_data_send(data, &len);
+    if (sendError != NRF_ERROR_RESOURCES)
+      break;
+    (*retries)++;
+
+    while (!m_throughputTest.txReady && !m_throughputTest.abort)
+      (void) sd_app_evt_wait();
+    if (m_throughputTest.abort)
+      break;
+  }
+
+  return sendError;
+}
+
+int
+throughputTest()
+{
+  uint32_t byteCount;
+
+  // Check the argLength
+  if (m_command.command.argLength != THROUGHPUT_TEST_ARG_LENGTH)
+    return COMMAND_FAILURE;
+
+  if (!parseHexField(m_command.command.argData, THROUGHPUT_TEST_COUNT_DIGITS, &byteCount) ||
+      byteCount == 0)
+    return COMMAND_FAILURE;
+
+  char pattern = m_command.command.argData[THROUGHPUT_TEST_COUNT_DIGITS];
+  if (pattern != '0' && pattern != 'I' && pattern != 'A')
+    return COMMAND_FAILURE;
+
+  // The test data goes out raw, so it needs the link to itself; urgent
+  // commands preempting it have their responses held until a block is sent
+  responseFlush();
+  responseHold(true);
+  m_throughputTest.abort = false;
+  m_throughputTest.running = true;
+
+  char block[BLE_MTU];
+  uint8_t counter = (pattern == 'I') ? THROUGHPUT_TEST_COUNTER_FIRST : 0;
+  uint32_t bytesSent = 0;
+  uint32_t retries = 0;
+  uint32_t sendError = NRF_SUCCESS;
+
+  // The RTC behind app_timer is only 24 bits wide, so accumulate the elapsed
+  // ticks block by block rather than taking one difference at the end.
+  uint32_t elapsedTicks = 0;
+  uint32_t lastTicks = app_timer_cnt_get();
+
+  while (bytesSent < byteCount && !m_throughputTest.abort)
+  {
+    // Let urgent commands' responses out whole between blocks; the host
+    // tells them from the test data by their framing
+    if (responseSlotsFree() < COMMAND_RESPONSE_BUFFER_COUNT)
+      responseFlush();
+
+    uint16_t len = (byteCount - bytesSent >= BLE_MTU) ? BLE_MTU : byteCount - bytesSent;
+    for (uint16_t i = 0; i < len; i++)
+    {
+      switch (pattern)
+      {
+        case 'I':
+          block[i] = (char) counter;
+          counter = (counter == UINT8_MAX) ? THROUGHPUT_TEST_COUNTER_FIRST : counter + 1;
+        break;
+        case 'A':
+          block[i] = 'A' + counter;
+          counter = (counter + 1) % 26;
+        break;
+        default:
+          block[i] = 0;
+        break;
+      }
+    }
+
+    sendError = sendWithRetry(block, len, &retries);
+
+    uint32_t nowTicks = app_timer_cnt_get();
+    elapsedTicks += app_timer_cnt_diff_compute(nowTicks, lastTicks);
+    lastTicks = nowTicks;
+
+    if (sendError == NRF_SUCCESS)
+      bytesSent += len;
+    else
+    {
+      if (!m_throughputTest.abort)
+        NRF_LOG_INFO("sendError =%d",sendError);
+      break;
+    }
+  }
+
+  m_throughputTest.running = false;
+  responseHold(false);
+
+  // kbit/s from RTC ticks: bits * ticks-per-second / (ticks * 1000)
+  uint32_t kbps = 0;
+  if (elapsedTicks > 0)
+    kbps = (uint32_t) (((uint64_t) bytesSent * 8 * RTC_TICKS_PER_SECOND) /
+                       ((uint64_t) elapsedTicks * 1000));
+
+  char summary[96];
+  response_builder_t builder;
+  responseBuilderInit(&builder, summary, sizeof(summary));
+  responseAppendText(&builder, "throughput:bytes=");
+  responseAppendUnsigned(&builder, bytesSent, 0);
+  responseAppendText(&builder, ",ticks=");
+  responseAppendUnsigned(&builder, elapsedTicks, 0);
+  responseAppendText(&builder, ",kbps=");
+  responseAppendUnsigned(&builder, kbps, 0);
+  responseAppendText(&builder, ",retries=");
+  responseAppendUnsigned(&builder, retries, 0);
+  if (m_throughputTest.abort)
+  {
+    responseAppendText(&builder, ",aborted");
+    sendError = NRF_SUCCESS;
+  }
+  else if (sendError != NRF_SUCCESS)
+  {
+    responseAppendText(&builder, ",error=");
+    responseAppendUnsigned(&builder, sendError, 0);
+  }
+
+  NRF_LOG_INFO("throughput test: %d bytes in %d ticks, %d retries", bytesSent, elapsedTicks, retries);
+
+  bleEventSendBuilt(&builder);
+
+  return sendError == NRF_SUCCESS ? COMMAND_SUCCESS : COMMAND_FAILURE;
+}
+
+/*!
+ * @brief An echo's timestamps, kept until they have been sent.
+ *
+ * @field echoing       - true until the echoed data is finished with
+ * @field stamping      - true until the timestamps are finished with
+ * @field blockClass    - the arg pool class of the echoed block
+ * @field rxTicks       - RTC ticks when the command's first write arrived
+ * @field dispatchTicks - RTC ticks when the command was dispatched
+ * @field sent          - true if the SoftDevice took the echoed data
+ * @field sentTicks     - RTC ticks when it took the first notification of it
+ * @field offset        - the bytes of the timestamps supplied so far
+ */
+typedef struct
+{
+  bool echoing;
+  bool stamping;
+  uint8_t blockClass;
+  uint32_t rxTicks;
+  uint32_t dispatchTicks;
+  bool sent;
+  uint32_t sentTicks;
+  uint16_t offset;
+} echo_stamps_t;
+
+// Each one in use holds a response slot, so there are enough
+static echo_stamps_t m_echoStamps[COMMAND_RESPONSE_BUFFER_COUNT];
+
+/*!
+ * @brief Take free echo timestamps.
+ *
+ * @return the timestamps, or NULL if none are free
+ */
+static echo_stamps_t *
+echoStampsTake(void)
+{
+  echo_stamps_t *stamps = NULL;
+
+  CRITICAL_REGION_ENTER();
+  for (uint8_t i = 0; i < COMMAND_RESPONSE_BUFFER_COUNT && stamps == NULL; i++)
+  {
+    if (!m_echoStamps[i].echoing && !m_echoStamps[i].stamping)
+    {
+      stamps = &m_echoStamps[i];
+      stamps->echoing = true;
+      stamps->stamping = true;
+    }
+  }
+  CRITICAL_REGION_EXIT();
+
+  return stamps;
+}
+
+/*!
+ * @brief Return an echoed arg block to the pool once it has been sent, noting
+ * when its first notification went.
+ */
+static void
+echoDone(void const *data, void *context)
+{
+  echo_stamps_t *stamps = context;
+
+  argPoolFree(stamps->blockClass, (uint8_t *) data);
+  stamps->sent = responseSent(&stamps->sentTicks);
+  stamps->echoing = false;
+}
+
+/*!
+ * @brief Supply an echo's timestamps.
+ *
+ * @details Called only once the echoed data before it has been sent, so
+ * the time its first notification went is known.
+ */
+static uint16_t
+echoStampsGenerate(uint8_t *buffer, uint16_t size, void *context)
+{
+  echo_stamps_t *stamps = context;
+  char timestamps[ECHO_STAMPS_LENGTH];
+  response_builder_t builder;
+
+  responseBuilderInit(&builder, timestamps, sizeof(timestamps));
+  responseAppendText(&builder, "echo:rx=");
+  responseAppendUnsigned(&builder, stamps->rxTicks, ECHO_TICKS_DIGITS);
+  responseAppendText(&builder, ",dispatch=");
+  responseAppendUnsigned(&builder, stamps->dispatchTicks, ECHO_TICKS_DIGITS);
+  responseAppendText(&builder, ",queued=");
+  if (stamps->sent)
+    responseAppendUnsigned(&builder, stamps->sentTicks, ECHO_TICKS_DIGITS);
+  else
+  {
+    responseAppendText(&builder, "none");
+    while (builder.length < ECHO_STAMPS_LENGTH)
+      responseAppendText(&builder, " ");
+  }
+
+  uint16_t length = ECHO_STAMPS_LENGTH - stamps->offset;
+  if (length > size)
+    length = size;
+  memcpy(buffer, timestamps + stamps->offset, length);
+  stamps->offset += length;
+  return length;
+}
+
+static void
+echoStampsDone(void const *data, void *context)
+{
+  echo_stamps_t *stamps = context;
+
+  stamps->stamping = false;
+}
+
+int
+echo()
+{
+  // The payload goes back unchanged, so any argLength is fine. Hand the
+  // arg block over to the response rather than copying it.
+  uint8_t *block = m_command.command.argData;
+  uint8_t blockClass = m_command.command.argClass;
+  m_command.command.argData = NULL;
+  m_command.command.argClass = ARG_POOL_NO_CLASS;
+
+  // Every response slot holds an echo's response, so both would be dropped
+  echo_stamps_t *stamps = echoStampsTake();
+  if (stamps == NULL)
+  {
+    argPoolFree(blockClass, block);
+    statusError(COMMAND_ERROR_RESPONSE_DROPPED);
+    return COMMAND_SUCCESS;
+  }
+
+  stamps->blockClass = blockClass;
+  stamps->rxTicks = m_command.rxTicks;
+  stamps->dispatchTicks = m_command.dispatchTicks;
+  stamps->sent = false;
+  stamps->offset = 0;
+
+  // The timestamps are generated once the echo has gone, right behind it
+  responseQueuedForCommand(responseSendStatic(NULL, block, m_command.command.argLength,
+      echoDone, stamps));
+  responseQueuedForCommand(responseStart(ECHO_STAMPS_LENGTH, echoStampsGenerate,
+      echoStampsDone, stamps));
+
+  return COMMAND_SUCCESS;
+}
+
+int
+timeSync()
+{
+  uint32_t high, low, delay = 0;
+
+  // Check the argLength
+  if (m_command.command.argLength != TIME_SYNC_TIME_DIGITS &&
+      m_command.command.argLength != TIME_SYNC_TIME_DIGITS + TIME_SYNC_DELAY_DIGITS)
+    return COMMAND_FAILURE;
+
+  uint8_t const *arg = m_command.command.argData;
+  if (!parseHexField(arg, TIME_SYNC_TIME_DIGITS / 2, &high) ||
+      !parseHexField(arg + TIME_SYNC_TIME_DIGITS / 2, TIME_SYNC_TIME_DIGITS / 2, &low))
+    return COMMAND_FAILURE;
+
+  if (m_command.command.argLength > TIME_SYNC_TIME_DIGITS &&
+      !parseHexField(arg + TIME_SYNC_TIME_DIGITS, TIME_SYNC_DELAY_DIGITS, &delay))
+    return COMMAND_FAILURE;
 
-void
-bleEventInitiate(char *message)
-{
-  // Determine how much data and send notification
-  uint16_t msgLength = strlen(message);
-  uint16_t len;
+  int64_t hostSendUs = (int64_t) (((uint64_t) high << 32) | low);
+  int64_t deviceRxUs = deviceTimeUsAt(m_command.rxTicks);
 
-  char dataAvailable[64];
-  sprintf(dataAvailable, "dataAvailable:%04d", msgLength);
-  uint16_t dataAvailableLength = strlen(dataAvailable);
-  uint32_t sendError = ble_cmd_data_send(dataAvailable, &dataAvailableLength);
-  if (sendError != 0)
-    NRF_LOG_INFO("sendError =%d",sendError);
-
-  uint16_t bytesToSend = msgLength;
-  char * msgPtr = message;
-  while (bytesToSend > 0) {
-    if (bytesToSend >= BLE_MTU) {
-      len = BLE_MTU;
-      sendError = ble_cmd_data_send(msgPtr, &len);
-      if (sendError != 0)
-        NRF_LOG_INFO("sendError =%d",sendError);
-      bytesToSend -= BLE_MTU;
-      msgPtr += BLE_MTU;
-    } else {
-      len = bytesToSend;
-      sendError = ble_cmd_data_send(msgPtr,  &len);
-      if (sendError != 0)
-        NRF_LOG_INFO("sendError =%d",sendError);
-      bytesToSend = 0;
-    }
-    nrf_delay_ms(10);
-  }
-}
+  // Response stamps read the sync from whichever tier is sending
+  CRITICAL_REGION_ENTER();
+  timeSyncAddSample(&m_timeSync, hostSendUs + delay, deviceRxUs);
+  CRITICAL_REGION_EXIT();
 
-void
-commandInit()
-{
-  m_command.initialized = true;
-  m_command.commandState = READY_FOR_COMMAND;
-  m_command.rawCommandReceived = false;
-  m_command.commandValid = false;
+  char response[96];
+  response_builder_t builder;
+  responseBuilderInit(&builder, response, sizeof(response));
+  responseAppendText(&builder, "timeSync:t1=");
+  responseAppendHex(&builder, (uint64_t) hostSendUs, 0);
+  responseAppendText(&builder, ",t2=");
+  responseAppendHex(&builder, (uint64_t) deviceRxUs, 0);
+  responseAppendText(&builder, ",t3=");
+  responseAppendHex(&builder, (uint64_t) deviceTimeUsAt(app_timer_cnt_get()), 0);
+  responseAppendText(&builder, ",skew=");
+  responseAppendSigned(&builder, m_timeSync.skewPpb);
+
+  bleEventSendBuilt(&builder);
+
+  return COMMAND_SUCCESS;
 }
 
-void
-receiveRawCommand(uint8_t const *raw, uint16_t rawLength)
+int
+timeStamping()
 {
-  // TODO just drop the command? Maybe, eventually notify the app the command failed
-  if (m_command.commandState != READY_FOR_COMMAND)
-    return;
+  // Check the argLength
+  if (m_command.command.argLength != 1)
+    return COMMAND_FAILURE;
 
-  // TODO the state used to be useful when there were chunked commands, but perhaps no longer...
-  m_command.commandState = DECODING_COMMAND;
-  m_command.commandValid = false,
+  switch (m_command.command.argData[0])
+  {
+    case '0':
+      m_timeStamping = false;
+      bleEventSendConst(m_timeStampingOffResponse);
+    break;
+    case '1':
+      m_timeStamping = true;
+      bleEventSendConst(m_timeStampingOnResponse);
+    break;
+    default:
+      return COMMAND_FAILURE;
+  }
+#if COMMAND_RETAIN_ENABLED
+  retainTimeStamping(m_timeStamping);
+#endif
 
+  return COMMAND_SUCCESS;
+}
 
-  m_command.command.commandID = raw[0];
+#if COMMAND_RX_CAPTURE_ENABLED
+// Position of the RX capture dump
+static struct
+{
+  uint8_t oldest;
+  uint8_t record;
+  uint8_t offset;
+  bool    active;
+} m_rxCaptureDump;
 
-  if (!isValidCommandID())
-  {
-    m_command.commandState = READY_FOR_COMMAND;
-    m_command.rawCommandReceived = false;
-    NRF_LOG_INFO("Invalid command ID");
-    return;
-  }
-  // Command length is base-16 and passed to us as an ASCII-encoded 3-digit int
-  //
-  // Bounds check
-  if (!(isASCIIHexDigit(raw[1]) &&
-      isASCIIHexDigit(raw[2]) &&
-      isASCIIHexDigit(raw[3])))
+/*!
+ * @brief Supply the captured writes, oldest first, as records of ticks
+ * (little endian), length and data.
+ */
+static uint16_t
+rxCaptureGenerate(uint8_t *buffer, uint16_t size, void *context)
+{
+  uint16_t length = 0;
+
+  while (length < size && m_rxCaptureDump.record < m_rxCaptureCount)
   {
-    m_command.commandState = READY_FOR_COMMAND;
-    m_command.rawCommandReceived = false;
-    return;
-  }
+    rx_capture_record_t const *record =
+        &m_rxCapture[(m_rxCaptureDump.oldest + m_rxCaptureDump.record) % COMMAND_RX_CAPTURE_SLOTS];
+    uint8_t header[sizeof(record->ticks) + sizeof(record->length)] =
+    {
+      record->ticks & 0xFF, (record->ticks >> 8) & 0xFF,
+      (record->ticks >> 16) & 0xFF, (record->ticks >> 24) & 0xFF,
+      record->length
+    };
 
-  char hex[4];
-  hex[0] = raw[1];
-  hex[1] = raw[2];
-  hex[2] = raw[3];
-  hex[3] = '\0';
-  uint16_t len = (uint16_t)strtol(hex, NULL, 16);
-  m_command.command.argLength = len;
-  strncpy((char *) (m_command.command.argData), (char *)(raw+4), len);
+    uint8_t offset = m_rxCaptureDump.offset++;
+    buffer[length++] = (offset < sizeof(header)) ? header[offset] : record->data[offset - sizeof(header)];
 
-  // TODO could check the length against that expected for a given command ID
+    if (m_rxCaptureDump.offset == sizeof(header) + record->length)
+    {
+      m_rxCaptureDump.record++;
+      m_rxCaptureDump.offset = 0;
+    }
+  }
 
-#if SIMPLE_COMMAND_DEBUG
-  char argString[4096];
-  strncpy(argString, ((char *)raw)+4, len);
-  argString[len] = '\0';
-  NRF_LOG_INFO("Received command:");
-  NRF_LOG_INFO("  command ID  = 0x%02x",m_command.command.commandID);
-  NRF_LOG_INFO("  arg length  = %d",m_command.command.argLength);
-  NRF_LOG_INFO("  argData = %s",argString);
-#endif
+  return length;
+}
 
-  m_command.commandValid = true;
-  m_command.commandState = READY_FOR_COMMAND;
-  m_command.rawCommandReceived = true;
+static void
+rxCaptureDumpDone(void const *data, void *context)
+{
+  m_rxCaptureDump.active = false;
 }
 
-bool
-validCommandReceived()
+/*!
+ * @brief Send the captured writes as one dataAvailable framed response.
+ */
+static bool
+rxCaptureDump()
 {
-  return m_command.rawCommandReceived == true &&
-      m_command.commandValid == true;
+  uint16_t dumpLength = 0;
+
+  // The dump reads the ring as it goes out, so only one at a time
+  if (m_rxCaptureDump.active)
+    return false;
+
+  m_rxCapturing = false;
+  m_rxCaptureDump.oldest = (m_rxCaptureCount == COMMAND_RX_CAPTURE_SLOTS) ? m_rxCaptureNext : 0;
+  m_rxCaptureDump.record = 0;
+  m_rxCaptureDump.offset = 0;
+
+  for (uint8_t i = 0; i < m_rxCaptureCount; i++)
+    dumpLength += sizeof(m_rxCapture[i].ticks) + sizeof(m_rxCapture[i].length) + m_rxCapture[i].length;
+
+  m_rxCaptureDump.active = true;
+  return responseStart(dumpLength, rxCaptureGenerate, rxCaptureDumpDone, NULL);
 }
+#endif
 
-void
-executeCommand()
+int
+rxCapture()
 {
-  m_command.rawCommandReceived = false;
+#if COMMAND_RX_CAPTURE_ENABLED
+  // Check the argLength
+  if (m_command.command.argLength != 1)
+    return COMMAND_FAILURE;
 
-  switch(m_command.command.commandID)
+  switch (m_command.command.argData[0])
   {
-    case NO_COMMAND:
-      noCommand();
-    break;
-    case FAST_BLINK:
-      fastBlink();
-    break;
-    case SLOW_BLINK:
-      slowBlink();
-    break;
-    case ALT_BLINK:
-      altBlink();
+    case '1':
+      m_rxCaptureNext = 0;
+      m_rxCaptureCount = 0;
+      m_rxCapturing = true;
+      bleEventSendConst(m_rxCaptureOnResponse);
     break;
-    case OFF:
-      off();
+    case '0':
+      m_rxCapturing = false;
+      bleEventSendConst(m_rxCaptureOffResponse);
     break;
-    case ABORT:
-      abortCommand();
+    case 'D':
+      if (!rxCaptureDump())
+        return COMMAND_FAILURE;
     break;
     default:
-    break;
+      return COMMAND_FAILURE;
   }
 
-  NRF_LOG_INFO("readerCommandExecute done");
-  m_command.commandState = READY_FOR_COMMAND;
-  m_command.commandValid = false;
+  return COMMAND_SUCCESS;
+#else
+  bleEventSendConst(m_rxCaptureUnavailableResponse);
+  return COMMAND_FAILURE;
+#endif
 }
 
-command_id_t
-currentCommand()
+int
+argPoolStatus()
+{
+  // Check the argLength
+  if (m_command.command.argLength != 0)
+    return COMMAND_FAILURE;
+
+  char status[96];
+  response_builder_t builder;
+  responseBuilderInit(&builder, status, sizeof(status));
+  responseAppendText(&builder, "argPool:");
+  uint32_t failures = 0;
+  arg_pool_stats_t stats;
+  for (uint8_t i = 0; argPoolStats(i, &stats); i++)
+  {
+    responseAppendUnsigned(&builder, stats.blockSize, 0);
+    responseAppendText(&builder, "=");
+    responseAppendUnsigned(&builder, stats.inUse, 0);
+    responseAppendText(&builder, "/");
+    responseAppendUnsigned(&builder, stats.blockCount, 0);
+    responseAppendText(&builder, "/");
+    responseAppendUnsigned(&builder, stats.highWater, 0);
+    responseAppendText(&builder, ",");
+    failures += stats.failures;
+  }
+  responseAppendText(&builder, "fail=");
+  responseAppendUnsigned(&builder, failures, 0);
+
+  bleEventSendBuilt(&builder);
+
+  return COMMAND_SUCCESS;
+}
+
+// STREAM_TEST state
+static struct
+{
+  uint32_t remaining;
+  uint32_t sent;
+  char pattern;
+  bool active;
+} m_streamTest;
+
+static void
+streamTestDone(void const *data, void *context)
 {
-  return m_command.command.commandID;
+  m_streamTest.active = false;
 }
 
-void
-setCurrentCommand(command_id_t commandID)
+static uint16_t
+streamTestGenerate(uint8_t *buffer, uint16_t size, void *context)
 {
-  m_command.command.commandID = commandID;
+  uint16_t length = (m_streamTest.remaining < size) ? m_streamTest.remaining : size;
+
+  for (uint16_t i = 0; i < length; i++, m_streamTest.sent++)
+  {
+    switch (m_streamTest.pattern)
+    {
+      case 'I':
+        buffer[i] = m_streamTest.sent & 0xFF;
+      break;
+      case 'A':
+        buffer[i] = 'A' + (m_streamTest.sent % 26);
+      break;
+      default:
+        buffer[i] = '0';
+      break;
+    }
+  }
+  m_streamTest.remaining -= length;
+
+  return length;
 }
 
 int
-noCommand()
+streamTest()
 {
+  uint32_t byteCount;
+
   // Check the argLength
-  if (m_command.command.argLength != 0)
+  if (m_command.command.argLength != STREAM_TEST_ARG_LENGTH)
     return COMMAND_FAILURE;
 
-  // This could be anything, like data from a sensor...
-  bleEventInitiate("No Command received");
+  if (!parseHexField(m_command.command.argData, STREAM_TEST_COUNT_DIGITS, &byteCount))
+    return COMMAND_FAILURE;
+
+  // One generated stream at a time
+  if (m_streamTest.active)
+    return COMMAND_FAILURE;
+
+  m_streamTest.active = true;
+  m_streamTest.remaining = byteCount;
+  m_streamTest.sent = 0;
+  m_streamTest.pattern = m_command.command.argData[STREAM_TEST_COUNT_DIGITS];
+
+  if (!responseStart(byteCount, streamTestGenerate, streamTestDone, NULL))
+    return COMMAND_FAILURE;
+  responseQueuedForCommand(true);
 
   return COMMAND_SUCCESS;
 }
 
+int
+argChecksum()
+{
+  char checksum[64];
+  response_builder_t builder;
+  responseBuilderInit(&builder, checksum, sizeof(checksum));
+  responseAppendText(&builder, "argChecksum:len=");
+  responseAppendUnsigned(&builder, m_command.argReceived, 0);
+  responseAppendText(&builder, ",fletcher=");
+  responseAppendHex(&builder, (m_checksumSum2 << 16) | m_checksumSum1, 8);
+  responseAppendText(&builder, ",ticks=");
+  responseAppendUnsigned(&builder, app_timer_cnt_diff_compute(m_checksumLastTicks, m_command.rxTicks), 0);
+
+  bleEventSendBuilt(&builder);
+
+  // The next checksum may start arriving while this one runs in the thread
+  // tier, so the sums are only free once they have been read
+  m_checksumBusy = false;
+
+  return COMMAND_SUCCESS;
+}
 
 int
-fastBlink()
+coalesceResponses()
 {
+  uint32_t delayMs = paramGet(PARAM_COALESCE_DELAY_MS);
+
   // Check the argLength
-  if (m_command.command.argLength != 0)
+  if (m_command.command.argLength != 1 && m_command.command.argLength != 1 + COALESCE_DELAY_DIGITS)
     return COMMAND_FAILURE;
 
-  // This could be anything, like data from a sensor...
-  bleEventInitiate("LED blinking quickly");
+  switch (m_command.command.argData[0])
+  {
+    case '0':
+      if (m_command.command.argLength != 1)
+        return COMMAND_FAILURE;
+      responseCoalesce(false, 0);
+#if COMMAND_RETAIN_ENABLED
+      retainCoalescing(false, 0);
+#endif
+      bleEventSendConst(m_coalescingOffResponse);
+    break;
+    case '1':
+      if (m_command.command.argLength > 1 &&
+          !parseHexField(m_command.command.argData + 1, COALESCE_DELAY_DIGITS, &delayMs))
+        return COMMAND_FAILURE;
+      responseCoalesce(true, delayMs);
+#if COMMAND_RETAIN_ENABLED
+      retainCoalescing(true, delayMs);
+#endif
+      bleEventSendConst(m_coalescingOnResponse);
+    break;
+    default:
+      return COMMAND_FAILURE;
+  }
 
   return COMMAND_SUCCESS;
 }
 
 int
-slowBlink()
+subscribe()
 {
+  uint16_t argLength = m_command.command.argLength;
+  uint8_t const *arg = m_command.command.argData;
+  uint32_t types[SUBSCRIPTION_TYPES];
+  uint32_t intervals[SUBSCRIPTION_TYPES];
+  uint8_t groups = argLength / SUBSCRIBE_GROUP_LENGTH;
+
   // Check the argLength
-  if (m_command.command.argLength != 0)
+  if (argLength == 0 || argLength % SUBSCRIBE_GROUP_LENGTH != 0 || groups > SUBSCRIPTION_TYPES)
     return COMMAND_FAILURE;
 
-  // This could be anything, like data from a sensor...
-  bleEventInitiate("LED blinking slowly");
+  // Apply none unless all are valid
+  for (uint8_t i = 0; i < groups; i++)
+  {
+    uint8_t const *group = arg + i * SUBSCRIBE_GROUP_LENGTH;
+    if (!parseHexField(group, SUBSCRIBE_TYPE_DIGITS, &types[i]) ||
+        !parseHexField(group + SUBSCRIBE_TYPE_DIGITS, SUBSCRIBE_INTERVAL_DIGITS, &intervals[i]) ||
+        types[i] < SUBSCRIPTION_STATE || types[i] > SUBSCRIPTION_COUNTERS)
+      return COMMAND_FAILURE;
+  }
+
+  uint8_t active;
+  CRITICAL_REGION_ENTER();
+  uint64_t now = deviceTicks();
+  for (uint8_t i = 0; i < groups; i++)
+    subscriptionSet(&m_subscriptions, (subscription_type_t) types[i],
+                    (intervals[i] == SUBSCRIBE_INTERVAL_OFF) ? SUBSCRIPTION_OFF : APP_TIMER_TICKS(intervals[i]),
+                    now);
+  active = subscriptionsActive(&m_subscriptions);
+  CRITICAL_REGION_EXIT();
+
+  char message[16];
+  response_builder_t builder;
+  responseBuilderInit(&builder, message, sizeof(message));
+  responseAppendText(&builder, "subscribed:");
+  responseAppendHex(&builder, active, 2);
+  bleEventSendBuilt(&builder);
+
+  // Report the types just subscribed to
+  subscriptionsKick();
 
   return COMMAND_SUCCESS;
 }
 
 int
-altBlink()
+resume()
+{
+  uint32_t token;
+  bool valid = m_command.command.argLength == RESUME_TOKEN_DIGITS &&
+      parseHexField(m_command.command.argData, RESUME_TOKEN_DIGITS, &token);
+
+  CRITICAL_REGION_ENTER();
+  if (valid && m_session.state == SESSION_OFFERED && token == m_session.token)
+  {
+    m_session.state = SESSION_RESUMING;
+    responseCarry(true);
+    responseRequestNotice(sessionNoticeBuild);
+  }
+  else
+    sessionNew();
+  CRITICAL_REGION_EXIT();
+
+  sessionResumeCheck();
+  return valid ? COMMAND_SUCCESS : COMMAND_FAILURE;
+}
+
+/*!
+ * @brief Append a parameter's ID and value, and its range and default if
+ * asked for.
+ */
+static void
+appendParameter(response_builder_t *builder, param_id_t id, bool info)
+{
+  responseAppendHex(builder, id, PARAMETER_ID_DIGITS);
+  responseAppendHex(builder, paramGet(id), PARAMETER_VALUE_DIGITS);
+  if (!info)
+    return;
+
+  param_info_t const *limits = paramInfo(id);
+  responseAppendText(builder, " min:");
+  responseAppendHex(builder, limits->min, PARAMETER_VALUE_DIGITS);
+  responseAppendText(builder, " max:");
+  responseAppendHex(builder, limits->max, PARAMETER_VALUE_DIGITS);
+  responseAppendText(builder, " default:");
+  responseAppendHex(builder, limits->byDefault, PARAMETER_VALUE_DIGITS);
+}
+
+int
+parameters()
 {
+  uint16_t argLength = m_command.command.argLength;
+  uint8_t const *arg = m_command.command.argData;
+  uint32_t id;
+  uint32_t value;
+
+  char message[COMMAND_RESPONSE_BUFFER_SIZE];
+  response_builder_t builder;
+  responseBuilderInit(&builder, message, sizeof(message));
+
+  // No arg lists them all
+  if (argLength == 0)
+  {
+    responseAppendText(&builder, "params:");
+    for (uint8_t i = 1; i <= PARAM_COUNT; i++)
+      appendParameter(&builder, (param_id_t) i, false);
+    bleEventSendBuilt(&builder);
+    return COMMAND_SUCCESS;
+  }
+
   // Check the argLength
-  if (m_command.command.argLength != 0)
+  if (argLength != PARAMETER_ID_DIGITS && argLength != PARAMETER_ID_DIGITS + PARAMETER_VALUE_DIGITS)
     return COMMAND_FAILURE;
 
-  // This could be anything, like data from a sensor...
-  bleEventInitiate("Alternating LEDs");
+  if (!parseHexField(arg, PARAMETER_ID_DIGITS, &id) || paramInfo((param_id_t) id) == NULL)
+    return COMMAND_FAILURE;
+
+  if (argLength > PARAMETER_ID_DIGITS &&
+      (!parseHexField(arg + PARAMETER_ID_DIGITS, PARAMETER_VALUE_DIGITS, &value) ||
+       !paramSet((param_id_t) id, value)))
+    return COMMAND_FAILURE;
+
+  responseAppendText(&builder, "param:");
+  appendParameter(&builder, (param_id_t) id, true);
+  bleEventSendBuilt(&builder);
 
   return COMMAND_SUCCESS;
 }
 
+#if COMMAND_JOURNAL_ENABLED
+// Position of the journal read
+static struct
+{
+  uint32_t sequence;
+  uint32_t end;
+  uint8_t  data[sizeof(journal_entry_t)];
+  uint8_t  length;
+  uint8_t  offset;
+  bool     active;
+} m_journalRead;
+
+/*!
+ * @brief Supply the header and then the journal entries kept, in order.
+ */
+static uint16_t
+journalReadGenerate(uint8_t *buffer, uint16_t size, void *context)
+{
+  uint16_t length = 0;
+
+  while (length < size)
+  {
+    if (m_journalRead.offset == m_journalRead.length)
+    {
+      journal_entry_t entry;
+      if (m_journalRead.sequence == m_journalRead.end)
+        break;
+      if (!journalEntry(m_journalRead.sequence++, &entry))
+        continue;
+      memcpy(m_journalRead.data, &entry, sizeof(entry));
+      m_journalRead.length = sizeof(entry);
+      m_journalRead.offset = 0;
+    }
+    buffer[length++] = m_journalRead.data[m_journalRead.offset++];
+  }
+
+  return length;
+}
+
+static void
+journalReadDone(void const *data, void *context)
+{
+  m_journalRead.active = false;
+}
+#endif
+
 int
-off()
+journalRead()
 {
+#if COMMAND_JOURNAL_ENABLED
+  uint32_t start = 0;
+
   // Check the argLength
-  if (m_command.command.argLength != 0)
+  if (m_command.command.argLength != 0 && m_command.command.argLength != JOURNAL_SEQUENCE_DIGITS)
     return COMMAND_FAILURE;
 
-  // This could be anything, like data from a sensor...
-  bleEventInitiate("LEDs are off");
+  if (m_command.command.argLength != 0 &&
+      !parseHexField(m_command.command.argData, JOURNAL_SEQUENCE_DIGITS, &start))
+    return COMMAND_FAILURE;
+
+  // The read goes out as the stream is sent, so only one at a time
+  if (m_journalRead.active)
+    return COMMAND_FAILURE;
+
+  // Entries recorded from here on, this read's among them, wait for the next
+  uint32_t next = journalNext();
+  uint32_t dropped = journalDropped();
+  uint32_t oldest = journalOldest();
+  if (start < oldest)
+    start = oldest;
+  m_journalRead.sequence = (start < next) ? start : next;
+  m_journalRead.end = next;
+  memcpy(m_journalRead.data, &next, sizeof(next));
+  memcpy(m_journalRead.data + sizeof(next), &dropped, sizeof(dropped));
+  m_journalRead.length = sizeof(next) + sizeof(dropped);
+  m_journalRead.offset = 0;
+  m_journalRead.active = true;
+
+  if (!responseStart(RESPONSE_LENGTH_UNKNOWN, journalReadGenerate, journalReadDone, NULL))
+    return COMMAND_FAILURE;
+  responseQueuedForCommand(true);
+#else
+  bleEventSendConst(m_journalUnavailableResponse);
+#endif
 
   return COMMAND_SUCCESS;
 }
 
+#if COMMAND_UPLOAD_ENABLED
+/*!
+ * @brief Wait for the upload's flash operation to end.
+ *
+ * @details It ends in the SoC event handler; the thread tier can afford to
+ * wait, asleep, BLE events and urgent commands getting in meanwhile.
+ */
+static void
+uploadWait(void)
+{
+  while (uploadBusy())
+    (void) sd_app_evt_wait();
+}
+
+/*!
+ * @brief Run an UPLOAD op from its slot.
+ */
+static bool
+uploadOp(upload_slot_t const *slot, uint32_t *block, response_builder_t *builder)
+{
+  uint32_t value;
+  uint32_t crc;
+
+  switch (slot->header[0])
+  {
+    case UPLOAD_OP_START:
+      if (slot->argLength != UPLOAD_HEADER_LENGTH ||
+          !parseHexField(slot->header + 1, UPLOAD_VALUE_DIGITS, &value) ||
+          !parseHexField(slot->header + 1 + UPLOAD_VALUE_DIGITS, UPLOAD_VALUE_DIGITS, &crc) ||
+          !uploadStart(value, crc))
+        return false;
+
+      // All the erasing is done before the first block
+      uploadWait();
+    break;
+
+    case UPLOAD_OP_BLOCK:
+    {
+      if (slot->argLength <= UPLOAD_HEADER_LENGTH || uploadSize() == 0 ||
+          !parseHexField(slot->header + 1, UPLOAD_VALUE_DIGITS, &value) ||
+          !parseHexField(slot->header + 1 + UPLOAD_VALUE_DIGITS, UPLOAD_VALUE_DIGITS, &crc))
+        return false;
+
+      // A block out of place, sent again or corrupted is not written; the
+      // response says where to carry on from
+      uint16_t length = slot->argLength - UPLOAD_HEADER_LENGTH;
+      if (value != uploadNext() || crc32_compute((uint8_t const *) block, length, NULL) != crc)
+      {
+        NRF_LOG_INFO("Upload block at 0x%x skipped", value);
+        break;
+      }
+
+      memset((uint8_t *) block + length, 0xFF, (sizeof(uint32_t) - length % sizeof(uint32_t)) % sizeof(uint32_t));
+      uploadWait();
+      if (!uploadWrite(block, value, length))
+        return false;
+
+      // The block's buffer is free for the block after next once written
+      uploadWait();
+    }
+    break;
+
+    case UPLOAD_OP_FINISH:
+    {
+      if (slot->argLength != 1)
+        return false;
+
+      uploadWait();
+      bool verified = uploadVerify(&crc);
+      responseAppendText(builder, "upload:next=");
+      responseAppendHex(builder, uploadNext(), UPLOAD_VALUE_DIGITS);
+      responseAppendText(builder, ",crc=");
+      responseAppendHex(builder, crc, UPLOAD_VALUE_DIGITS);
+      responseAppendText(builder, verified ? ",ok" : ",bad");
+    }
+    return true;
+
+    default:
+      return false;
+  }
+
+  if (uploadFailed())
+    return false;
+  responseAppendText(builder, "upload:next=");
+  responseAppendHex(builder, uploadNext(), UPLOAD_VALUE_DIGITS);
+  return true;
+}
+#endif
+
+int
+upload()
+{
+#if COMMAND_UPLOAD_ENABLED
+  char text[48];
+  response_builder_t builder;
+  responseBuilderInit(&builder, text, sizeof(text));
+
+  uint8_t index = m_command.argSlot;
+  bool done = uploadOp(&m_upload.slots[index], m_upload.blocks[index], &builder);
+  uploadSlotRelease(index);
+
+  if (!done)
+    return COMMAND_FAILURE;
+  bleEventSendBuilt(&builder);
+#else
+  bleEventSendConst(m_uploadUnavailableResponse);
+#endif
+
+  return COMMAND_SUCCESS;
+}
 
 int
 abortCommand()
@@ -266,8 +2756,21 @@ abortCommand()
   if (m_command.command.argLength != 0)
     return COMMAND_FAILURE;
 
+  if (m_throughputTest.running)
+  {
+    m_throughputTest.abort = true;
+    bleEventSendConst(m_abortedResponse);
+    return COMMAND_SUCCESS;
+  }
+
+  if (responseCancel())
+  {
+    bleEventSendConst(m_abortedResponse);
+    return COMMAND_SUCCESS;
+  }
+
   // This could be anything, like data from a sensor...
-  bleEventInitiate("Aborting (just pretending...)");
+  bleEventSendConst(m_abortResponse);
 
   // TODO for now
   return COMMAND_SUCCESS;
@@ -282,15 +2785,56 @@ bool isASCIIHexDigit(char c)
   return okay;
 }
 
+/*!
+ * @brief Parse a fixed-width field of ASCII-encoded hex digits.
+ *
+ * @param field  - pointer to the first digit
+ * @param digits - the number of digits in the field [1,8]
+ * @param value  - the parsed value
+ * @return true if every digit is valid hex, false otherwise
+ */
+bool
+parseHexField(uint8_t const *field, uint8_t digits, uint32_t *value)
+{
+  uint32_t v = 0;
+  for (uint8_t i = 0; i < digits; i++)
+  {
+    char c = field[i];
+    if (!isASCIIHexDigit(c))
+      return false;
+    v <<= 4;
+    if (c <= '9')
+      v |= c - '0';
+    else
+      v |= (c & ~0x20) - 'A' + 10;
+  }
+  *value = v;
+  return true;
+}
+
 bool
-isValidCommandID()
+isValidCommandID(command_id_t commandID)
 {
   bool valid =
-      m_command.command.commandID == NO_COMMAND ||
-      m_command.command.commandID == FAST_BLINK ||
-      m_command.command.commandID == SLOW_BLINK ||
-      m_command.command.commandID == ALT_BLINK ||
-      m_command.command.commandID == OFF ||
-      m_command.command.commandID == ABORT;
+      commandID == NO_COMMAND ||
+      commandID == FAST_BLINK ||
+      commandID == SLOW_BLINK ||
+      commandID == ALT_BLINK ||
+      commandID == OFF ||
+      commandID == THROUGHPUT_TEST ||
+      commandID == ECHO ||
+      commandID == TIME_SYNC ||
+      commandID == TIME_STAMPING ||
+      commandID == RX_CAPTURE ||
+      commandID == ARG_POOL_STATUS ||
+      commandID == ARG_CHECKSUM ||
+      commandID == STREAM_TEST ||
+      commandID == COALESCE_RESPONSES ||
+      commandID == SUBSCRIBE ||
+      commandID == RESUME ||
+      commandID == PARAMETERS ||
+      commandID == JOURNAL_READ ||
+      commandID == UPLOAD ||
+      commandID == ABORT;
   return valid;
 }
@@ -39,18 +39,213 @@
  * @field Arg Len - the length fo the Arg Data field as a hex int
  *                  represented by 3 ASCII-encoded hex digits.
  * @field Arg Data This is command-dependent ASCII-encoded data.
+ *
+ * Arg Data that does not fit in the write carrying the command follows in
+ * More Arg Data writes until Arg Len bytes have been received:
+ *   +--ID--+-Arg Data---------------------------------------------------+
+ *   | 0x00 | next part of the current command's Arg Data                |
+ *   +------+------------------------------------------------------------+
+ *   | 1 B  | <= ATT MTU - 4 B                                           |
+ *   +------+------------------------------------------------------------+
+ * A command of a higher priority class (see command_class_t) that arrives
+ * whole in one write is taken alongside the partially received command, so
+ * e.g. an interactive command need not wait for a bulk upload. Any other
+ * command received before the Arg Data is complete abandons the partially
+ * received command.
+ *
+ * Commands run, and their responses go out, by class: control commands
+ * (TIME_SYNC, TIME_STAMPING, COALESCE_RESPONSES, SUBSCRIBE, RESUME,
+ * PARAMETERS, ABORT) first, then
+ * interactive ones, then bulk ones (THROUGHPUT_TEST, RX_CAPTURE,
+ * ARG_CHECKSUM, STREAM_TEST, JOURNAL_READ, UPLOAD, and any command with
+ * more Arg Data than fits a small arg block). Within a class they run in the order received.
+ *
+ * Notifications that start with a byte below 0x20 are framing: stream,
+ * packed and carried response marks (see response.h) and the notice marks
+ * below. Bytes 0x00 to 0x1F are reserved for them. Other responses start
+ * with printable text. THROUGHPUT_TEST sends its data raw, with notices and
+ * urgent commands' responses between blocks. Its 'I' and 'A' patterns never
+ * use a reserved byte, so the host can tell them apart. Its '0' pattern is
+ * all 0x00, the RESPONSE_STREAM_MORE mark. A host should send no command
+ * whose response might be streamed while a '0' test runs.
+ */
+
+/*!
+ * @brief Marks an RX credit grant.
+ * @ingroup simple
+ *
+ * @details The peripheral queues received commands until it can run them.
+ * It tells the central how many it can take with credit grants, sent as
+ * notices between responses (see responseSendNotice()) once notifications
+ * are enabled and whenever the central is running short:
+ *
+ *   +-Mark-+-Limit-+-Started-+-Arg Each-+-Arg Max-+
+ *   | 0x03 | 2 B   | 2 B     | 2 B      | 2 B     |
+ *   +------+-------+---------+----------+---------+
+ * All fields are little endian.
+ * @field Limit    - the central may start commands numbered below this
+ * @field Started  - the commands the peripheral had seen start
+ * @field Arg Each - the Arg Data every credited command may carry
+ * @field Arg Max  - the Arg Data a command may carry when it is the only
+ *                   one outstanding
+ *
+ * Commands are numbered from 0, counting every write that starts a command,
+ * from when notifications are enabled; counts wrap at 2^16. Limit never goes
+ * backward. A central that keeps to the rules below never has a command
+ * dropped:
+ * - start command n only once a grant with Limit > n has arrived;
+ * - give a command at most Arg Each bytes of Arg Data, or up to Arg Max
+ *   once every earlier command's responses have arrived;
+ * - commands whose Arg Data is checksummed as it arrives (ARG_CHECKSUM) are
+ *   not limited by Arg Each, but only one may be outstanding at a time;
+ * - UPLOAD commands take their Arg Data into their own block buffers, so
+ *   are not limited by Arg Each either, but at most two may be outstanding.
+ */
+#define COMMAND_CREDIT_MARK 0x03
+
+/*!
+ * @brief Marks an event notice.
+ * @ingroup simple
+ *
+ * @details Once a central subscribes (see SUBSCRIBE), event types that
+ * change are reported in notices between responses, each type no more often
+ * than its subscription allows; changes in between are folded into the next
+ * record, so a notice always carries the latest value:
+ *
+ *   +-Mark-+-Seq-+-Type-+-Value-+-Type-+-Value-+----
+ *   | 0x04 | 1 B | 1 B  | n B   | 1 B  | m B   | ...
+ *   +------+-----+------+-------+------+-------+----
+ * @field Seq   - counts notices from 0 per connection, wrapping; a gap means
+ *                one was dropped
+ * @field Type  - a subscription_type_t
+ * @field Value - for SUBSCRIPTION_STATE, the command most recently run;
+ *                for SUBSCRIPTION_ERRORS, the COMMAND_ERROR_ flags; for
+ *                SUBSCRIPTION_COUNTERS, how much each of commands run,
+ *                writes received and errors flagged grew since the last
+ *                record, each an unsigned LEB128 varint. The first record
+ *                after subscribing reports every type, the counters as
+ *                totals since notifications were enabled.
  */
+#define COMMAND_EVENT_MARK 0x04
+
+/*!
+ * @brief Marks a session notice.
+ * @ingroup simple
+ *
+ * @details Requests are numbered from 0 per session, counting every write
+ * that starts a command. A session normally lasts a connection, but if the
+ * link drops with responses undelivered, or with commands still to run,
+ * the peripheral keeps them, bounded by its response slots, and the session
+ * can be resumed over the next connection. Once notifications are enabled,
+ * and in reply to RESUME, the peripheral sends:
+ *
+ *   +-Mark-+-Token-+-Carried-+
+ *   | 0x05 | 4 B   | 1 B     |
+ *   +------+-------+---------+
+ * @field Token   - identifies the session, little endian
+ * @field Carried - 1 if the session can be resumed, or was just resumed,
+ *                  with responses from before the link dropped, 0 otherwise
+ *
+ * A central that sees Carried 1 and the Token it had sends RESUME with that
+ * Token as its first command; any other first command starts a new session
+ * and drops the carried responses and the carried commands still to run.
+ * Once resumed, each carried response is preceded by a RESPONSE_CARRIED
+ * notification giving its request (see response.h), and a RESPONSE_CARRIED
+ * notification with no request follows the last of them. The central then
+ * sends again any request it has no response to. Carried requests keep
+ * their numbers and a resumed session numbers on from them.
+ */
+#define COMMAND_SESSION_MARK 0x05
+
+/*!
+ * @brief Marks a stamp notice.
+ * @ingroup simple
+ *
+ * @details While time stamping is on (see TIME_STAMPING) and once the host
+ * has synced, each response's dataAvailable header is preceded by:
+ *
+ *   +-Mark-+-SentAt-+
+ *   | 0x07 | 8 B    |
+ *   +------+--------+
+ * @field SentAt - when the response started to go out, in us in the host's
+ *                 time base, signed and little endian
+ */
+#define COMMAND_STAMP_MARK 0x07
+
+/*!
+ * @brief Marks a boot notice.
+ * @ingroup simple
+ *
+ * @details Over the first connection after a reset, following the session
+ * notice, the peripheral reports how long each stage of its start up took
+ * (see commandBootProfile()), in as many notices as it takes:
+ *
+ *   +-Mark-+-First-+-Time-+-Time-+----
+ *   | 0x08 | 1 B   | 3 B  | 3 B  | ...
+ *   +------+-------+------+------+----
+ * @field First - the boot_stage_t of the first Time
+ * @field Time  - when the stage was done, in us since main() started,
+ *                little endian; 0xFFFFFF if later, or 0 if skipped. Those
+ *                after BOOT_STAGE_BLE_STACK are timed on the RTC, so are
+ *                to its 30.5 us ticks; the cycle counter that times the
+ *                others stops while the CPU sleeps
+ */
+#define COMMAND_BOOT_MARK 0x08
+
+/*!
+ * @brief The stages of start up, in the order main() runs them.
+ *
+ * @details Those from BOOT_STAGE_LOG_BACKENDS on are deferred until
+ * advertising has started.
+ */
+typedef enum
+{
+  BOOT_STAGE_LOG,                // logging, without its backends
+  BOOT_STAGE_LEDS,
+  BOOT_STAGE_TIMERS,
+  BOOT_STAGE_RESUME,             // the state from before a warm reset
+  BOOT_STAGE_BLE_STACK,          // the SoftDevice, which starts the LF clock
+  BOOT_STAGE_POWER,              // before anything that waits for an event
+  BOOT_STAGE_PARAMS,             // loading the runtime parameters
+  BOOT_STAGE_GAP,
+  BOOT_STAGE_GATT,
+  BOOT_STAGE_SERVICES,
+  BOOT_STAGE_ADVERTISING_DATA,
+  BOOT_STAGE_CONN_PARAMS,
+  BOOT_STAGE_PEER_MANAGER,
+  BOOT_STAGE_ADVERTISING,        // connectable from here
+  BOOT_STAGE_LOG_BACKENDS,
+  BOOT_STAGE_RADIO_NOTIFICATION,
+  BOOT_STAGE_JOURNAL,
+  BOOT_STAGE_UPLOAD,
+  BOOT_STAGES
+} boot_stage_t;
 
 /*!
  * @brief The Reader Command IDs
  */
 typedef enum
 {
+  MORE_ARG_DATA            = 0x00, // Continuation of the current command's Arg Data
   NO_COMMAND               = 0xFE, // No Command
   FAST_BLINK               = 0x01, // Command 1
   SLOW_BLINK               = 0x02, // Command 2
   ALT_BLINK                = 0x03, // Command 2
   OFF                      = 0x04, // Command 2
+  THROUGHPUT_TEST          = 0x05, // Stream generated data to measure link throughput
+  ECHO                     = 0x06, // Return the Arg Data with device timestamps
+  TIME_SYNC                = 0x07, // Clock sync exchange against the host time base
+  TIME_STAMPING            = 0x08, // Stamp responses with synchronized send time
+  RX_CAPTURE               = 0x09, // Capture received writes for replay
+  ARG_POOL_STATUS          = 0x0A, // Report argument pool occupancy
+  ARG_CHECKSUM             = 0x0B, // Checksum streamed arg data
+  STREAM_TEST              = 0x0C, // Generate a response of any length
+  COALESCE_RESPONSES       = 0x0D, // Pack short responses into shared notifications
+  SUBSCRIBE                = 0x0E, // Report device events as they change
+  RESUME                   = 0x0F, // Resume a session after the link dropped
+  PARAMETERS               = 0x10, // Read or set the runtime tuning parameters
+  JOURNAL_READ             = 0x11, // Stream the journal of commands run
+  UPLOAD                   = 0x12, // Stream an upload into flash
   ABORT                    = 0xFF  // Abort current command
 } command_id_t;
 
@@ -59,6 +254,20 @@ typedef enum
 #define SLOW_BLINK_STRING               "slow_blink"
 #define ALT_BLINK_STRING                "alt_blink"
 #define OFF_STRING                      "off"
+#define THROUGHPUT_TEST_STRING          "throughput_test"
+#define ECHO_STRING                     "echo"
+#define TIME_SYNC_STRING                "time_sync"
+#define TIME_STAMPING_STRING            "time_stamping"
+#define RX_CAPTURE_STRING               "rx_capture"
+#define ARG_POOL_STATUS_STRING          "arg_pool_status"
+#define ARG_CHECKSUM_STRING             "arg_checksum"
+#define STREAM_TEST_STRING              "stream_test"
+#define COALESCE_RESPONSES_STRING       "coalesce_responses"
+#define SUBSCRIBE_STRING                "subscribe"
+#define RESUME_STRING                   "resume"
+#define PARAMETERS_STRING               "parameters"
+#define JOURNAL_READ_STRING             "journal_read"
+#define UPLOAD_STRING                   "upload"
 #define ABORT_STRING                    "abort"
 
 typedef enum
@@ -67,14 +276,61 @@ typedef enum
   COMMAND_FAILURE = 0
 } command_status_t;
 
+/*!
+ * @brief Error flags in the status record, each set when the error first
+ * occurs and cleared when a new session starts.
+ */
+#define COMMAND_ERROR_INVALID_COMMAND    0x01 // A write started a command with an unknown ID or bad header
+#define COMMAND_ERROR_COMMAND_DROPPED    0x02 // A command arrived with no room for it or its Arg Data
+#define COMMAND_ERROR_COMMAND_INCOMPLETE 0x04 // A command's Arg Data never all arrived
+#define COMMAND_ERROR_RESPONSE_DROPPED   0x08 // A response found no free response slot
+
+/*!
+ * @brief What a monitor needs to know about the command engine.
+ *
+ * @field command - the command most recently run, as currentCommand()
+ * @field errors  - COMMAND_ERROR_ flags
+ * @field changes - counts changes to @p command and @p errors, wrapping, so
+ *                  a monitor can tell it missed one
+ */
+typedef struct
+{
+  uint8_t command;
+  uint8_t errors;
+  uint8_t changes;
+} command_status_record_t;
+
+
+/*!
+ * @brief Requests a call to commandUrgentRun(), e.g. by pending the software
+ * interrupt whose handler makes it.
+ */
+typedef void (*command_pend_t)(void);
 
 /*!
  * @brief Initialize command handling.
  * @ingroup simple
  *
  * @details This function must be called at initialization.
+ *
+ * @param urgentPend - called when urgent commands are waiting; NULL runs
+ *                     them at once from executeCommand()
  */
-void commandInit();
+void commandInit(command_pend_t urgentPend);
+
+/*!
+ * @brief Report the start up profile over the first connection.
+ * @ingroup simple
+ *
+ * @details Call once start up is done. The times are sent in boot notices
+ * (see COMMAND_BOOT_MARK) once the first central enables notifications. If
+ * the link drops before the last of them is built, the next connection
+ * sends them all again.
+ *
+ * @param stageUs - when each boot_stage_t was done, in us since main()
+ *                  started; must stay valid
+ */
+void commandBootProfile(uint32_t const *stageUs);
 
 /*!
  * @brief Receive and begin processing a raw command
@@ -96,10 +352,48 @@ void receiveRawCommand(uint8_t const *raw, uint16_t rawLength);
 bool validCommandReceived();
 
 /*!
- * @brief Execute the most recently received command.
+ * @brief Hand the commands received to the tiers that run them.
+ *
+ * @details Urgent commands (ABORT, the LED commands and the other control
+ * commands) are handed to commandUrgentRun(); the rest wait for
+ * commandThreadRun().
  */
 void executeCommand();
 
+/*!
+ * @brief Run the urgent commands waiting.
+ * @ingroup simple
+ *
+ * @details Call from the software interrupt that the urgent pend callback
+ * pends. Its priority must be above thread mode; urgent commands are short,
+ * so it may be as high as the BLE event priority.
+ */
+void commandUrgentRun();
+
+/*!
+ * @brief Run the thread tier commands waiting.
+ * @ingroup simple
+ *
+ * @details Call from the main loop. Commands run here may take as long as
+ * they need; BLE events and urgent commands preempt them.
+ */
+void commandThreadRun();
+
+/*!
+ * @brief Align command work with connection events.
+ * @ingroup simple
+ *
+ * @details Call from the SoftDevice radio notification handler, if
+ * subscribed. When the radio is about to be active, responses held back for
+ * coalescing are queued so they go in the coming event, and no more thread
+ * tier commands are started until the event is over; those waiting then
+ * start with the whole connection interval to queue their responses in.
+ *
+ * @param radioActive - true when the radio is about to be active, false
+ *                      once it is done
+ */
+void commandRadioNotification(bool radioActive);
+
 /*!
  * @brief Initiate a BLE event (notify) to respond to a command with a message.
  *
@@ -110,10 +404,51 @@ void executeCommand();
  */
 void bleEventInitiate(char *message);
 
+/*!
+ * @brief Start a new command session.
+ * @ingroup simple
+ *
+ * @details Call when the command service reports BLE_CMD_EVT_COMM_STARTED.
+ * Restarts command numbering and grants the central its first credits, and
+ * sends a session notice (see COMMAND_SESSION_MARK). After
+ * commandCommPaused() the session carries on instead: numbering continues,
+ * credits are granted afresh and what was held back goes out. Subscriptions,
+ * event counters and error flags are only cleared for a new connection.
+ */
+void commandCommStarted();
+
+/*!
+ * @brief Hold the session while the central has notifications off.
+ * @ingroup simple
+ *
+ * @details Call when the command service reports BLE_CMD_EVT_COMM_STOPPED.
+ * No credits are granted and nothing is sent until notifications are on
+ * again. Commands keep running and their responses wait in their slots.
+ */
+void commandCommPaused();
+
+/*!
+ * @brief Keep the session for the central to resume.
+ * @ingroup simple
+ *
+ * @details Call on disconnecting. Responses still to be delivered, and
+ * those of commands still to run, are kept until the next connection
+ * decides whether to resume the session.
+ */
+void commandCommStopped();
+
+/*!
+ * @brief Continue sending a generated response.
+ * @ingroup simple
+ *
+ * @details Call when the command service reports BLE_CMD_EVT_TX_RDY.
+ */
+void commandTxReady();
+
 /*!
  * @brief Return the current command ID
  *
- * @return the current command ID
+ * @return the ID of the command most recently run, in either tier
  */
 command_id_t currentCommand();
 
@@ -124,4 +459,15 @@ command_id_t currentCommand();
  */
 void setCurrentCommand(command_id_t commandID);
 
+/*!
+ * @brief Return the status record
+ * @ingroup simple
+ *
+ * @details e.g. to advertise it, so a monitor can follow the device without
+ * connecting; poll it and compare @p changes to see whether it changed.
+ *
+ * @return the status record
+ */
+command_status_record_t commandStatusRecord();
+
 #endif // _SIMPLE_COMMAND_H
@@ -21,19 +21,49 @@
 #include <stdbool.h>
 
 #include "command.h"
+#include "argPool.h"
+#include "response.h"
 
 #define COMMAND_ID_FIELD_LENGTH              1
 #define COMMAND_ARG_LENGTH_FIELD_LENGTH      3
 #define COMMAND_ARG_DATA_FIELD_MAX_LENGTH 4095
 
-// TODO make the max arg length less?
+// Arg data lives in an argPool block sized to the arg; NULL if there is none
 typedef struct
 {
   command_id_t commandID; // The command ID
-  uint16_t     argLength; // The number of arg bytes [0,4095]
-  uint8_t      argData[COMMAND_ARG_DATA_FIELD_MAX_LENGTH];
+  uint16_t     argLength; // The number of arg bytes [0,argPoolMaxLength()]
+  uint8_t      argClass;  // The argPool size class of argData
+  uint8_t    * argData;
 } command_packet_t;
 
+/*!
+ * @brief Callbacks for taking a command's arg data as it arrives.
+ * @ingroup simple
+ *
+ * @details Commands without their own callbacks have their arg data
+ * buffered in an argPool block and are dispatched to their handler once it
+ * has all arrived.
+ *
+ * @field begin   - called once the arg length is decoded; return false to
+ *                  refuse the command
+ * @field chunk   - called with each piece of arg data, in order
+ * @field end     - called by executeCommand() once all arg data has arrived;
+ *                  NULL dispatches to the command's handler instead
+ * @field abandon - called instead of end if the command is never completed
+ * @field drop    - called instead of end if the command is completed but
+ *                  dropped before it runs, with the command's argSlot; NULL
+ *                  if there is nothing to undo
+ */
+typedef struct
+{
+  bool (*begin)(uint16_t argLength);
+  void (*chunk)(uint8_t const *data, uint16_t length);
+  int  (*end)(void);
+  void (*abandon)(void);
+  void (*drop)(uint8_t argSlot);
+} command_arg_stream_t;
+
 typedef enum
 {
   READY_FOR_COMMAND  = 0x00,
@@ -43,23 +73,103 @@ typedef enum
   INVALID            = 0xFF
 } command_state_t;
 
+/*!
+ * @brief Scheduling classes, highest priority first.
+ * @ingroup simple
+ *
+ * @details Each class has its own RX queue. Commands run from the highest
+ * priority queue with one waiting, and their responses go out ahead of
+ * those of lower classes; a bulk response is sent so that the others can
+ * cut in between its fragments.
+ */
+typedef enum
+{
+  COMMAND_CLASS_CONTROL     = 0x00, // Short commands that change how the link behaves
+  COMMAND_CLASS_INTERACTIVE = 0x01, // Short commands a user is waiting on
+  COMMAND_CLASS_BULK        = 0x02, // Long transfers
+  COMMAND_CLASSES
+} command_class_t;
+
+/*!
+ * @brief Where commands run.
+ * @ingroup simple
+ *
+ * @details Urgent commands are short and run from a software interrupt as
+ * soon as they arrive, preempting thread tier commands; see
+ * commandUrgentRun(). Everything else runs in the main loop, where it may
+ * take as long as it needs; see commandThreadRun().
+ */
+typedef enum
+{
+  COMMAND_TIER_URGENT = 0x00,
+  COMMAND_TIER_THREAD = 0x01
+} command_tier_t;
+
+/*!
+ * @brief A command being received or waiting to run.
+ * @ingroup simple
+ *
+ * @field inUse        - true while being received or waiting to run
+ * @field command      - the interpreted raw command
+ * @field commandClass - the class the command is scheduled in
+ * @field tier         - where the command runs
+ * @field argStream    - how the command's arg data is taken
+ * @field argReceived  - the number of Arg Data bytes received so far
+ * @field argSlot      - the slot the arg stream took for the command, for
+ *                      streams that keep one per command
+ * @field rxTicks      - RTC ticks when the command's first write arrived
+ * @field request      - the command's number in its session
+ * @field carried      - true if the link it came over has since dropped
+ */
+typedef struct
+{
+  bool inUse;
+  command_packet_t command;
+  command_class_t commandClass;
+  command_tier_t tier;
+  command_arg_stream_t const *argStream;
+  uint16_t argReceived;
+  uint8_t argSlot;
+  uint32_t rxTicks;
+  uint16_t request;
+  bool carried;
+} command_rx_t;
+
 /*!
  * @brief A struct to encapsulate the Reader Command.
  * @ingroup simple
  *
+ * @details Commands are received into one of COMMAND_RX_QUEUE_SIZE RX queue
+ * entries, set per board in sdk_config.h, queued by tier and class and run
+ * in class order; the fields below from @p command on describe the command
+ * running. An urgent command preempting a thread tier one puts them back
+ * once it is done.
+ *
  * @field initialized        - true if the command has been initiallized, false otherwise
- * @field rawCommandReceived - true if a new command has been received, false otherwise
- * @field commandValid       - true if the command is valid
+ * @field commandState       - the state of receiving the command
  * @field command            - the interpreted raw command
- * @field commandState       - the command processing state
+ * @field commandClass       - the class the command was scheduled in
+ * @field argStream          - how the command's arg data is taken
+ * @field argReceived        - the number of Arg Data bytes received
+ * @field argSlot            - the slot the arg stream took for the command
+ * @field rxTicks            - RTC ticks when the command's first write arrived
+ * @field dispatchTicks      - RTC ticks when the command was dispatched
+ * @field request            - the command's number in its session
+ * @field carried            - true if the link it came over has since dropped
  */
 typedef struct
 {
   bool initialized;
-  bool rawCommandReceived;
-  bool commandValid;
   command_packet_t command;
+  command_class_t commandClass;
+  command_arg_stream_t const *argStream;
   command_state_t commandState;
+  uint16_t argReceived;
+  uint8_t argSlot;
+  uint32_t rxTicks;
+  uint32_t dispatchTicks;
+  uint16_t request;
+  bool carried;
 } command_t;
 
 
@@ -146,6 +256,355 @@ int altBlink();
  */
 int off();
 
+/*!
+ * @brief Stream generated data to the central to measure link throughput
+ * @ingroup simple
+ *
+ * @details The requested number of bytes is generated and sent through
+ * @p ble_cmd_data_send() as fast as the SoftDevice accepts notifications; a
+ * send refused with NRF_ERROR_RESOURCES is retried until it is queued. The
+ * raw data is not preceded by a dataAvailable header; the central knows how
+ * many bytes it asked for. When all data has been queued a summary message
+ * is sent with bleEventInitiate():
+ *
+ *   throughput:bytes=<n>,ticks=<RTC ticks>,kbps=<kbit/s>,retries=<n>
+ *
+ * If the link fails part way, "error=<nrf error>" is appended and bytes
+ * reports how much was actually queued.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x05 | 007     | byte count | pattern                               |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 6 C        | 1 C                                   |
+ *   +------+---------+----------------------------------------------------+
+ * @field byte count - the number of bytes to send [1,FFFFFF], as ASCII hex
+ * @field pattern    - '0' for all zero bytes, 'I' for a byte counter running
+ *                     0x20 to 0xFF, 'A' for repeating 'A' to 'Z'
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int throughputTest();
+
+/*!
+ * @brief Echo the Arg Data back with device-side timestamps
+ * @ingroup simple
+ *
+ * @details The Arg Data is returned unchanged as one response, followed by a
+ * second response giving the app_timer RTC tick count at which the command's
+ * first write was received, at which it was dispatched and at which the
+ * SoftDevice took the first notification of the echo:
+ *
+ *   echo:rx=<ticks>,dispatch=<ticks>,queued=<ticks>
+ *
+ * Each tick count has eight digits. queued is "none", padded with spaces to
+ * the same length, if none of the echoed data was sent.
+ *
+ * Comparing these with the central's own round trip time separates the time
+ * spent on the link from the time spent on the device.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x06 | [0,FFF] | payload                                            |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | <= 4095 B                                          |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int echo();
+
+/*!
+ * @brief Clock sync exchange
+ * @ingroup simple
+ *
+ * @details NTP-like exchange against the RTC behind app_timer. The central
+ * sends its clock (t1) and the device replies with t1, the device time the
+ * request was received (t2), the device time the reply was generated (t3) and
+ * its current drift estimate in parts per billion:
+ *
+ *   timeSync:t1=<hex us>,t2=<hex us>,t3=<hex us>,skew=<ppb>
+ *
+ * With its own receive time (t4) the central can compute offset and round
+ * trip delay as in NTP. The device also feeds each exchange to its own
+ * estimator (see timeSync.h) so it can stamp responses in the host time
+ * base; the optional uplink delay is the central's estimate of the one-way
+ * delay, which the device adds to t1. Without it stamps read early by the
+ * minimum uplink delay.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x07 | 010/018 | host time us | [uplink delay us]                   |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 16 C         | 8 C                                 |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int timeSync();
+
+/*!
+ * @brief Turn time stamping of responses on or off
+ * @ingroup simple
+ *
+ * @details While on and once at least one TIME_SYNC exchange has been made,
+ * every response's dataAvailable header is preceded by a stamp notice
+ * carrying the send time in the host time base (see COMMAND_STAMP_MARK in
+ * command.h).
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x08 | 001     | '1' on, '0' off                                    |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 1 C                                                |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int timeStamping();
+
+/*!
+ * @brief Control capture of received writes
+ * @ingroup simple
+ *
+ * @details While capture is on, every write to the invoke characteristic is
+ * recorded with its arrival time in a RAM ring of COMMAND_RX_CAPTURE_SLOTS
+ * records, overwriting the oldest when full. Only the first
+ * COMMAND_RX_CAPTURE_PAYLOAD bytes of each write are kept. The dump is a
+ * single response whose data is the records, oldest first:
+ *
+ *   +-Ticks---------+-Length-+-Data----------------------------+
+ *   | RTC ticks, LE | kept   | the first Length bytes written  |
+ *   +---------------+--------+---------------------------------+
+ *   | 4 B           | 1 B    | <= COMMAND_RX_CAPTURE_PAYLOAD B |
+ *   +---------------+--------+---------------------------------+
+ *
+ * which is the format the link simulator replays (see sim/linkSim.c).
+ * Dumping stops the capture so the ring holds still while it is sent.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x09 | 001     | '1' start (clears), '0' stop, 'D' dump             |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 1 C                                                |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int rxCapture();
+
+/*!
+ * @brief Report argument pool occupancy
+ * @ingroup simple
+ *
+ * @details Responds with each size class as size=inUse/count/highWater,
+ * followed by the number of failed allocations, e.g.
+ * "argPool:32=0/4/1,256=0/2/1,4096=0/1/0,fail=0".
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+
+ *   | 0x0A | 000     |
+ *   +------+---------+
+ *   | 1 B  | 3 C     |
+ *   +------+---------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int argPoolStatus();
+
+/*!
+ * @brief Checksum the arg data
+ * @ingroup simple
+ *
+ * @details The arg data is checksummed as it arrives rather than buffered, so
+ * any length up to COMMAND_ARG_DATA_FIELD_MAX_LENGTH is accepted regardless
+ * of the argPool configuration. Responds with the length, the Fletcher-32 of
+ * the data and the RTC ticks from the command's first write to the last,
+ * leaving out the time it then waited to run, e.g.
+ * "argChecksum:len=4095,fletcher=1a2b3c4d,ticks=12345".
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x0B | 000-FFF | any                                                |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | [0,4095] B                                         |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int argChecksum();
+
+/*!
+ * @brief Generate a response of any length
+ * @ingroup simple
+ *
+ * @details Exercises generated responses: the data is produced a fragment
+ * at a time as notification slots free up, so its length is not limited by
+ * RAM. Up to RESPONSE_FRAMED_MAX_LENGTH bytes are dataAvailable framed;
+ * longer responses are sent as a stream (see response.h). Patterns are as
+ * for THROUGHPUT_TEST; 'I' includes zero bytes.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x0C | 009     | byte count (8 hex C), pattern ('0', 'I' or 'A')    |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 9 C                                                |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int streamTest();
+
+/*!
+ * @brief Turn response coalescing on or off
+ * @ingroup simple
+ *
+ * @details While on, short responses queued together are packed into one
+ * notification (see RESPONSE_PACKED in response.h), each waiting up to the
+ * given delay for others to join it; the default delay is the
+ * PARAM_COALESCE_DELAY_MS parameter, COMMAND_RESPONSE_COALESCE_DELAY_MS
+ * unless set. The response to turning it on is
+ * itself packed; the response to turning it off is not.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x0D | 001     | '0' off, '1' on                                    |
+ *   +------+---------+----------------------------------------------------+
+ *   | 0x0D | 003     | '1' on, max delay in ms (2 hex C)                  |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 1 or 3 C                                           |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int coalesceResponses();
+
+/*!
+ * @brief Subscribe to device events
+ * @ingroup simple
+ *
+ * @details Each group sets one event type's subscription: the least time
+ * between its records, or FFFF to unsubscribe. Types not named are left as
+ * they are; subscriptions end with the connection. Changes are reported in
+ * event notices (see COMMAND_EVENT_MARK in command.h), so a central need not
+ * poll. The response is "subscribed:" and the types now subscribed to, bit
+ * (type - 1) set for each (2 hex C).
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x0E | 006     | type (2 hex C), min interval in ms (4 hex C)       |
+ *   +------+---------+----------------------------------------------------+
+ *   | 0x0E | 00C     | two groups as above                                |
+ *   +------+---------+----------------------------------------------------+
+ *   | 0x0E | 012     | three groups as above                              |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 6, 12 or 18 C                                      |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int subscribe();
+
+/*!
+ * @brief Resume a session after the link dropped
+ * @ingroup simple
+ *
+ * @details Must be the first command over a new connection. If the token
+ * is that of the session the peripheral kept, the responses carried over
+ * are sent, each marked with its request; otherwise they are dropped and a
+ * new session starts. Either way the peripheral replies with a session
+ * notice rather than a response (see COMMAND_SESSION_MARK in command.h), so
+ * RESUME needs no response slot while carried responses hold them.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x0F | 008     | session token (8 hex C)                            |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 8 C                                                |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int resume();
+
+/*!
+ * @brief Read or set the runtime tuning parameters
+ * @ingroup simple
+ *
+ * @details With no Arg Data the response is "params:" and each parameter's
+ * ID (2 hex C) and value (8 hex C), in ID order. Given an ID, with a value
+ * to set it to, the response is "param:", the ID and value, and
+ * " min:", " max:" and " default:" each followed by a value. A value set is
+ * applied at once where it can be and kept in flash, so it holds across
+ * resets; param.h lists the parameters and their units. Setting a value out
+ * of range, or one that would leave the connection parameters invalid
+ * together, fails.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x10 | 000     | none; list all                                     |
+ *   +------+---------+----------------------------------------------------+
+ *   | 0x10 | 002     | parameter ID (2 hex C)                             |
+ *   +------+---------+----------------------------------------------------+
+ *   | 0x10 | 00A     | parameter ID (2 hex C), new value (8 hex C)        |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 0, 2 or 10 C                                       |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int parameters();
+
+/*!
+ * @brief Stream the journal of commands run
+ * @ingroup simple
+ *
+ * @details Every command run is recorded in a journal kept in flash (see
+ * journal.h), so it outlives the connection and resets. The response is a
+ * stream: the sequence number the next entry will get and the entries
+ * dropped since boot as the RAM buffer was full (4 B each, little endian),
+ * then each journal_entry_t kept from the given sequence number up to that
+ * next one, oldest first. Entries overwritten or torn are skipped; the
+ * sequence numbers show the gaps. A read cut off by the link dropping is
+ * resumed by reading from the last sequence number received plus one.
+ * With no Arg Data, the read starts from the oldest entry kept.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x11 | 000     | none; from the oldest entry                        |
+ *   +------+---------+----------------------------------------------------+
+ *   | 0x11 | 008     | first sequence number (8 hex C)                    |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 0 or 8 C                                           |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int journalRead();
+
+/*!
+ * @brief Stream an upload into flash
+ * @ingroup simple
+ *
+ * @details Uploads too large for one command, e.g. LED pattern tables or
+ * calibration data, go to a flash region (see upload.h) in blocks of up to
+ * COMMAND_UPLOAD_BLOCK_SIZE bytes, one per command:
+ * - S starts an upload of the given size and CRC-32, erasing what it needs
+ *   before responding, or carries on with the one under way if the size and
+ *   CRC match, e.g. after the link dropped;
+ * - B takes a block at the given offset with the block's own CRC-32. Each
+ *   block but the last is a whole number of words. Its Arg Data goes
+ *   straight into a block buffer as it arrives; once the whole block is in
+ *   and checks out it is written, while the next block arrives into the
+ *   other buffer. So keep at most two blocks outstanding. A block that is
+ *   out of place or fails its CRC is not written;
+ * - F checks the whole upload in flash against the CRC it started with.
+ * S and B respond with the offset the next block should have, e.g.
+ * "upload:next=00000400", from which a central carries on. F responds with
+ * the CRC of what is in flash and whether it matches, e.g.
+ * "upload:next=00002000,crc=1a2b3c4d,ok". All offsets, sizes and CRCs are
+ * 8 hex C.
+ *
+ * @param command (format below)
+ *   +--ID--+-Arg Len-+-Arg Data-------------------------------------------+
+ *   | 0x12 | 011     | S, size, CRC                                       |
+ *   +------+---------+----------------------------------------------------+
+ *   | 0x12 | 012-    | B, offset, block CRC, block                        |
+ *   +------+---------+----------------------------------------------------+
+ *   | 0x12 | 001     | F                                                  |
+ *   +------+---------+----------------------------------------------------+
+ *   | 1 B  | 3 C     | 1 C, or 17 C and [0,COMMAND_UPLOAD_BLOCK_SIZE] B   |
+ *   +------+---------+----------------------------------------------------+
+ * @return SUCCESS if successful, FAILURE otherwise.
+ */
+int upload();
 
 /*!
  * @brief
@@ -167,6 +626,8 @@ int abortCommand();
 
 bool isASCIIHexDigit(char c);
 
-bool isValidCommandID();
+bool parseHexField(uint8_t const *field, uint8_t digits, uint32_t *value);
+
+bool isValidCommandID(command_id_t commandID);
 
 #endif // _COMMAND_INTERNAL_H
@@ -0,0 +1,325 @@
+/*!
+ * @file journal.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Append-only journal of the commands run, kept in flash
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "app_error.h"
+#include "app_util_platform.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+#include "nrf_log.h"
+
+#include "journal.h"
+
+#if COMMAND_JOURNAL_ENABLED
+
+// What a word of erased flash reads as
+#define JOURNAL_BLANK UINT32_MAX
+
+static void journalFsEventHandler(nrf_fstorage_evt_t *p_evt);
+
+NRF_FSTORAGE_DEF(nrf_fstorage_t m_journalFs) =
+{
+  .evt_handler = journalFsEventHandler
+};
+
+/*!
+ * @brief Journal state.
+ *
+ * @details Entry n lives in slot n % slots, so an entry read back is valid
+ * only if it holds its own sequence number.
+ *
+ * @field buffer       - entries waiting for flash, oldest at tail
+ * @field tail         - the oldest buffered entry
+ * @field count        - the entries buffered, including those being written
+ * @field writing      - the entries being written, from tail
+ * @field erasing      - true while the page for the next entry is erased
+ * @field flushing     - true from starting a flush until the buffer is empty
+ * @field flushDue     - true if a batch is waiting for the radio to go idle
+ * @field aligned      - true once radio notifications are coming
+ * @field next         - the number of the next entry recorded
+ * @field slots        - entries the journal holds
+ * @field slotsPerPage - entries a page holds
+ * @field dropped      - entries dropped as the buffer was full
+ */
+static struct
+{
+  journal_entry_t buffer[COMMAND_JOURNAL_BUFFER_ENTRIES];
+  uint8_t tail;
+  uint8_t count;
+  uint8_t writing;
+  bool erasing;
+  bool flushing;
+  bool flushDue;
+  bool aligned;
+  uint32_t next;
+  uint32_t slots;
+  uint32_t slotsPerPage;
+  uint32_t dropped;
+} m_journal;
+
+static uint32_t
+slotAddr(uint32_t sequence)
+{
+  return m_journalFs.start_addr + (sequence % m_journal.slots) * sizeof(journal_entry_t);
+}
+
+static bool
+slotBlank(uint32_t addr)
+{
+  uint32_t words[sizeof(journal_entry_t) / sizeof(uint32_t)];
+
+  (void) nrf_fstorage_read(&m_journalFs, addr, words, sizeof(words));
+  for (uint8_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+    if (words[i] != JOURNAL_BLANK)
+      return false;
+  return true;
+}
+
+static bool
+pageBlank(uint32_t pageAddr)
+{
+  for (uint32_t i = 0; i < m_journal.slotsPerPage; i++)
+    if (!slotBlank(pageAddr + i * sizeof(journal_entry_t)))
+      return false;
+  return true;
+}
+
+/*!
+ * @brief Queue the next flash operation of a flush, or end it.
+ *
+ * @details Writes the buffered entries in runs that neither wrap the buffer
+ * nor cross a page, erasing each page as the ring comes to it.
+ *
+ * @note Call with the state locked and no operation queued.
+ */
+static void
+flushStep(void)
+{
+  ret_code_t err_code;
+
+  if (m_journal.count == 0)
+  {
+    m_journal.flushing = false;
+    return;
+  }
+
+  uint32_t sequence = m_journal.next - m_journal.count;
+  uint32_t addr = slotAddr(sequence);
+  uint32_t slotInPage = (sequence % m_journal.slots) % m_journal.slotsPerPage;
+
+  if (slotInPage == 0 && !pageBlank(addr))
+  {
+    err_code = nrf_fstorage_erase(&m_journalFs, addr, 1, NULL);
+    if (err_code == NRF_SUCCESS)
+      m_journal.erasing = true;
+    else
+      m_journal.flushing = false;
+    return;
+  }
+
+  uint8_t run = m_journal.count;
+  if (run > COMMAND_JOURNAL_BUFFER_ENTRIES - m_journal.tail)
+    run = COMMAND_JOURNAL_BUFFER_ENTRIES - m_journal.tail;
+  if (run > m_journal.slotsPerPage - slotInPage)
+    run = m_journal.slotsPerPage - slotInPage;
+
+  err_code = nrf_fstorage_write(&m_journalFs, addr, &m_journal.buffer[m_journal.tail],
+                                run * sizeof(journal_entry_t), NULL);
+  if (err_code == NRF_SUCCESS)
+    m_journal.writing = run;
+  else
+    m_journal.flushing = false;
+}
+
+/*!
+ * @brief Start writing the buffered entries unless already doing so.
+ *
+ * @note Call with the state locked.
+ */
+static void
+flushStart(void)
+{
+  m_journal.flushDue = false;
+  if (m_journal.flushing)
+    return;
+  m_journal.flushing = true;
+  flushStep();
+}
+
+static void
+journalFsEventHandler(nrf_fstorage_evt_t *p_evt)
+{
+  CRITICAL_REGION_ENTER();
+  switch (p_evt->id)
+  {
+    case NRF_FSTORAGE_EVT_WRITE_RESULT:
+      if (p_evt->result == NRF_SUCCESS)
+      {
+        m_journal.tail = (m_journal.tail + m_journal.writing) % COMMAND_JOURNAL_BUFFER_ENTRIES;
+        m_journal.count -= m_journal.writing;
+      }
+      m_journal.writing = 0;
+    break;
+    case NRF_FSTORAGE_EVT_ERASE_RESULT:
+      m_journal.erasing = false;
+    break;
+    default:
+    break;
+  }
+
+  // A failed operation leaves the entries buffered for the next flush
+  if (p_evt->result == NRF_SUCCESS)
+    flushStep();
+  else
+  {
+    NRF_LOG_INFO("journal: flash operation failed, 0x%x", p_evt->result);
+    m_journal.flushing = false;
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+void
+journalInit(uint32_t startAddr, uint32_t endAddr, bool resumed, uint32_t resumeUs)
+{
+  ret_code_t err_code;
+  journal_entry_t entry;
+  bool found = false;
+  uint32_t last = 0;
+
+  m_journalFs.start_addr = startAddr;
+  m_journalFs.end_addr = endAddr;
+  err_code = nrf_fstorage_init(&m_journalFs, &nrf_fstorage_sd, NULL);
+  APP_ERROR_CHECK(err_code);
+
+  m_journal.slots = (endAddr - startAddr) / sizeof(journal_entry_t);
+  m_journal.slotsPerPage = m_journalFs.p_flash_info->erase_unit / sizeof(journal_entry_t);
+
+  // Carry on after the latest entry
+  for (uint32_t slot = 0; slot < m_journal.slots; slot++)
+  {
+    (void) nrf_fstorage_read(&m_journalFs, startAddr + slot * sizeof(entry), &entry, sizeof(entry));
+    if (entry.sequence == JOURNAL_BLANK || entry.sequence % m_journal.slots != slot)
+      continue;
+    if (!found || entry.sequence > last)
+      last = entry.sequence;
+    found = true;
+  }
+  m_journal.next = found ? last + 1 : 0;
+
+  // Skip slots torn by a reset while they were written, up to the next page
+  while (!slotBlank(slotAddr(m_journal.next)) &&
+         (m_journal.next % m_journal.slots) % m_journal.slotsPerPage != 0)
+    m_journal.next++;
+
+  journalRecord(JOURNAL_BOOT, resumed ? 1 : 0, 0, 0, resumeUs);
+}
+
+void
+journalRecord(uint8_t commandID, uint8_t status, uint16_t request,
+              uint32_t timeMs, uint32_t durationUs)
+{
+  CRITICAL_REGION_ENTER();
+  // Start up sets the journal up only once advertising
+  if (m_journal.count == COMMAND_JOURNAL_BUFFER_ENTRIES || m_journal.slots == 0)
+    m_journal.dropped++;
+  else
+  {
+    journal_entry_t *entry =
+        &m_journal.buffer[(m_journal.tail + m_journal.count) % COMMAND_JOURNAL_BUFFER_ENTRIES];
+    entry->timeMs = timeMs;
+    entry->durationUs = durationUs;
+    entry->request = request;
+    entry->commandID = commandID;
+    entry->status = status;
+    entry->sequence = m_journal.next++;
+    m_journal.count++;
+
+    // Coalesce entries into fewer, longer writes
+    if (m_journal.count >= COMMAND_JOURNAL_FLUSH_ENTRIES && !m_journal.flushing)
+    {
+      if (m_journal.aligned)
+        m_journal.flushDue = true;
+      else
+        flushStart();
+    }
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+void
+journalRadioIdle(void)
+{
+  CRITICAL_REGION_ENTER();
+  m_journal.aligned = true;
+  if (m_journal.flushDue)
+    flushStart();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+journalFlush(void)
+{
+  CRITICAL_REGION_ENTER();
+  flushStart();
+  CRITICAL_REGION_EXIT();
+}
+
+uint32_t
+journalNext(void)
+{
+  return m_journal.next;
+}
+
+uint32_t
+journalDropped(void)
+{
+  return m_journal.dropped;
+}
+
+uint32_t
+journalOldest(void)
+{
+  uint32_t kept = m_journal.slots + m_journal.count;
+
+  return (m_journal.next > kept) ? m_journal.next - kept : 0;
+}
+
+bool
+journalEntry(uint32_t sequence, journal_entry_t *entry)
+{
+  bool kept;
+
+  CRITICAL_REGION_ENTER();
+  uint32_t buffered = m_journal.next - m_journal.count;
+  if (sequence >= m_journal.next)
+    kept = false;
+  else if (sequence >= buffered)
+  {
+    *entry = m_journal.buffer[(m_journal.tail + sequence - buffered) % COMMAND_JOURNAL_BUFFER_ENTRIES];
+    kept = true;
+  }
+  else
+  {
+    (void) nrf_fstorage_read(&m_journalFs, slotAddr(sequence), entry, sizeof(*entry));
+    kept = entry->sequence == sequence;
+  }
+  CRITICAL_REGION_EXIT();
+
+  return kept;
+}
+
+#endif // COMMAND_JOURNAL_ENABLED
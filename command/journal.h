@@ -0,0 +1,132 @@
+/*!
+ * @file journal.h
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Append-only journal of the commands run, kept in flash
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdk_config.h"
+
+/*!
+ * @brief The command ID of the entry recorded at boot.
+ */
+#define JOURNAL_BOOT 0x00
+
+/*!
+ * @brief A journal entry, as kept in flash and as read back.
+ *
+ * @details Entries are numbered in the order recorded, from 0 on a blank
+ * journal and on across resets. The sequence number goes last, so an entry
+ * torn by a reset while it was written never reads as valid.
+ *
+ *   +-Time-+-Duration-+-Request-+-ID--+-Status-+-Sequence-+
+ *   | 4 B  | 4 B      | 2 B     | 1 B | 1 B    | 4 B      |
+ *   +------+----------+---------+-----+--------+----------+
+ * All fields are little endian.
+ * @field timeMs     - when the command started, ms since boot
+ * @field durationUs - how long it ran, in us; for a boot, how long from
+ *                     main() until the state was resumed
+ * @field request    - the request it answered, numbered per session
+ * @field commandID  - the command, or JOURNAL_BOOT
+ * @field status     - what it returned, COMMAND_SUCCESS or COMMAND_FAILURE;
+ *                     for a boot, 1 if the state from before a warm reset
+ *                     was resumed
+ * @field sequence   - the entry number
+ */
+typedef struct
+{
+  uint32_t timeMs;
+  uint32_t durationUs;
+  uint16_t request;
+  uint8_t  commandID;
+  uint8_t  status;
+  uint32_t sequence;
+} journal_entry_t;
+
+/*!
+ * @brief Find where the journal left off and record a boot.
+ *
+ * @details The journal is a ring of entries over whole flash pages, e.g. a
+ * region reserved in the linker script, written through nrf_fstorage once
+ * the SoftDevice is enabled. Entries are buffered in RAM and written
+ * COMMAND_JOURNAL_FLUSH_ENTRIES at a time. A page is erased only when the
+ * ring comes round to it again, losing its oldest entries.
+ *
+ * @param startAddr - the first byte of the journal, page aligned
+ * @param endAddr   - the byte after the journal, page aligned
+ * @param resumed   - whether the state from before a warm reset was resumed
+ * @param resumeUs  - how long from main() until it was, in us
+ */
+void journalInit(uint32_t startAddr, uint32_t endAddr, bool resumed, uint32_t resumeUs);
+
+/*!
+ * @brief Record that a command ran.
+ *
+ * @details Dropped if COMMAND_JOURNAL_BUFFER_ENTRIES are already waiting for
+ * flash, or before journalInit(); see journalDropped().
+ *
+ * @param commandID  - the command
+ * @param status     - what it returned
+ * @param request    - the request it answered
+ * @param timeMs     - when it started, ms since boot
+ * @param durationUs - how long it ran
+ */
+void journalRecord(uint8_t commandID, uint8_t status, uint16_t request,
+                   uint32_t timeMs, uint32_t durationUs);
+
+/*!
+ * @brief The radio has just gone idle.
+ *
+ * @details Call on the radio notification after each radio event. Once it
+ * has been called, a batch of entries waits for it before going to flash,
+ * so the SoftDevice has the whole gap before the next event to write them.
+ */
+void journalRadioIdle(void);
+
+/*!
+ * @brief Write every entry buffered now, however few.
+ *
+ * @details E.g. when the link drops, so the journal is up to date for a
+ * post-mortem.
+ */
+void journalFlush(void);
+
+/*!
+ * @brief The sequence number the next entry recorded will get.
+ */
+uint32_t journalNext(void);
+
+/*!
+ * @brief The number of entries dropped since boot as the buffer was full.
+ */
+uint32_t journalDropped(void);
+
+/*!
+ * @brief Read an entry, from flash or the buffer.
+ *
+ * @param sequence - the entry number
+ * @param entry    - set to the entry
+ * @return true if the entry is kept, false if it was overwritten, torn or
+ *         never recorded
+ */
+bool journalEntry(uint32_t sequence, journal_entry_t *entry);
+
+/*!
+ * @brief The oldest entry number that may still be kept.
+ */
+uint32_t journalOldest(void);
+
+#endif // _JOURNAL_H
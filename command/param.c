@@ -0,0 +1,270 @@
+/*!
+ * @file param.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Runtime tuning parameters, kept in flash
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "app_error.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include "ble_gap.h"
+#include "fds.h"
+#include "nrf_log.h"
+
+#include "sdk_config.h"
+#include "param.h"
+
+// Indexed by param_id_t - 1
+static param_info_t const m_info[PARAM_COUNT] =
+{
+  // PARAM_CONN_INTERVAL_MIN, 100 ms
+  { BLE_GAP_CP_MIN_CONN_INTVL_MIN, BLE_GAP_CP_MAX_CONN_INTVL_MAX, MSEC_TO_UNITS(100, UNIT_1_25_MS) },
+  // PARAM_CONN_INTERVAL_MAX, 200 ms
+  { BLE_GAP_CP_MIN_CONN_INTVL_MIN, BLE_GAP_CP_MAX_CONN_INTVL_MAX, MSEC_TO_UNITS(200, UNIT_1_25_MS) },
+  // PARAM_SLAVE_LATENCY
+  { 0, BLE_GAP_CP_SLAVE_LATENCY_MAX, 0 },
+  // PARAM_CONN_SUP_TIMEOUT, 4 s
+  { BLE_GAP_CP_CONN_SUP_TIMEOUT_MIN, BLE_GAP_CP_CONN_SUP_TIMEOUT_MAX, MSEC_TO_UNITS(4000, UNIT_10_MS) },
+  // PARAM_ADV_FAST_INTERVAL, 20 ms
+  { BLE_GAP_ADV_INTERVAL_MIN, BLE_GAP_ADV_INTERVAL_MAX, 32 },
+  // PARAM_ADV_FAST_DURATION, 30 s
+  { 0, UINT16_MAX, 3000 },
+  // PARAM_ADV_SLOW_INTERVAL, 1022.5 ms
+  { BLE_GAP_ADV_INTERVAL_MIN, BLE_GAP_ADV_INTERVAL_MAX, 1636 },
+  // PARAM_COALESCE_DELAY_MS
+  { 0, UINT8_MAX, COMMAND_RESPONSE_COALESCE_DELAY_MS }
+};
+
+/*!
+ * @brief Parameter state.
+ *
+ * @field values    - the values in use
+ * @field stored    - the values being written, left alone until written
+ * @field desc      - the record, once found or written
+ * @field found     - true once there is a record to update
+ * @field loaded    - true once loading is done
+ * @field writing   - true while a write is queued
+ * @field dirty     - true if the values need writing
+ * @field collected - true if garbage was collected for the write due
+ * @field changed   - applies a value that was set
+ */
+static struct
+{
+  uint32_t values[PARAM_COUNT];
+  uint32_t stored[PARAM_COUNT];
+  fds_record_desc_t desc;
+  bool found;
+  volatile bool loaded;
+  bool writing;
+  bool dirty;
+  bool collected;
+  param_changed_t changed;
+} m_param;
+
+/*!
+ * @brief Whether the connection parameters are valid together.
+ */
+static bool
+connParamsValid(uint32_t const *values)
+{
+  uint32_t intervalMin = values[PARAM_CONN_INTERVAL_MIN - 1];
+  uint32_t intervalMax = values[PARAM_CONN_INTERVAL_MAX - 1];
+  uint32_t latency = values[PARAM_SLAVE_LATENCY - 1];
+  uint32_t timeout = values[PARAM_CONN_SUP_TIMEOUT - 1];
+
+  // 10 ms timeout units against 1.25 ms interval units, twice over
+  return intervalMin <= intervalMax && timeout * 4 > (1 + latency) * intervalMax;
+}
+
+static bool
+inRange(uint8_t index, uint32_t value)
+{
+  return value >= m_info[index].min && value <= m_info[index].max;
+}
+
+/*!
+ * @brief Take the values from the record, if there is one.
+ */
+static void
+paramLoad(void)
+{
+  fds_find_token_t token;
+  fds_flash_record_t record;
+
+  memset(&token, 0, sizeof(token));
+  if (fds_record_find(PARAM_FILE_ID, PARAM_RECORD_KEY, &m_param.desc, &token) != NRF_SUCCESS ||
+      fds_record_open(&m_param.desc, &record) != NRF_SUCCESS)
+    return;
+  m_param.found = true;
+
+  // A record from before parameters were added is shorter; they keep their defaults
+  uint32_t const *data = record.p_data;
+  uint16_t count = MIN(record.p_header->length_words, PARAM_COUNT);
+  for (uint8_t i = 0; i < count; i++)
+    if (inRange(i, data[i]))
+      m_param.values[i] = data[i];
+  (void) fds_record_close(&m_param.desc);
+
+  if (!connParamsValid(m_param.values))
+  {
+    NRF_LOG_INFO("paramLoad: stored connection parameters invalid");
+    for (uint8_t i = PARAM_CONN_INTERVAL_MIN - 1; i < PARAM_CONN_SUP_TIMEOUT; i++)
+      m_param.values[i] = m_info[i].byDefault;
+  }
+}
+
+/*!
+ * @brief Queue a write of the values, or leave them dirty to try again.
+ *
+ * @note Call with the state locked and no write queued.
+ */
+static void
+paramStore(void)
+{
+  fds_record_t record;
+  ret_code_t err_code;
+
+  memcpy(m_param.stored, m_param.values, sizeof(m_param.stored));
+  record.file_id = PARAM_FILE_ID;
+  record.key = PARAM_RECORD_KEY;
+  record.data.p_data = m_param.stored;
+  record.data.length_words = PARAM_COUNT;
+
+  if (m_param.found)
+    err_code = fds_record_update(&m_param.desc, &record);
+  else
+    err_code = fds_record_write(&m_param.desc, &record);
+
+  switch (err_code)
+  {
+    case NRF_SUCCESS:
+      m_param.found = true;
+      m_param.writing = true;
+      m_param.dirty = false;
+    break;
+    case FDS_ERR_NO_SPACE_IN_FLASH:
+      // Collect garbage once; the write goes again on FDS_EVT_GC
+      if (!m_param.collected && fds_gc() == NRF_SUCCESS)
+        m_param.collected = true;
+      m_param.dirty = true;
+    break;
+    default:
+      // Busy; the write goes again on the next FDS event
+      m_param.dirty = true;
+    break;
+  }
+}
+
+static void
+fdsEventHandler(fds_evt_t const *p_evt)
+{
+  CRITICAL_REGION_ENTER();
+  switch (p_evt->id)
+  {
+    case FDS_EVT_INIT:
+      if (!m_param.loaded)
+      {
+        if (p_evt->result == NRF_SUCCESS)
+          paramLoad();
+        m_param.loaded = true;
+      }
+    break;
+    case FDS_EVT_WRITE:
+    case FDS_EVT_UPDATE:
+      if (p_evt->write.file_id != PARAM_FILE_ID || !m_param.writing)
+        break;
+      m_param.writing = false;
+      if (p_evt->result == NRF_SUCCESS)
+        m_param.collected = false;
+      else
+        m_param.dirty = true;
+    break;
+    default:
+    break;
+  }
+
+  // Any event may mean FDS has room for a write that failed
+  if (m_param.loaded && m_param.dirty && !m_param.writing)
+    paramStore();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+paramInit(param_changed_t changed)
+{
+  ret_code_t err_code;
+
+  for (uint8_t i = 0; i < PARAM_COUNT; i++)
+    m_param.values[i] = m_info[i].byDefault;
+  m_param.changed = changed;
+
+  err_code = fds_register(fdsEventHandler);
+  APP_ERROR_CHECK(err_code);
+
+  // Does nothing but send FDS_EVT_INIT if FDS is up already
+  err_code = fds_init();
+  APP_ERROR_CHECK(err_code);
+}
+
+bool
+paramLoaded(void)
+{
+  return m_param.loaded;
+}
+
+param_info_t const *
+paramInfo(param_id_t id)
+{
+  if (id < 1 || id > PARAM_COUNT)
+    return NULL;
+  return &m_info[id - 1];
+}
+
+uint32_t
+paramGet(param_id_t id)
+{
+  if (id < 1 || id > PARAM_COUNT)
+    return 0;
+  return m_param.values[id - 1];
+}
+
+bool
+paramSet(param_id_t id, uint32_t value)
+{
+  uint32_t values[PARAM_COUNT];
+  bool valid;
+
+  if (id < 1 || id > PARAM_COUNT || !inRange(id - 1, value))
+    return false;
+
+  CRITICAL_REGION_ENTER();
+  memcpy(values, m_param.values, sizeof(values));
+  values[id - 1] = value;
+  valid = connParamsValid(values);
+  if (valid && value != m_param.values[id - 1])
+  {
+    m_param.values[id - 1] = value;
+    m_param.collected = false;
+    if (m_param.writing)
+      m_param.dirty = true;
+    else
+      paramStore();
+  }
+  CRITICAL_REGION_EXIT();
+
+  if (valid && m_param.changed != NULL)
+    m_param.changed(id, value);
+  return valid;
+}
@@ -0,0 +1,123 @@
+/*!
+ * @file param.h
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Runtime tuning parameters, kept in flash
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#ifndef _PARAM_H
+#define _PARAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * @brief The FDS file and record key the parameters are kept under.
+ *
+ * @details File IDs from 0xC000 up belong to the Peer Manager.
+ */
+#define PARAM_FILE_ID    0x5C00
+#define PARAM_RECORD_KEY 0x0001
+
+/*!
+ * @brief The number of parameters.
+ */
+#define PARAM_COUNT 8
+
+/*!
+ * @brief Parameter IDs, each a uint32_t in the units the SoftDevice takes.
+ */
+typedef enum
+{
+  PARAM_CONN_INTERVAL_MIN = 0x01, // preferred least connection interval, 1.25 ms units
+  PARAM_CONN_INTERVAL_MAX = 0x02, // preferred most connection interval, 1.25 ms units
+  PARAM_SLAVE_LATENCY     = 0x03, // connection events the peripheral may skip
+  PARAM_CONN_SUP_TIMEOUT  = 0x04, // connection supervision timeout, 10 ms units
+  PARAM_ADV_FAST_INTERVAL = 0x05, // fast advertising interval, 0.625 ms units
+  PARAM_ADV_FAST_DURATION = 0x06, // how long to advertise fast, 10 ms units; 0 for ever
+  PARAM_ADV_SLOW_INTERVAL = 0x07, // slow advertising interval, 0.625 ms units
+  PARAM_COALESCE_DELAY_MS = 0x08  // default response coalescing delay, ms
+} param_id_t;
+
+/*!
+ * @brief What values a parameter takes.
+ *
+ * @field min       - the least value
+ * @field max       - the most value
+ * @field byDefault - the value until one is set
+ */
+typedef struct
+{
+  uint32_t min;
+  uint32_t max;
+  uint32_t byDefault;
+} param_info_t;
+
+/*!
+ * @brief Called once a parameter has been set, to apply it.
+ *
+ * @param id    - the parameter
+ * @param value - its new value
+ */
+typedef void (*param_changed_t)(param_id_t id, uint32_t value);
+
+/*!
+ * @brief Start loading the parameters from flash.
+ *
+ * @details Parameters read their defaults until loading is done, see
+ * paramLoaded(). A stored value out of range takes its default, as do the
+ * connection parameters if together they break the rules in paramSet().
+ * FDS is initialized if it is not already, so this must follow
+ * nrf_sdh_enable_request(); it may come before or after pm_init().
+ *
+ * @param changed - called from paramSet(); may be NULL
+ */
+void paramInit(param_changed_t changed);
+
+/*!
+ * @brief Whether the parameters have been loaded from flash.
+ */
+bool paramLoaded(void);
+
+/*!
+ * @brief A parameter's range and default.
+ *
+ * @param id - the parameter
+ * @return its info, or NULL if there is no such parameter
+ */
+param_info_t const *paramInfo(param_id_t id);
+
+/*!
+ * @brief A parameter's value.
+ *
+ * @param id - the parameter
+ * @return its value, or 0 if there is no such parameter
+ */
+uint32_t paramGet(param_id_t id);
+
+/*!
+ * @brief Set a parameter and keep it in flash.
+ *
+ * @details The value is applied through the param_changed_t given to
+ * paramInit() and written to flash in the background; if FDS is busy or
+ * full, garbage collecting once, the write is tried again on the next FDS
+ * event or set. Besides its range, a value must keep the connection
+ * parameters valid together: the least interval no more than the most, and
+ * the supervision timeout longer than (1 + slave latency) * most interval
+ * * 2.
+ *
+ * @param id    - the parameter
+ * @param value - its new value
+ * @return true if set, false if there is no such parameter or the value is
+ *         not valid
+ */
+bool paramSet(param_id_t id, uint32_t value);
+
+#endif // _PARAM_H
@@ -0,0 +1,1056 @@
+/*!
+ * @file response.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Command responses queued and sent as notification slots free up
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_log.h"
+#include "sdk_errors.h"
+#include "nrf_soc.h"
+
+#include "ble_cmd.h"
+
+#include "response.h"
+#include "responseBuilder.h"
+
+#define RESPONSE_SLOT_NONE 0xFF
+
+// Notice builders that can be waiting at once
+#define RESPONSE_NOTICE_BUILDERS 4
+
+/*!
+ * @brief A queued response.
+ *
+ * @field generator        - supplies the response data
+ * @field generatorContext - passed to @p generator
+ * @field done             - called once the response is finished with, or NULL
+ * @field context          - passed to @p done
+ * @field header           - a pre-framed header, or NULL to format one
+ * @field data             - the data of a copied or static response, or NULL
+ * @field length           - the response length, or RESPONSE_LENGTH_UNKNOWN
+ * @field offset           - the bytes of @p data supplied so far
+ * @field queued           - true while the slot holds a response
+ * @field priority         - the priority it was queued with; lower goes first
+ * @field interruptible    - true if higher priority responses may cut into it
+ * @field sequence         - when it was queued, for order within a priority
+ * @field request          - the request it answers
+ * @field carried          - true if it is carried over from a link that dropped
+ * @field sent             - true once the SoftDevice took a notification of it
+ * @field sentTicks        - RTC ticks when the SoftDevice took the first
+ * @field buffer           - where a copied response is kept
+ */
+typedef struct
+{
+  response_generator_t generator;
+  void *generatorContext;
+  response_done_t done;
+  void *context;
+  char const *header;
+  uint8_t const *data;
+  uint32_t length;
+  uint16_t offset;
+  bool queued;
+  uint8_t priority;
+  bool interruptible;
+  uint16_t sequence;
+  uint16_t request;
+  bool carried;
+  bool sent;
+  uint32_t sentTicks;
+  uint8_t buffer[COMMAND_RESPONSE_BUFFER_SIZE];
+} response_slot_t;
+
+typedef enum
+{
+  RESPONSE_MARK,
+  RESPONSE_STAMP,
+  RESPONSE_HEADER,
+  RESPONSE_BODY
+} response_phase_t;
+
+/*!
+ * @brief Progress sending a response.
+ *
+ * @field phase          - the part of the response being sent
+ * @field stream         - true if sent as a stream rather than dataAvailable framed
+ * @field ended          - true once a stream's generator has returned 0
+ * @field remaining      - bytes of a framed response still to generate
+ * @field fragment       - the next fragment to queue
+ * @field fragmentLength - the length of @p fragment; 0 if it is yet to be generated
+ * @field packed         - the number of responses packed into one notification;
+ *                         0 if the response is sent on its own
+ * @field packedSlots    - the slots of the packed responses, in order
+ */
+typedef struct
+{
+  response_phase_t phase;
+  bool stream;
+  bool ended;
+  uint32_t remaining;
+  uint8_t fragment[RESPONSE_FRAGMENT_SIZE];
+  uint16_t fragmentLength;
+  uint8_t packed;
+  uint8_t packedSlots[COMMAND_RESPONSE_BUFFER_COUNT];
+} response_tx_t;
+
+/*!
+ * @brief Response coalescing settings and progress.
+ *
+ * @field enabled    - true to pack short responses together
+ * @field delayTicks - the longest a response is held back for others to join it
+ * @field waiting    - true while the coalescing timer runs
+ * @field expired    - true once the coalescing timer has run out
+ */
+typedef struct
+{
+  bool enabled;
+  uint32_t delayTicks;
+  bool waiting;
+  bool expired;
+} response_coalesce_t;
+
+/*!
+ * @brief What becomes of responses carried over from a link that dropped.
+ */
+typedef enum
+{
+  RESPONSE_CARRY_HOLD, // keep them, sending nothing until decided
+  RESPONSE_CARRY_SEND, // send them, each marked with its request
+  RESPONSE_CARRY_DROP  // drop them; nobody is waiting for them
+} response_carry_t;
+
+static response_slot_t m_slots[COMMAND_RESPONSE_BUFFER_COUNT];
+static uint8_t m_slotCount;
+static uint16_t m_sequence;
+static uint8_t m_priority;
+static bool m_interruptible;
+static uint16_t m_request;
+static bool m_requestCarried;
+static response_carry_t m_carry;
+
+// The response being sent, and a stream a higher priority response cut into
+static uint8_t m_current;
+static response_tx_t m_tx;
+static uint8_t m_suspended;
+static response_tx_t m_suspendedTx;
+
+// What responseSent() reports during a done callback
+static bool m_releasedSent;
+static uint32_t m_releasedSentTicks;
+
+static response_stamp_t m_stamp;
+static bool m_pumping;
+static bool m_held;
+static bool m_paused;
+static response_coalesce_t m_coalesce;
+static uint8_t m_notice[RESPONSE_FRAGMENT_SIZE];
+static uint16_t m_noticeLength;
+// A built notice has its own buffer so a notice sent meanwhile can't replace it
+static response_notice_t m_noticeBuilds[RESPONSE_NOTICE_BUILDERS];
+static uint8_t m_noticeBuildCount;
+static uint8_t m_builtNotice[RESPONSE_FRAGMENT_SIZE];
+static uint16_t m_builtNoticeLength;
+
+APP_TIMER_DEF(m_coalesceTimer);
+
+static void responsePump(void);
+
+/*!
+ * @brief Supply a copied or static response's data.
+ */
+static uint16_t
+responseDataGenerate(uint8_t *buffer, uint16_t size, void *context)
+{
+  response_slot_t *slot = context;
+  uint16_t length = slot->length - slot->offset;
+
+  if (length > size)
+    length = size;
+  memcpy(buffer, slot->data + slot->offset, length);
+  slot->offset += length;
+  return length;
+}
+
+static bool
+responseIsStream(response_slot_t const *slot)
+{
+  return slot->length > RESPONSE_FRAMED_MAX_LENGTH ||
+      (slot->interruptible && slot->length > RESPONSE_UNINTERRUPTED_MAX_LENGTH);
+}
+
+/*!
+ * @brief List the queued responses in the order they are to be sent, by
+ * priority then by when they were queued. A suspended stream is left out.
+ *
+ * @param order - filled with slot indexes
+ * @return the number of slots listed
+ */
+static uint8_t
+responseOrder(uint8_t *order)
+{
+  uint8_t count = 0;
+
+  for (uint8_t i = 0; i < COMMAND_RESPONSE_BUFFER_COUNT; i++)
+  {
+    response_slot_t const *slot = &m_slots[i];
+    if (!slot->queued || i == m_suspended)
+      continue;
+
+    // Insertion sort; there are only a few slots
+    uint8_t j = count++;
+    while (j > 0)
+    {
+      response_slot_t const *before = &m_slots[order[j - 1]];
+      if (before->priority < slot->priority ||
+          (before->priority == slot->priority && (int16_t) (slot->sequence - before->sequence) > 0))
+        break;
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = i;
+  }
+
+  return count;
+}
+
+/*!
+ * @brief Get ready to send a response.
+ */
+static void
+responseBegin(uint8_t index)
+{
+  response_slot_t const *slot = &m_slots[index];
+
+  m_current = index;
+  memset(&m_tx, 0, sizeof(m_tx));
+  m_tx.phase = RESPONSE_MARK;
+  m_tx.stream = responseIsStream(slot);
+  m_tx.remaining = m_tx.stream ? 0 : slot->length;
+}
+
+/*!
+ * @brief Free a slot and tell its owner.
+ */
+static void
+responseRelease(uint8_t index)
+{
+  response_slot_t *slot = &m_slots[index];
+  bool sent = m_releasedSent;
+  uint32_t sentTicks = m_releasedSentTicks;
+
+  // Free the slot first; the done callback may queue a response into it
+  slot->queued = false;
+  m_slotCount--;
+
+  m_releasedSent = slot->sent;
+  m_releasedSentTicks = slot->sentTicks;
+  if (slot->done != NULL)
+    slot->done(slot->data, slot->context);
+  m_releasedSent = sent;
+  m_releasedSentTicks = sentTicks;
+}
+
+/*!
+ * @brief Release the response just sent, or all those packed with it.
+ */
+static void
+responseFinish()
+{
+  uint8_t index = m_current;
+
+  m_current = RESPONSE_SLOT_NONE;
+  if (m_tx.packed == 0)
+  {
+    responseRelease(index);
+    return;
+  }
+
+  for (uint8_t i = 0; i < m_tx.packed; i++)
+    responseRelease(m_tx.packedSlots[i]);
+}
+
+/*!
+ * @brief Note the SoftDevice taking a notification of the response being
+ * sent, or of each packed into it.
+ */
+static void
+responseTaken()
+{
+  uint32_t ticks = app_timer_cnt_get();
+  uint8_t count = (m_tx.packed > 0) ? m_tx.packed : 1;
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    response_slot_t *slot = &m_slots[(m_tx.packed > 0) ? m_tx.packedSlots[i] : m_current];
+    if (!slot->sent)
+    {
+      slot->sent = true;
+      slot->sentTicks = ticks;
+    }
+  }
+}
+
+/*!
+ * @brief Between responses, pick the next to send.
+ *
+ * @details A stream that was cut into resumes once no higher priority
+ * response that could cut in is waiting.
+ */
+static void
+responseSelect()
+{
+  uint8_t order[COMMAND_RESPONSE_BUFFER_COUNT];
+  uint8_t count = responseOrder(order);
+
+  if (m_suspended != RESPONSE_SLOT_NONE &&
+      (count == 0 || m_slots[order[0]].priority >= m_slots[m_suspended].priority ||
+       responseIsStream(&m_slots[order[0]])))
+  {
+    m_current = m_suspended;
+    m_tx = m_suspendedTx;
+    m_suspended = RESPONSE_SLOT_NONE;
+    return;
+  }
+
+  if (count > 0 && order[0] != m_current)
+    responseBegin(order[0]);
+}
+
+/*!
+ * @brief Between fragments of a stream, let a higher priority response cut in.
+ *
+ * @details Only one response cuts in at a time, and it must be framed; the
+ * stream resumes once it has been sent.
+ */
+static void
+responseCutIn()
+{
+  if (!m_tx.stream || m_tx.phase != RESPONSE_BODY || m_tx.ended ||
+      m_suspended != RESPONSE_SLOT_NONE)
+    return;
+
+  uint8_t order[COMMAND_RESPONSE_BUFFER_COUNT];
+  uint8_t count = responseOrder(order);
+  uint8_t next = (order[0] == m_current) ? 1 : 0;
+
+  if (next >= count)
+    return;
+
+  response_slot_t const *slot = &m_slots[order[next]];
+  if (slot->priority < m_slots[m_current].priority && !responseIsStream(slot))
+  {
+    m_suspended = m_current;
+    m_suspendedTx = m_tx;
+    responseBegin(order[next]);
+  }
+}
+
+static bool
+responsePackable(response_slot_t const *slot)
+{
+  return slot->generator == responseDataGenerate && !slot->carried &&
+      slot->length <= RESPONSE_PACKED_MAX_LENGTH;
+}
+
+/*!
+ * @brief Pick the responses, from the one about to be sent, that fit in one
+ * packed notification.
+ *
+ * @details Only responses of the same priority are packed together.
+ *
+ * @param full - set true if no further response could join them
+ * @return the number of responses; 0 if the first cannot be packed
+ */
+static uint8_t
+responsePackCount(bool *full)
+{
+  uint8_t order[COMMAND_RESPONSE_BUFFER_COUNT];
+  uint8_t listed = responseOrder(order);
+  uint16_t bytes = 1;
+  uint8_t count = 0;
+
+  *full = true;
+  while (count < listed)
+  {
+    response_slot_t const *slot = &m_slots[order[count]];
+    if (!responsePackable(slot) || slot->priority != m_slots[m_current].priority ||
+        bytes + 1 + slot->length > RESPONSE_FRAGMENT_SIZE)
+      return count;
+    m_tx.packedSlots[count] = order[count];
+    bytes += 1 + slot->length;
+    count++;
+  }
+
+  // Another response could still join unless every buffer is taken
+  *full = (m_slotCount == COMMAND_RESPONSE_BUFFER_COUNT);
+  return count;
+}
+
+/*!
+ * @brief Decide whether the response about to be sent goes out packed, and
+ * whether to hold it back for more to join it.
+ *
+ * @return true to wait for another response or the coalescing timer
+ */
+static bool
+responseCoalesceWait()
+{
+  bool full = true;
+
+  m_tx.packed = m_coalesce.enabled ? responsePackCount(&full) : 0;
+  if (m_tx.packed > 0 && !full && !m_coalesce.expired && m_coalesce.delayTicks > 0)
+  {
+    if (!m_coalesce.waiting)
+    {
+      m_coalesce.waiting = true;
+      APP_ERROR_CHECK(app_timer_start(m_coalesceTimer, m_coalesce.delayTicks, NULL));
+    }
+    return true;
+  }
+
+  if (m_coalesce.waiting)
+    (void) app_timer_stop(m_coalesceTimer);
+  m_coalesce.waiting = false;
+  m_coalesce.expired = false;
+  return false;
+}
+
+static void
+coalesceTimeoutHandler(void * p_context)
+{
+  CRITICAL_REGION_ENTER();
+  m_coalesce.waiting = false;
+  m_coalesce.expired = true;
+  responsePump();
+  CRITICAL_REGION_EXIT();
+}
+
+/*!
+ * @brief Generate the next fragment of the response being sent.
+ *
+ * @return true if there is a fragment to send, false if the response is done
+ */
+static bool
+responseFill()
+{
+  response_slot_t *slot = &m_slots[m_current];
+
+  if (m_tx.phase == RESPONSE_MARK)
+  {
+    m_tx.phase = RESPONSE_STAMP;
+    if (slot->carried)
+    {
+      m_tx.fragment[0] = RESPONSE_CARRIED;
+      m_tx.fragment[1] = slot->request & 0xFF;
+      m_tx.fragment[2] = slot->request >> 8;
+      m_tx.fragmentLength = 3;
+      return true;
+    }
+  }
+
+  if (m_tx.phase == RESPONSE_STAMP)
+  {
+    m_tx.phase = RESPONSE_HEADER;
+    if (m_stamp != NULL)
+    {
+      m_tx.fragmentLength = m_stamp(m_tx.fragment, RESPONSE_FRAGMENT_SIZE);
+      if (m_tx.fragmentLength > 0)
+        return true;
+    }
+  }
+
+  if (m_tx.phase == RESPONSE_HEADER)
+  {
+    m_tx.phase = RESPONSE_BODY;
+    if (m_tx.packed > 0)
+    {
+      m_tx.fragment[0] = RESPONSE_PACKED;
+      m_tx.fragmentLength = 1;
+      for (uint8_t i = 0; i < m_tx.packed; i++)
+      {
+        response_slot_t const *packed = &m_slots[m_tx.packedSlots[i]];
+        m_tx.fragment[m_tx.fragmentLength++] = packed->length;
+        memcpy(m_tx.fragment + m_tx.fragmentLength, packed->data, packed->length);
+        m_tx.fragmentLength += packed->length;
+      }
+      m_tx.remaining = 0;
+      return true;
+    }
+
+    if (slot->header != NULL && !m_tx.stream)
+    {
+      memcpy(m_tx.fragment, slot->header, RESPONSE_HEADER_LENGTH);
+      m_tx.fragmentLength = RESPONSE_HEADER_LENGTH;
+      return true;
+    }
+
+    response_builder_t builder;
+    responseBuilderInit(&builder, (char *) m_tx.fragment, sizeof(m_tx.fragment));
+    if (m_tx.stream)
+      responseAppendText(&builder, "dataStream:");
+    else
+    {
+      responseAppendText(&builder, "dataAvailable:");
+      responseAppendUnsigned(&builder, m_tx.remaining, 4);
+    }
+    m_tx.fragmentLength = builder.length;
+    return true;
+  }
+
+  if (m_tx.stream)
+  {
+    if (m_tx.ended)
+      return false;
+
+    uint16_t length = slot->generator(m_tx.fragment + 1, RESPONSE_FRAGMENT_SIZE - 1,
+        slot->generatorContext);
+    m_tx.ended = (length == 0);
+    m_tx.fragment[0] = m_tx.ended ? RESPONSE_STREAM_END : RESPONSE_STREAM_MORE;
+    m_tx.fragmentLength = length + 1;
+    return true;
+  }
+
+  if (m_tx.remaining == 0)
+    return false;
+
+  uint16_t size = (m_tx.remaining < RESPONSE_FRAGMENT_SIZE) ? m_tx.remaining : RESPONSE_FRAGMENT_SIZE;
+  uint16_t length = slot->generator(m_tx.fragment, size, slot->generatorContext);
+  if (length == 0)
+  {
+    NRF_LOG_INFO("Response ended %d bytes short", m_tx.remaining);
+    return false;
+  }
+  m_tx.remaining -= length;
+  m_tx.fragmentLength = length;
+  return true;
+}
+
+/*!
+ * @brief Take a free slot, set up for a response from data at the current
+ * priority.
+ *
+ * @return the slot, or NULL if there is none
+ */
+static response_slot_t *
+responseSlotTake()
+{
+  response_slot_t *slot = m_slots;
+
+  while (slot < m_slots + COMMAND_RESPONSE_BUFFER_COUNT && slot->queued)
+    slot++;
+  if (slot == m_slots + COMMAND_RESPONSE_BUFFER_COUNT)
+  {
+    NRF_LOG_INFO("Response dropped, no response buffer free");
+    return NULL;
+  }
+
+  slot->generator = responseDataGenerate;
+  slot->generatorContext = slot;
+  slot->done = NULL;
+  slot->context = NULL;
+  slot->header = NULL;
+  slot->data = NULL;
+  slot->length = 0;
+  slot->offset = 0;
+  slot->priority = m_priority;
+  slot->interruptible = m_interruptible;
+  slot->request = m_request;
+  slot->carried = m_requestCarried;
+  slot->sent = false;
+  return slot;
+}
+
+/*!
+ * @brief Queue the slot responseSlotTake() returned and start sending.
+ */
+static void
+responseSlotQueue(response_slot_t *slot)
+{
+  slot->sequence = m_sequence++;
+  slot->queued = true;
+  m_slotCount++;
+
+  // Nobody is waiting for it any more
+  if (slot->carried && m_carry == RESPONSE_CARRY_DROP)
+  {
+    responseRelease(slot - m_slots);
+    return;
+  }
+
+  responsePump();
+}
+
+void
+responseInit(response_stamp_t stamp)
+{
+  for (uint8_t i = 0; i < COMMAND_RESPONSE_BUFFER_COUNT; i++)
+    m_slots[i].queued = false;
+  m_slotCount = 0;
+  m_sequence = 0;
+  m_priority = 0;
+  m_interruptible = false;
+  m_request = 0;
+  m_requestCarried = false;
+  m_carry = RESPONSE_CARRY_SEND;
+  m_current = RESPONSE_SLOT_NONE;
+  m_suspended = RESPONSE_SLOT_NONE;
+  m_releasedSent = false;
+  m_stamp = stamp;
+  m_noticeLength = 0;
+  m_noticeBuildCount = 0;
+  m_builtNoticeLength = 0;
+  m_held = false;
+  m_paused = false;
+  memset(&m_coalesce, 0, sizeof(m_coalesce));
+
+  ret_code_t err_code = app_timer_create(&m_coalesceTimer, APP_TIMER_MODE_SINGLE_SHOT, coalesceTimeoutHandler);
+  APP_ERROR_CHECK(err_code);
+}
+
+void
+responsePriority(uint8_t priority, bool interruptible)
+{
+  CRITICAL_REGION_ENTER();
+  m_priority = priority;
+  m_interruptible = interruptible;
+  CRITICAL_REGION_EXIT();
+}
+
+void
+responseSendNotice(void const *notice, uint16_t length)
+{
+  if (length > sizeof(m_notice))
+    return;
+
+  CRITICAL_REGION_ENTER();
+  memcpy(m_notice, notice, length);
+  m_noticeLength = length;
+  responsePump();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+responseRequest(uint16_t request, bool carried)
+{
+  CRITICAL_REGION_ENTER();
+  m_request = request;
+  m_requestCarried = carried;
+  CRITICAL_REGION_EXIT();
+}
+
+void
+responseRequestNotice(response_notice_t build)
+{
+  CRITICAL_REGION_ENTER();
+  uint8_t i = 0;
+  while (i < m_noticeBuildCount && m_noticeBuilds[i] != build)
+    i++;
+  if (i == m_noticeBuildCount && i < RESPONSE_NOTICE_BUILDERS)
+    m_noticeBuilds[m_noticeBuildCount++] = build;
+  responsePump();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+responseCoalesce(bool enabled, uint16_t delayMs)
+{
+  CRITICAL_REGION_ENTER();
+  m_coalesce.enabled = enabled;
+  m_coalesce.delayTicks = APP_TIMER_TICKS(delayMs);
+
+  // Send anything that was being held back
+  if (!enabled && m_coalesce.waiting)
+  {
+    m_coalesce.expired = true;
+    responsePump();
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+bool
+responseSend(void const *data, uint16_t length)
+{
+  if (length > COMMAND_RESPONSE_BUFFER_SIZE)
+  {
+    NRF_LOG_INFO("Response of %d bytes dropped, too long", length);
+    return false;
+  }
+
+  bool queued = false;
+
+  CRITICAL_REGION_ENTER();
+  response_slot_t *slot = responseSlotTake();
+  if (slot != NULL)
+  {
+    memcpy(slot->buffer, data, length);
+    slot->data = slot->buffer;
+    slot->length = length;
+    responseSlotQueue(slot);
+    queued = true;
+  }
+  CRITICAL_REGION_EXIT();
+
+  return queued;
+}
+
+bool
+responseSendStatic(char const *header, void const *data, uint16_t length,
+                   response_done_t done, void *context)
+{
+  response_slot_t *slot;
+
+  CRITICAL_REGION_ENTER();
+  slot = responseSlotTake();
+  if (slot != NULL)
+  {
+    slot->header = header;
+    slot->data = data;
+    slot->length = length;
+    slot->done = done;
+    slot->context = context;
+    responseSlotQueue(slot);
+  }
+  CRITICAL_REGION_EXIT();
+
+  if (slot == NULL && done != NULL)
+    done(data, context);
+  return slot != NULL;
+}
+
+bool
+responseStart(uint32_t length, response_generator_t generator,
+              response_done_t done, void *context)
+{
+  response_slot_t *slot;
+
+  CRITICAL_REGION_ENTER();
+  slot = responseSlotTake();
+  if (slot != NULL)
+  {
+    slot->generator = generator;
+    slot->generatorContext = context;
+    slot->done = done;
+    slot->context = context;
+    slot->length = length;
+    responseSlotQueue(slot);
+  }
+  CRITICAL_REGION_EXIT();
+
+  if (slot == NULL && done != NULL)
+    done(NULL, context);
+  return slot != NULL;
+}
+
+uint8_t
+responseSlotsFree(void)
+{
+  return COMMAND_RESPONSE_BUFFER_COUNT - m_slotCount;
+}
+
+bool
+responseSent(uint32_t *ticks)
+{
+  if (m_releasedSent)
+    *ticks = m_releasedSentTicks;
+  return m_releasedSent;
+}
+
+/*!
+ * @brief Send a notice.
+ *
+ * @param length - the notice length, cleared once it is sent or dropped
+ * @return false if the SoftDevice has no room for it yet
+ */
+static bool
+noticeSend(uint8_t const *notice, uint16_t *length)
+{
+  uint16_t sendLength = *length;
+  uint32_t sendError = ble_cmd_data_send((char *) notice, &sendLength);
+
+  if (sendError == NRF_ERROR_RESOURCES)
+    return false;
+  if (sendError != NRF_SUCCESS)
+    NRF_LOG_INFO("Notice dropped, error 0x%x", sendError);
+  *length = 0;
+  return true;
+}
+
+/*!
+ * @brief Send as much of the queued responses as the SoftDevice will take.
+ *
+ * @note Call with the queue locked.
+ */
+static void
+responsePump(void)
+{
+  // A generator or done callback may queue a response
+  if (m_pumping || m_held || m_paused)
+    return;
+  m_pumping = true;
+
+  while (m_slotCount > 0 || m_noticeLength > 0 ||
+         m_noticeBuildCount > 0 || m_builtNoticeLength > 0)
+  {
+    bool boundary = (m_current == RESPONSE_SLOT_NONE) ||
+        (m_tx.phase == RESPONSE_MARK && m_tx.fragmentLength == 0);
+
+    // Notices go between responses
+    if (m_noticeLength > 0 && boundary)
+    {
+      if (!noticeSend(m_notice, &m_noticeLength))
+        break;
+      continue;
+    }
+
+    // Built only now, so it carries whatever changed while waiting
+    if (m_builtNoticeLength == 0 && m_noticeBuildCount > 0 && boundary)
+    {
+      response_notice_t build = m_noticeBuilds[0];
+
+      memmove(m_noticeBuilds, m_noticeBuilds + 1, --m_noticeBuildCount * sizeof(m_noticeBuilds[0]));
+      m_builtNoticeLength = build(m_builtNotice, sizeof(m_builtNotice));
+      continue;
+    }
+
+    if (m_builtNoticeLength > 0 && boundary)
+    {
+      if (!noticeSend(m_builtNotice, &m_builtNoticeLength))
+        break;
+      continue;
+    }
+
+    if (m_slotCount == 0 || m_carry == RESPONSE_CARRY_HOLD)
+      break;
+
+    if (boundary)
+      responseSelect();
+    else if (m_tx.fragmentLength == 0)
+      responseCutIn();
+
+    if (m_tx.fragmentLength == 0)
+    {
+      // Hold short responses back briefly so others can share the notification
+      if (m_tx.phase == RESPONSE_MARK && responseCoalesceWait())
+        break;
+
+      if (!responseFill())
+      {
+        responseFinish();
+        continue;
+      }
+    }
+
+    uint16_t length = m_tx.fragmentLength;
+    uint32_t sendError = ble_cmd_data_send((char *) m_tx.fragment, &length);
+
+    // Wait for BLE_CMD_EVT_TX_RDY
+    if (sendError == NRF_ERROR_RESOURCES)
+      break;
+
+    m_tx.fragmentLength = 0;
+    if (sendError != NRF_SUCCESS)
+    {
+      NRF_LOG_INFO("Response dropped, error 0x%x", sendError);
+      responseFinish();
+    }
+    else
+      responseTaken();
+  }
+
+  m_pumping = false;
+}
+
+/*!
+ * @brief responseCancel() with the queue locked.
+ */
+static bool
+responseCancelCurrent(void)
+{
+  uint8_t order[COMMAND_RESPONSE_BUFFER_COUNT];
+  uint8_t index = m_suspended;
+
+  // A stream that was cut into is the one running longest
+  if (index == RESPONSE_SLOT_NONE)
+    index = m_current;
+  if (index == RESPONSE_SLOT_NONE && responseOrder(order) > 0)
+    index = order[0];
+
+  if (index == RESPONSE_SLOT_NONE || m_slots[index].generator == responseDataGenerate)
+    return false;
+
+  if (index == m_suspended)
+    m_suspended = RESPONSE_SLOT_NONE;
+  else
+  {
+    m_current = RESPONSE_SLOT_NONE;
+    m_tx.fragmentLength = 0;
+  }
+  responseRelease(index);
+  return true;
+}
+
+void
+responseEventDue(void)
+{
+  CRITICAL_REGION_ENTER();
+  if (m_coalesce.waiting)
+  {
+    m_coalesce.expired = true;
+    responsePump();
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+void
+responseTxReady(void)
+{
+  CRITICAL_REGION_ENTER();
+  responsePump();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+responseHold(bool held)
+{
+  CRITICAL_REGION_ENTER();
+  m_held = held;
+  responsePump();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+responsePause(bool paused)
+{
+  CRITICAL_REGION_ENTER();
+  m_paused = paused;
+  responsePump();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+responseFlush(void)
+{
+  // Unlocked between sends so urgent work and BLE events still get in, but
+  // only sent from here while held, so responses go out whole
+  for (;;)
+  {
+    CRITICAL_REGION_ENTER();
+    bool held = m_held;
+    m_held = false;
+    m_coalesce.expired = true;
+    responsePump();
+    m_held = held;
+    CRITICAL_REGION_EXIT();
+
+    if (m_slotCount == 0 || m_carry == RESPONSE_CARRY_HOLD || m_paused)
+      break;
+    // Sleep until a notification has gone out rather than spinning on the
+    // SoftDevice
+    (void) sd_app_evt_wait();
+  }
+}
+
+bool
+responseCancel(void)
+{
+  bool cancelled;
+
+  CRITICAL_REGION_ENTER();
+  cancelled = responseCancelCurrent();
+  CRITICAL_REGION_EXIT();
+
+  return cancelled;
+}
+
+/*!
+ * @brief Start a response again from the beginning, or drop it if it is
+ * generated and so cannot be.
+ */
+static void
+responseRewind(uint8_t index)
+{
+  if (index == RESPONSE_SLOT_NONE)
+    return;
+
+  response_slot_t *slot = &m_slots[index];
+  if (slot->generator == responseDataGenerate)
+    slot->offset = 0;
+  else
+    responseRelease(index);
+}
+
+void
+responseDetach(void)
+{
+  CRITICAL_REGION_ENTER();
+  uint8_t current = m_current;
+  uint8_t suspended = m_suspended;
+
+  // Notices were for the link that dropped
+  m_noticeLength = 0;
+  m_noticeBuildCount = 0;
+  m_builtNoticeLength = 0;
+  if (m_coalesce.waiting)
+    (void) app_timer_stop(m_coalesceTimer);
+  m_coalesce.waiting = false;
+  m_coalesce.expired = false;
+
+  // Whatever of a response reached the SoftDevice may not have reached the
+  // central, so it goes again whole
+  m_current = RESPONSE_SLOT_NONE;
+  m_suspended = RESPONSE_SLOT_NONE;
+  m_tx.fragmentLength = 0;
+  m_carry = RESPONSE_CARRY_HOLD;
+  m_paused = false;
+  responseRewind(current);
+  responseRewind(suspended);
+
+  for (uint8_t i = 0; i < COMMAND_RESPONSE_BUFFER_COUNT; i++)
+    if (m_slots[i].queued)
+      m_slots[i].carried = true;
+  CRITICAL_REGION_EXIT();
+}
+
+void
+responseCarry(bool send)
+{
+  CRITICAL_REGION_ENTER();
+  m_carry = send ? RESPONSE_CARRY_SEND : RESPONSE_CARRY_DROP;
+  if (!send)
+  {
+    for (uint8_t i = 0; i < COMMAND_RESPONSE_BUFFER_COUNT; i++)
+      if (m_slots[i].queued && m_slots[i].carried)
+        responseRelease(i);
+  }
+  responsePump();
+  CRITICAL_REGION_EXIT();
+}
+
+uint8_t
+responseCarriedCount(void)
+{
+  uint8_t count = 0;
+
+  CRITICAL_REGION_ENTER();
+  for (uint8_t i = 0; i < COMMAND_RESPONSE_BUFFER_COUNT; i++)
+    if (m_slots[i].queued && m_slots[i].carried)
+      count++;
+  CRITICAL_REGION_EXIT();
+
+  return count;
+}
@@ -0,0 +1,360 @@
+/*!
+ * @file response.h
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Command responses queued and sent as notification slots free up
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#ifndef _RESPONSE_H
+#define _RESPONSE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdk_config.h"
+
+/*!
+ * @brief The most bytes carried by one notification, ATT MTU 23 - 3.
+ */
+#define RESPONSE_FRAGMENT_SIZE 20
+
+/*!
+ * @brief The longest response a dataAvailable header can announce.
+ */
+#define RESPONSE_FRAMED_MAX_LENGTH 9999
+
+/*!
+ * @brief The longest interruptible response sent framed; longer ones are
+ * streamed so they can be cut into, costing a flag byte per fragment.
+ */
+#define RESPONSE_UNINTERRUPTED_MAX_LENGTH (8 * RESPONSE_FRAGMENT_SIZE)
+
+/*!
+ * @brief Response length for a generator that runs until it returns 0.
+ */
+#define RESPONSE_LENGTH_UNKNOWN UINT32_MAX
+
+/*!
+ * @brief Stream fragment flags.
+ *
+ * @details Responses of unknown length, or longer than
+ * RESPONSE_FRAMED_MAX_LENGTH, are sent as a "dataStream:" notification
+ * followed by fragments, each a flag byte and up to
+ * RESPONSE_FRAGMENT_SIZE - 1 bytes of data:
+ *
+ *   +-Flag-+-Data-------------------------------------------------------+
+ *   | 0x00 | the next part of the response                              |
+ *   +------+------------------------------------------------------------+
+ *   | 0x01 | none; the response is complete                             |
+ *   +------+------------------------------------------------------------+
+ *   | 1 B  | <= RESPONSE_FRAGMENT_SIZE - 1 B                            |
+ *   +------+------------------------------------------------------------+
+ */
+#define RESPONSE_STREAM_MORE 0x00
+#define RESPONSE_STREAM_END  0x01
+
+/*!
+ * @brief Marks a packed notification.
+ *
+ * @details While coalescing is on (see responseCoalesce()), short copied or
+ * constant responses queued together go out in one notification rather than
+ * a header and data each:
+ *
+ *   +-Mark-+-Len-+-Response-----+-Len-+-Response-----+----
+ *   | 0x02 | n   | n B          | m   | m B          | ...
+ *   +------+-----+--------------+-----+--------------+----
+ *   | 1 B  | 1 B | <= RESPONSE_PACKED_MAX_LENGTH B    ...
+ *   +------+-----+--------------+-----+--------------+----
+ *
+ * It takes the place of a response header, which never starts with 0x02.
+ */
+#define RESPONSE_PACKED 0x02
+
+/*!
+ * @brief The longest response that can be packed.
+ */
+#define RESPONSE_PACKED_MAX_LENGTH (RESPONSE_FRAGMENT_SIZE - 2)
+
+/*!
+ * @brief Marks a response carried over from a link that dropped.
+ *
+ * @details Once the central resumes the session (see responseCarry()), each
+ * response that was not delivered before the link dropped is sent again
+ * whole, preceded by a notification giving the request it answers:
+ *
+ *   +-Mark-+-Request-+
+ *   | 0x06 | 2 B LE  |
+ *   +------+---------+
+ *
+ * Carried responses are never packed.
+ */
+#define RESPONSE_CARRIED 0x06
+
+/*!
+ * @brief Supplies the next part of a response.
+ *
+ * @param buffer  - where to put the data
+ * @param size    - the most bytes to supply
+ * @param context - the context given to responseStart()
+ * @return the number of bytes supplied; 0 ends the response
+ */
+typedef uint16_t (*response_generator_t)(uint8_t *buffer, uint16_t size, void *context);
+
+/*!
+ * @brief Called once a response has been sent, cancelled or dropped.
+ *
+ * @param data    - the data given to responseSendStatic(), or NULL
+ * @param context - the context given with the response
+ */
+typedef void (*response_done_t)(void const *data, void *context);
+
+/*!
+ * @brief Supplies a notification to send just before each response header.
+ *
+ * @param buffer - where to put the notification
+ * @param size   - the most bytes to supply
+ * @return the number of bytes supplied; 0 for none
+ */
+typedef uint16_t (*response_stamp_t)(uint8_t *buffer, uint16_t size);
+
+/*!
+ * @brief Builds a notice when it can be sent.
+ *
+ * @param buffer - where to put the notice
+ * @param size   - the most bytes to supply
+ * @return the number of bytes supplied; 0 for none
+ */
+typedef uint16_t (*response_notice_t)(uint8_t *buffer, uint16_t size);
+
+/*!
+ * @brief Initialize the response queue.
+ *
+ * @details Responses are queued in COMMAND_RESPONSE_BUFFER_COUNT slots, set
+ * per board in sdk_config.h, and sent in order, one fragment at a time as
+ * the SoftDevice has room to queue a notification; whatever does not fit
+ * now is sent from responseTxReady(). So a command can run and queue its
+ * response while earlier responses are still going out.
+ *
+ * A response of known length up to RESPONSE_FRAMED_MAX_LENGTH is framed
+ * with a "dataAvailable:%04d" header; anything else, and any interruptible
+ * response longer than RESPONSE_UNINTERRUPTED_MAX_LENGTH, is sent as a
+ * stream.
+ *
+ * Responses go out by priority (see responsePriority()), then in the order
+ * they were queued. A higher priority framed response may cut in between
+ * fragments of a stream; the host sees a notification starting with
+ * anything other than a stream flag, i.e. a stamp, header, packed
+ * notification or notice, and the stream carries on once that response is
+ * complete.
+ *
+ * @note Functions may be called from thread mode or any application
+ * interrupt priority; each locks the queue with a critical region, and
+ * generators, stamps and done callbacks are called with it locked.
+ *
+ * @param stamp - supplies a notification to precede each response; may be NULL
+ */
+void responseInit(response_stamp_t stamp);
+
+/*!
+ * @brief Set the priority of the responses queued from now on.
+ *
+ * @param priority      - 0 goes first
+ * @param interruptible - true to send long responses as streams that higher
+ *                        priority responses can cut into
+ */
+void responsePriority(uint8_t priority, bool interruptible);
+
+/*!
+ * @brief Set the request the responses queued from now on answer.
+ *
+ * @param request - the request, as numbered by the caller
+ * @param carried - true if the request was made over a link that has
+ *                  since dropped
+ */
+void responseRequest(uint16_t request, bool carried);
+
+/*!
+ * @brief Queue a response, copying it into a response buffer.
+ *
+ * @param data   - the response
+ * @param length - the response length, at most COMMAND_RESPONSE_BUFFER_SIZE
+ * @return true if queued, false if no slot was free or it was too long
+ */
+bool responseSend(void const *data, uint16_t length);
+
+/*!
+ * @brief Queue a response without copying it.
+ *
+ * @param header  - a RESPONSE_HEADER_LENGTH dataAvailable header for the
+ *                  response, or NULL to format one
+ * @param data    - the response, which must be left alone until @p done
+ * @param length  - the response length, at most RESPONSE_FRAMED_MAX_LENGTH
+ * @param done    - called once the response is finished with; may be NULL
+ * @param context - passed to @p done
+ * @return true if queued, false if no slot was free
+ */
+bool responseSendStatic(char const *header, void const *data, uint16_t length,
+                        response_done_t done, void *context);
+
+/*!
+ * @brief Queue a generated response.
+ *
+ * @details The generator is called for one fragment at a time, so data may
+ * be binary and, with RESPONSE_LENGTH_UNKNOWN, of any length. A framed
+ * response's generator must supply exactly @p length bytes.
+ *
+ * @param length    - the response length, or RESPONSE_LENGTH_UNKNOWN
+ * @param generator - supplies the response data
+ * @param done      - called once the response is finished with; may be NULL
+ * @param context   - passed to @p generator and @p done
+ * @return true if queued, false if no slot was free
+ */
+bool responseStart(uint32_t length, response_generator_t generator,
+                   response_done_t done, void *context);
+
+/*!
+ * @brief Send a notice between responses.
+ *
+ * @details A notice is a short notification outside the response framing,
+ * e.g. a credit grant. It goes out at the next response boundary, ahead of
+ * any response yet to start; a notice still waiting is replaced. A notice
+ * must start with a byte below 0x20 other than RESPONSE_PACKED so the host
+ * can tell it from a response header.
+ *
+ * @param notice - the notice, which is copied
+ * @param length - the notice length, at most RESPONSE_FRAGMENT_SIZE
+ */
+void responseSendNotice(void const *notice, uint16_t length);
+
+/*!
+ * @brief Build a notice at the next response boundary.
+ *
+ * @details Like responseSendNotice(), but the notice is built only once it
+ * can go, so it reports the latest state however long the link is busy.
+ * It goes after any notice sent with responseSendNotice() and does not
+ * replace it. A few different builders can be waiting at once, each asked
+ * in turn; asking again for one that is waiting does nothing.
+ *
+ * @param build - builds the notice, called with the queue locked
+ */
+void responseRequestNotice(response_notice_t build);
+
+/*!
+ * @brief Pack short responses together.
+ *
+ * @details While on, a response of up to RESPONSE_PACKED_MAX_LENGTH bytes
+ * waits up to @p delayMs for others to share its notification; it goes at
+ * once if the next response would not fit or every slot is taken. With a
+ * delay of 0 only responses already queued are packed.
+ *
+ * @param enabled - true to pack responses, false to frame each on its own
+ * @param delayMs - the longest to hold a response back
+ */
+void responseCoalesce(bool enabled, uint16_t delayMs);
+
+/*!
+ * @brief Send responses being held back before the next connection event.
+ *
+ * @details Call shortly before the radio becomes active, e.g. on a radio
+ * notification. A response waiting for others to share its notification
+ * goes at once rather than missing the event; with this, a long coalescing
+ * delay packs as much as it can without pushing responses to a later event.
+ */
+void responseEventDue(void);
+
+/*!
+ * @brief The number of response slots free.
+ */
+uint8_t responseSlotsFree(void);
+
+/*!
+ * @brief When the SoftDevice took the first notification of a response.
+ *
+ * @details Only for a done callback, about the response it is called for.
+ *
+ * @param ticks - set to the RTC ticks it was taken at
+ * @return true if it was taken, false if the response never got that far
+ */
+bool responseSent(uint32_t *ticks);
+
+/*!
+ * @brief Send as much of the queued responses as the SoftDevice will take.
+ *
+ * @details Call on BLE_CMD_EVT_TX_RDY.
+ */
+void responseTxReady(void);
+
+/*!
+ * @brief Stop or restart sending while the central has notifications off.
+ *
+ * @details Nothing is sent while paused, responses and notices alike; they
+ * keep their place and go out once restarted. responseDetach() restarts.
+ *
+ * @param paused - true to stop sending, false to send again
+ */
+void responsePause(bool paused);
+
+/*!
+ * @brief Send all queued responses, sleeping while the SoftDevice has no
+ * room.
+ *
+ * @details For thread tier commands that need the link to themselves. Sends
+ * even while responses are held, but not while paused; what is left then
+ * goes once restarted.
+ */
+void responseFlush(void);
+
+/*!
+ * @brief Hold queued responses back, e.g. while a command sends raw data.
+ *
+ * @details Responses may still be queued while held; they go out once
+ * released, or whole from responseFlush().
+ *
+ * @param held - true to hold responses back, false to send them again
+ */
+void responseHold(bool held);
+
+/*!
+ * @brief Keep the queued responses when the link drops.
+ *
+ * @details Call on disconnecting. Nothing more is sent until
+ * responseCarry() decides what becomes of the responses still queued and
+ * those queued from here on for requests marked carried. A response partly
+ * sent starts again from the beginning; a generated one cannot, so it is
+ * dropped. Notices waiting are dropped. The responses are bounded by the
+ * response slots, which they keep until decided.
+ */
+void responseDetach(void);
+
+/*!
+ * @brief Decide what becomes of responses carried over from a link that
+ * dropped.
+ *
+ * @param send - true to send them, each marked with RESPONSE_CARRIED; false
+ *               to drop them and any queued later for a carried request
+ */
+void responseCarry(bool send);
+
+/*!
+ * @brief The number of carried responses still queued.
+ */
+uint8_t responseCarriedCount(void);
+
+/*!
+ * @brief Stop sending the response being sent if it is generated.
+ *
+ * @details Fragments already queued are still sent; the host sees a
+ * truncated response.
+ *
+ * @return true if a response was cancelled, false otherwise
+ */
+bool responseCancel(void);
+
+#endif // _RESPONSE_H
@@ -0,0 +1,137 @@
+/*!
+ * @file responseBuilder.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief printf-free formatting of command responses
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "responseBuilder.h"
+
+static void
+appendChar(response_builder_t *builder, char c)
+{
+  if (builder->length < builder->size)
+    builder->buffer[builder->length++] = c;
+  else
+    builder->overflow = true;
+}
+
+/*!
+ * @brief Append digits produced least significant first.
+ */
+static void
+appendReversed(response_builder_t *builder, char const *digits, uint8_t count)
+{
+  while (count > 0)
+    appendChar(builder, digits[--count]);
+}
+
+void
+responseBuilderInit(response_builder_t *builder, char *buffer, uint16_t size)
+{
+  builder->buffer = buffer;
+  builder->size = size;
+  builder->length = 0;
+  builder->overflow = false;
+}
+
+void
+responseAppendText(response_builder_t *builder, char const *text)
+{
+  while (*text != '\0')
+    appendChar(builder, *text++);
+}
+
+void
+responseAppendBytes(response_builder_t *builder, void const *data, uint16_t length)
+{
+  uint16_t room = builder->size - builder->length;
+
+  if (length > room)
+  {
+    length = room;
+    builder->overflow = true;
+  }
+  memcpy(builder->buffer + builder->length, data, length);
+  builder->length += length;
+}
+
+void
+responseAppendUnsigned(response_builder_t *builder, uint32_t value, uint8_t minDigits)
+{
+  char digits[10];
+  uint8_t count = 0;
+
+  do {
+    digits[count++] = '0' + (value % 10);
+    value /= 10;
+  } while (value != 0);
+
+  while (minDigits > count)
+  {
+    appendChar(builder, '0');
+    minDigits--;
+  }
+  appendReversed(builder, digits, count);
+}
+
+void
+responseAppendSigned(response_builder_t *builder, int32_t value)
+{
+  if (value < 0)
+  {
+    appendChar(builder, '-');
+    responseAppendUnsigned(builder, -(uint32_t) value, 0);
+  }
+  else
+    responseAppendUnsigned(builder, (uint32_t) value, 0);
+}
+
+void
+responseAppendHex(response_builder_t *builder, uint64_t value, uint8_t minDigits)
+{
+  char digits[16];
+  uint8_t count = 0;
+
+  do {
+    digits[count++] = "0123456789abcdef"[value & 0xF];
+    value >>= 4;
+  } while (value != 0);
+
+  while (minDigits > count)
+  {
+    appendChar(builder, '0');
+    minDigits--;
+  }
+  appendReversed(builder, digits, count);
+}
+
+void
+responseAppendFixed(response_builder_t *builder, int32_t value, uint8_t decimals)
+{
+  uint32_t magnitude = (value < 0) ? -(uint32_t) value : (uint32_t) value;
+  uint32_t scale = 1;
+
+  for (uint8_t i = 0; i < decimals; i++)
+    scale *= 10;
+
+  if (value < 0)
+    appendChar(builder, '-');
+  responseAppendUnsigned(builder, magnitude / scale, 0);
+  if (decimals > 0)
+  {
+    appendChar(builder, '.');
+    responseAppendUnsigned(builder, magnitude % scale, decimals);
+  }
+}
@@ -0,0 +1,123 @@
+/*!
+ * @file responseBuilder.h
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief printf-free formatting of command responses
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#ifndef _RESPONSE_BUILDER_H
+#define _RESPONSE_BUILDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * @brief The length of a "dataAvailable:%04d" response header.
+ */
+#define RESPONSE_HEADER_LENGTH 18
+
+#define RESPONSE_HEADER_DIGIT(_length, _place) ('0' + ((_length) / (_place)) % 10)
+
+/*!
+ * @brief Define a constant response, framed at compile time.
+ *
+ * @details The header and text are laid out contiguously in flash, so
+ * sending the response needs no formatting or strlen(). @p _text must be a
+ * non-empty string literal of at most 9999 chars.
+ *
+ * @param _name - the name of the response
+ * @param _text - the response text
+ */
+#define RESPONSE_CONST_DEF(_name, _text)                                      \
+  static const struct                                                         \
+  {                                                                           \
+    char header[RESPONSE_HEADER_LENGTH];                                      \
+    char text[sizeof(_text) - 1];                                             \
+  } _name =                                                                   \
+  {                                                                           \
+    .header =                                                                 \
+    {                                                                         \
+      'd', 'a', 't', 'a', 'A', 'v', 'a', 'i', 'l', 'a', 'b', 'l', 'e', ':',   \
+      RESPONSE_HEADER_DIGIT(sizeof(_text) - 1, 1000),                         \
+      RESPONSE_HEADER_DIGIT(sizeof(_text) - 1, 100),                          \
+      RESPONSE_HEADER_DIGIT(sizeof(_text) - 1, 10),                           \
+      RESPONSE_HEADER_DIGIT(sizeof(_text) - 1, 1)                             \
+    },                                                                        \
+    .text = _text                                                             \
+  }
+
+/*!
+ * @brief A response being formatted.
+ *
+ * @details Appends that do not fit are truncated and set @p overflow; the
+ * buffer is never NUL-terminated.
+ *
+ * @field buffer   - where the response is formatted
+ * @field size     - the size of @p buffer
+ * @field length   - the number of bytes formatted so far
+ * @field overflow - true if anything was truncated
+ */
+typedef struct
+{
+  char *buffer;
+  uint16_t size;
+  uint16_t length;
+  bool overflow;
+} response_builder_t;
+
+/*!
+ * @brief Start formatting a response.
+ *
+ * @param builder - the builder
+ * @param buffer  - where to format the response
+ * @param size    - the size of @p buffer
+ */
+void responseBuilderInit(response_builder_t *builder, char *buffer, uint16_t size);
+
+/*!
+ * @brief Append a NUL-terminated string, without the NUL.
+ */
+void responseAppendText(response_builder_t *builder, char const *text);
+
+/*!
+ * @brief Append bytes, which may include zeros.
+ */
+void responseAppendBytes(response_builder_t *builder, void const *data, uint16_t length);
+
+/*!
+ * @brief Append an unsigned decimal.
+ *
+ * @param minDigits - pad with leading zeros to this many digits
+ */
+void responseAppendUnsigned(response_builder_t *builder, uint32_t value, uint8_t minDigits);
+
+/*!
+ * @brief Append a signed decimal.
+ */
+void responseAppendSigned(response_builder_t *builder, int32_t value);
+
+/*!
+ * @brief Append lower case hex digits.
+ *
+ * @param minDigits - pad with leading zeros to this many digits
+ */
+void responseAppendHex(response_builder_t *builder, uint64_t value, uint8_t minDigits);
+
+/*!
+ * @brief Append a fixed point value as a decimal with a fractional part.
+ *
+ * @details e.g. value 12345 with 3 decimals appends "12.345".
+ *
+ * @param value    - the value scaled by 10^@p decimals
+ * @param decimals - the number of fractional digits
+ */
+void responseAppendFixed(response_builder_t *builder, int32_t value, uint8_t decimals);
+
+#endif // _RESPONSE_BUILDER_H
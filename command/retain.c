@@ -0,0 +1,144 @@
+/*!
+ * @file retain.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Command state kept in RAM across a warm reset
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "app_util_platform.h"
+#include "crc32.h"
+
+#include "command.h"
+#include "retain.h"
+
+#if COMMAND_RETAIN_ENABLED
+
+// Marks the state as this firmware's; changes with the layout
+#define RETAIN_MAGIC (0x52540000UL | sizeof(retain_state_t))
+
+/*!
+ * @brief The state and what vouches for it, in the no-init section.
+ *
+ * @field magic - RETAIN_MAGIC
+ * @field state - the state
+ * @field crc   - the CRC-32 of the state
+ */
+static struct
+{
+  uint32_t magic;
+  retain_state_t state;
+  uint32_t crc;
+} m_retain __attribute__((section(".retain")));
+
+static bool m_resumed;
+
+static uint32_t
+retainCrc(void)
+{
+  return crc32_compute((uint8_t const *) &m_retain.state, sizeof(m_retain.state), NULL);
+}
+
+/*!
+ * @brief Vouch for the state again once it has changed.
+ *
+ * @note Call with the state locked.
+ */
+static void
+retainSeal(void)
+{
+  m_retain.crc = retainCrc();
+}
+
+bool
+retainInit(bool warm)
+{
+  m_resumed = warm && m_retain.magic == RETAIN_MAGIC && m_retain.crc == retainCrc();
+  if (!m_resumed)
+  {
+    // Zeroed as a whole so the padding is the same each time the CRC is taken
+    memset(&m_retain, 0, sizeof(m_retain));
+    m_retain.magic = RETAIN_MAGIC;
+    m_retain.state.command = NO_COMMAND;
+    retainSeal();
+  }
+
+  return m_resumed;
+}
+
+bool
+retainResumed(void)
+{
+  return m_resumed;
+}
+
+retain_state_t
+retainState(void)
+{
+  retain_state_t state;
+
+  CRITICAL_REGION_ENTER();
+  state = m_retain.state;
+  CRITICAL_REGION_EXIT();
+
+  return state;
+}
+
+void
+retainCommand(uint8_t command)
+{
+  CRITICAL_REGION_ENTER();
+  m_retain.state.command = command;
+  retainSeal();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+retainTimeStamping(bool timeStamping)
+{
+  CRITICAL_REGION_ENTER();
+  m_retain.state.timeStamping = timeStamping;
+  retainSeal();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+retainCoalescing(bool coalescing, uint16_t coalesceDelayMs)
+{
+  CRITICAL_REGION_ENTER();
+  m_retain.state.coalescing = coalescing;
+  m_retain.state.coalesceDelayMs = coalesceDelayMs;
+  retainSeal();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+retainSession(uint32_t token)
+{
+  CRITICAL_REGION_ENTER();
+  m_retain.state.sessionToken = token;
+  retainSeal();
+  CRITICAL_REGION_EXIT();
+}
+
+void
+retainLink(bool connected, ble_gap_addr_t const *peer)
+{
+  CRITICAL_REGION_ENTER();
+  m_retain.state.connected = connected;
+  m_retain.state.peer = *peer;
+  retainSeal();
+  CRITICAL_REGION_EXIT();
+}
+
+#endif // COMMAND_RETAIN_ENABLED
@@ -0,0 +1,95 @@
+/*!
+ * @file retain.h
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Command state kept in RAM across a warm reset
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#ifndef _RETAIN_H
+#define _RETAIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdk_config.h"
+#include "ble_gap.h"
+
+/*!
+ * @brief The state kept across a warm reset.
+ *
+ * @field command         - the command most recently run, as currentCommand()
+ * @field timeStamping    - whether responses are stamped, as TIME_STAMPING
+ * @field coalescing      - whether short responses are coalesced, as
+ *                          COALESCE_RESPONSES
+ * @field coalesceDelayMs - how long they wait to be coalesced
+ * @field sessionToken    - the token of the latest session
+ * @field connected       - whether a link was up
+ * @field peer            - the address of the last connected central
+ */
+typedef struct
+{
+  uint8_t command;
+  bool timeStamping;
+  bool coalescing;
+  uint16_t coalesceDelayMs;
+  uint32_t sessionToken;
+  bool connected;
+  ble_gap_addr_t peer;
+} retain_state_t;
+
+/*!
+ * @brief Take up the state kept from before the reset, or start it afresh.
+ *
+ * @details The state lives in a RAM section the startup code leaves alone
+ * (see the linker script), with a CRC-32 over it. It is taken up only after a
+ * reset that keeps RAM, i.e. not after power on or a brown out, and only if
+ * the CRC matches. Call first thing in main().
+ *
+ * @param warm - whether the reset kept RAM, from the reset reason
+ * @return true if the state was taken up
+ */
+bool retainInit(bool warm);
+
+/*!
+ * @brief Whether retainInit() took up the state from before the reset.
+ */
+bool retainResumed(void);
+
+/*!
+ * @brief The state as last kept.
+ */
+retain_state_t retainState(void);
+
+/*!
+ * @brief Keep the command most recently run.
+ */
+void retainCommand(uint8_t command);
+
+/*!
+ * @brief Keep whether responses are stamped.
+ */
+void retainTimeStamping(bool timeStamping);
+
+/*!
+ * @brief Keep whether short responses are coalesced, and how long they wait.
+ */
+void retainCoalescing(bool coalescing, uint16_t coalesceDelayMs);
+
+/*!
+ * @brief Keep the token of a new session.
+ */
+void retainSession(uint32_t token);
+
+/*!
+ * @brief Keep whether a link is up, and with which central.
+ */
+void retainLink(bool connected, ble_gap_addr_t const *peer);
+
+#endif // _RETAIN_H
@@ -0,0 +1,186 @@
+/*!
+ * @file subscription.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Event subscriptions, reported as deltas at a limited rate
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "subscription.h"
+
+// The longest record: type and a 5 byte varint per counter
+#define SUBSCRIPTION_RECORD_MAX_LENGTH (1 + 5 * SUBSCRIPTION_COUNTER_COUNT)
+
+/*!
+ * @brief Whether a type's value differs from that last reported.
+ */
+static bool
+changed(subscriptions_t const *subs, subscription_values_t const *values, uint8_t index)
+{
+  if (subs->fresh & (1 << index))
+    return true;
+
+  switch (index + 1)
+  {
+    case SUBSCRIPTION_STATE:
+      return values->command != subs->sent.command;
+    case SUBSCRIPTION_ERRORS:
+      return values->errors != subs->sent.errors;
+    case SUBSCRIPTION_COUNTERS:
+      return memcmp(values->counters, subs->sent.counters, sizeof(values->counters)) != 0;
+    default:
+      return false;
+  }
+}
+
+static uint8_t
+encodeVarint(uint8_t *buffer, uint32_t value)
+{
+  uint8_t length = 0;
+
+  while (value >= 0x80)
+  {
+    buffer[length++] = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  buffer[length++] = (uint8_t) value;
+  return length;
+}
+
+/*!
+ * @brief Encode a type's record and note its value as reported.
+ *
+ * @param buffer - room for SUBSCRIPTION_RECORD_MAX_LENGTH bytes
+ * @return the record length
+ */
+static uint8_t
+encodeRecord(subscriptions_t *subs, subscription_values_t const *values, uint8_t index, uint8_t *buffer)
+{
+  uint8_t length = 0;
+
+  buffer[length++] = index + 1;
+  switch (index + 1)
+  {
+    case SUBSCRIPTION_STATE:
+      buffer[length++] = values->command;
+      subs->sent.command = values->command;
+    break;
+    case SUBSCRIPTION_ERRORS:
+      buffer[length++] = values->errors;
+      subs->sent.errors = values->errors;
+    break;
+    case SUBSCRIPTION_COUNTERS:
+      for (uint8_t i = 0; i < SUBSCRIPTION_COUNTER_COUNT; i++)
+      {
+        length += encodeVarint(buffer + length, values->counters[i] - subs->sent.counters[i]);
+        subs->sent.counters[i] = values->counters[i];
+      }
+    break;
+  }
+  return length;
+}
+
+void
+subscriptionsInit(subscriptions_t *subs)
+{
+  memset(subs, 0, sizeof(*subs));
+  for (uint8_t i = 0; i < SUBSCRIPTION_TYPES; i++)
+    subs->intervalTicks[i] = SUBSCRIPTION_OFF;
+}
+
+void
+subscriptionSet(subscriptions_t *subs, subscription_type_t type,
+                uint64_t intervalTicks, uint64_t nowTicks)
+{
+  uint8_t index = type - 1;
+
+  if (index >= SUBSCRIPTION_TYPES)
+    return;
+
+  subs->intervalTicks[index] = intervalTicks;
+  if (intervalTicks == SUBSCRIPTION_OFF)
+  {
+    subs->fresh &= ~(1 << index);
+    return;
+  }
+
+  subs->dueTicks[index] = nowTicks;
+  subs->fresh |= 1 << index;
+  if (type == SUBSCRIPTION_COUNTERS)
+    memset(subs->sent.counters, 0, sizeof(subs->sent.counters));
+}
+
+uint8_t
+subscriptionsActive(subscriptions_t const *subs)
+{
+  uint8_t active = 0;
+
+  for (uint8_t i = 0; i < SUBSCRIPTION_TYPES; i++)
+    if (subs->intervalTicks[i] != SUBSCRIPTION_OFF)
+      active |= 1 << i;
+  return active;
+}
+
+bool
+subscriptionsDue(subscriptions_t const *subs, subscription_values_t const *values,
+                 uint64_t nowTicks, uint64_t *waitTicks)
+{
+  *waitTicks = SUBSCRIPTION_OFF;
+
+  for (uint8_t i = 0; i < SUBSCRIPTION_TYPES; i++)
+  {
+    if (subs->intervalTicks[i] == SUBSCRIPTION_OFF || !changed(subs, values, i))
+      continue;
+    if (nowTicks >= subs->dueTicks[i])
+      return true;
+    if (subs->dueTicks[i] - nowTicks < *waitTicks)
+      *waitTicks = subs->dueTicks[i] - nowTicks;
+  }
+  return false;
+}
+
+uint16_t
+subscriptionsEncode(subscriptions_t *subs, subscription_values_t const *values,
+                    uint64_t nowTicks, uint8_t *buffer, uint16_t size)
+{
+  uint8_t record[SUBSCRIPTION_RECORD_MAX_LENGTH];
+  uint16_t length = 1;
+
+  if (size < 1 + SUBSCRIPTION_RECORD_MAX_LENGTH)
+    return 0;
+
+  for (uint8_t i = 0; i < SUBSCRIPTION_TYPES; i++)
+  {
+    if (subs->intervalTicks[i] == SUBSCRIPTION_OFF || nowTicks < subs->dueTicks[i] ||
+        !changed(subs, values, i))
+      continue;
+
+    // Encode aside so a record that does not fit leaves the type due
+    subscriptions_t before = *subs;
+    uint8_t recordLength = encodeRecord(subs, values, i, record);
+    if (length + recordLength > size)
+    {
+      *subs = before;
+      continue;
+    }
+    memcpy(buffer + length, record, recordLength);
+    length += recordLength;
+    subs->fresh &= ~(1 << i);
+    subs->dueTicks[i] = nowTicks + subs->intervalTicks[i];
+  }
+
+  if (length == 1)
+    return 0;
+  buffer[0] = subs->sequence++;
+  return length;
+}
@@ -0,0 +1,143 @@
+/*!
+ * @file subscription.h
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Event subscriptions, reported as deltas at a limited rate
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#ifndef _SUBSCRIPTION_H
+#define _SUBSCRIPTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * @brief The number of event types that can be subscribed to.
+ */
+#define SUBSCRIPTION_TYPES 3
+
+/*!
+ * @brief The number of counters a SUBSCRIPTION_COUNTERS record reports.
+ */
+#define SUBSCRIPTION_COUNTER_COUNT 3
+
+/*!
+ * @brief The interval of a type not subscribed to.
+ */
+#define SUBSCRIPTION_OFF UINT64_MAX
+
+/*!
+ * @brief Event types, each reported as a record of the type followed by its
+ * value.
+ */
+typedef enum
+{
+  SUBSCRIPTION_STATE    = 0x01, // the command most recently run, 1 B
+  SUBSCRIPTION_ERRORS   = 0x02, // the COMMAND_ERROR_ flags, 1 B
+  SUBSCRIPTION_COUNTERS = 0x03  // how much each counter grew, a LEB128 varint each
+} subscription_type_t;
+
+/*!
+ * @brief What the event types report.
+ *
+ * @field command  - the command most recently run
+ * @field errors   - the COMMAND_ERROR_ flags
+ * @field counters - running totals, which may wrap
+ */
+typedef struct
+{
+  uint8_t command;
+  uint8_t errors;
+  uint32_t counters[SUBSCRIPTION_COUNTER_COUNT];
+} subscription_values_t;
+
+/*!
+ * @brief Subscription state.
+ *
+ * @field intervalTicks - the least time between records of each type, or
+ *                        SUBSCRIPTION_OFF
+ * @field dueTicks      - when each type may next be reported
+ * @field fresh         - types to report whatever their value, as they were
+ *                        just subscribed to; bit (type - 1)
+ * @field sent          - the values as last reported
+ * @field sequence      - counts notices encoded, wrapping
+ */
+typedef struct
+{
+  uint64_t intervalTicks[SUBSCRIPTION_TYPES];
+  uint64_t dueTicks[SUBSCRIPTION_TYPES];
+  uint8_t fresh;
+  subscription_values_t sent;
+  uint8_t sequence;
+} subscriptions_t;
+
+/*!
+ * @brief Drop all subscriptions.
+ *
+ * @details Counters are reported from zero again.
+ *
+ * @param subs - the subscriptions
+ */
+void subscriptionsInit(subscriptions_t *subs);
+
+/*!
+ * @brief Subscribe to an event type, or change or drop a subscription.
+ *
+ * @details A type subscribed to is reported in the next notice whatever its
+ * value; SUBSCRIPTION_COUNTERS then reports the totals since
+ * subscriptionsInit().
+ *
+ * @param subs          - the subscriptions
+ * @param type          - the event type
+ * @param intervalTicks - the least time between its records, or
+ *                        SUBSCRIPTION_OFF
+ * @param nowTicks      - the time now
+ */
+void subscriptionSet(subscriptions_t *subs, subscription_type_t type,
+                     uint64_t intervalTicks, uint64_t nowTicks);
+
+/*!
+ * @brief The types subscribed to.
+ *
+ * @return bit (type - 1) set for each
+ */
+uint8_t subscriptionsActive(subscriptions_t const *subs);
+
+/*!
+ * @brief Whether a notice is due.
+ *
+ * @param subs      - the subscriptions
+ * @param values    - the values now
+ * @param nowTicks  - the time now
+ * @param waitTicks - if none is due, how long until one will be for the
+ *                    changes so far, or SUBSCRIPTION_OFF if none will
+ * @return true if a type subscribed to has changed and may be reported now
+ */
+bool subscriptionsDue(subscriptions_t const *subs, subscription_values_t const *values,
+                      uint64_t nowTicks, uint64_t *waitTicks);
+
+/*!
+ * @brief Encode a notice of the types that are due.
+ *
+ * @details The notice is a sequence number followed by a record for each
+ * type that changed since it was last reported and whose interval has
+ * passed. Types that do not fit stay due.
+ *
+ * @param subs     - the subscriptions
+ * @param values   - the values now
+ * @param nowTicks - the time now
+ * @param buffer   - where to put the notice
+ * @param size     - the most bytes to supply
+ * @return the notice length; 0 if nothing was due
+ */
+uint16_t subscriptionsEncode(subscriptions_t *subs, subscription_values_t const *values,
+                             uint64_t nowTicks, uint8_t *buffer, uint16_t size);
+
+#endif // _SUBSCRIPTION_H
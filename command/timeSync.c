@@ -0,0 +1,120 @@
+/*!
+ * @file timeSync.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Host/device clock offset and drift estimation
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "timeSync.h"
+
+#define PPB 1000000000LL
+
+void
+timeSyncInit(time_sync_t *sync)
+{
+  memset(sync, 0, sizeof(time_sync_t));
+}
+
+static int64_t
+sampleOffset(time_sync_sample_t const *sample)
+{
+  return sample->deviceUs - sample->hostUs;
+}
+
+/*!
+ * @brief Refit the drift and offset.
+ *
+ * @details The drift is the least squares slope of offset against device time
+ * over the completed epoch minima. The offset is then taken from the lower
+ * envelope: the least delayed point once the drift has been removed.
+ */
+static void
+timeSyncFit(time_sync_t *sync)
+{
+  time_sync_sample_t const *newest = &sync->epochMin;
+  int64_t skewPpb = 0;
+
+  if (sync->count >= 2)
+  {
+    // Work relative to the newest point to keep the sums small
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    for (uint8_t i = 0; i < sync->count; i++)
+    {
+      double x = (double) (sync->samples[i].deviceUs - newest->deviceUs);
+      double y = (double) (sampleOffset(&sync->samples[i]) - sampleOffset(newest));
+      sumX += x;
+      sumY += y;
+      sumXX += x * x;
+      sumXY += x * y;
+    }
+
+    double denominator = sync->count * sumXX - sumX * sumX;
+    if (denominator > 0)
+      skewPpb = (int64_t) (((sync->count * sumXY - sumX * sumY) / denominator) * PPB);
+
+    if (skewPpb > TIME_SYNC_MAX_SKEW_PPB)
+      skewPpb = TIME_SYNC_MAX_SKEW_PPB;
+    else if (skewPpb < -TIME_SYNC_MAX_SKEW_PPB)
+      skewPpb = -TIME_SYNC_MAX_SKEW_PPB;
+  }
+
+  int64_t refOffset = sampleOffset(newest);
+  for (uint8_t i = 0; i < sync->count; i++)
+  {
+    int64_t drift = (skewPpb * (sync->samples[i].deviceUs - newest->deviceUs)) / PPB;
+    int64_t offset = sampleOffset(&sync->samples[i]) - drift;
+    if (offset < refOffset)
+      refOffset = offset;
+  }
+
+  sync->refDeviceUs = newest->deviceUs;
+  sync->refOffsetUs = refOffset;
+  sync->skewPpb = (int32_t) skewPpb;
+}
+
+void
+timeSyncAddSample(time_sync_t *sync, int64_t hostUs, int64_t deviceUs)
+{
+  time_sync_sample_t sample = { .hostUs = hostUs, .deviceUs = deviceUs };
+
+  // A new epoch starts with the previous epoch's minimum moved into the window
+  if (sync->epochCount == TIME_SYNC_EPOCH_SAMPLES)
+  {
+    if (sync->count == TIME_SYNC_WINDOW)
+    {
+      memmove(&sync->samples[0], &sync->samples[1], (TIME_SYNC_WINDOW - 1) * sizeof(time_sync_sample_t));
+      sync->count--;
+    }
+    sync->samples[sync->count++] = sync->epochMin;
+    sync->epochCount = 0;
+  }
+
+  if (sync->epochCount == 0 || sampleOffset(&sample) < sampleOffset(&sync->epochMin))
+    sync->epochMin = sample;
+  sync->epochCount++;
+
+  timeSyncFit(sync);
+  sync->synchronized = true;
+}
+
+bool
+timeSyncToHost(time_sync_t const *sync, int64_t deviceUs, int64_t *hostUs)
+{
+  if (!sync->synchronized)
+    return false;
+
+  int64_t drift = ((int64_t) sync->skewPpb * (deviceUs - sync->refDeviceUs)) / PPB;
+  *hostUs = deviceUs - (sync->refOffsetUs + drift);
+  return true;
+}
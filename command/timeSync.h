@@ -0,0 +1,116 @@
+/*!
+ * @file timeSync.h
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Host/device clock offset and drift estimation
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#ifndef _TIME_SYNC_H
+#define _TIME_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*!
+ * @brief The number of sync samples reduced to a single epoch minimum.
+ *
+ * @details BLE uplink delay varies by up to a connection interval, so a
+ * drift estimate needs many samples before the minima settle.
+ */
+#define TIME_SYNC_EPOCH_SAMPLES 16
+
+/*!
+ * @brief The number of epoch minima the estimator fits the drift over.
+ */
+#define TIME_SYNC_WINDOW 8
+
+/*!
+ * @brief Largest drift, in parts per billion, the estimator will report.
+ *
+ * @details Both ends run from crystals, so anything larger is link delay
+ * noise rather than real drift.
+ */
+#define TIME_SYNC_MAX_SKEW_PPB 200000
+
+/*!
+ * @brief A single sync exchange.
+ *
+ * @field hostUs   - the host's clock when it sent the sync request, plus any
+ *                   uplink delay correction the host supplied
+ * @field deviceUs - the device's clock when the request was received
+ */
+typedef struct
+{
+  int64_t hostUs;
+  int64_t deviceUs;
+} time_sync_sample_t;
+
+/*!
+ * @brief Estimator state.
+ *
+ * @details The estimate maps device time to host time as
+ *
+ *   hostUs = deviceUs - (refOffsetUs + skewPpb * (deviceUs - refDeviceUs) / 1e9)
+ *
+ * @field samples      - the least delayed sample of each recent epoch,
+ *                       oldest first
+ * @field count        - the number of valid entries in @p samples
+ * @field epochMin     - the least delayed sample of the current epoch
+ * @field epochCount   - the number of samples taken in the current epoch
+ * @field synchronized - true once at least one sample has been taken
+ * @field refDeviceUs  - device time of the offset reference sample
+ * @field refOffsetUs  - device minus host time at @p refDeviceUs
+ * @field skewPpb      - device clock drift relative to the host, parts per billion
+ */
+typedef struct
+{
+  time_sync_sample_t samples[TIME_SYNC_WINDOW];
+  uint8_t count;
+  time_sync_sample_t epochMin;
+  uint8_t epochCount;
+  bool synchronized;
+  int64_t refDeviceUs;
+  int64_t refOffsetUs;
+  int32_t skewPpb;
+} time_sync_t;
+
+/*!
+ * @brief Reset an estimator, discarding all samples.
+ *
+ * @param sync - the estimator
+ */
+void timeSyncInit(time_sync_t *sync);
+
+/*!
+ * @brief Add a sync sample and update the offset and drift estimate.
+ *
+ * @details Samples delayed on the link only ever make device minus host time
+ * look larger, so rather than averaging every sample the estimator keeps the
+ * least delayed sample of each epoch of TIME_SYNC_EPOCH_SAMPLES, and fits a
+ * line through those minima to find the drift. The offset is the least
+ * delayed sample, including the current epoch's, once drift is removed.
+ *
+ * @param sync     - the estimator
+ * @param hostUs   - the host time carried by the sync request
+ * @param deviceUs - the device time the request was received
+ */
+void timeSyncAddSample(time_sync_t *sync, int64_t hostUs, int64_t deviceUs);
+
+/*!
+ * @brief Convert device time to the synchronized host time base.
+ *
+ * @param sync     - the estimator
+ * @param deviceUs - the device time to convert
+ * @param hostUs   - the corresponding host time
+ * @return true if the estimator is synchronized, false otherwise
+ */
+bool timeSyncToHost(time_sync_t const *sync, int64_t deviceUs, int64_t *hostUs);
+
+#endif // _TIME_SYNC_H
@@ -0,0 +1,254 @@
+/*!
+ * @file upload.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Uploads streamed into a flash region
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "app_error.h"
+#include "app_util_platform.h"
+#include "crc32.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+#include "nrf_log.h"
+
+#include "upload.h"
+
+#if COMMAND_UPLOAD_ENABLED
+
+// Flash is read back this many words at a time
+#define UPLOAD_READ_WORDS 16
+
+static void uploadFsEventHandler(nrf_fstorage_evt_t *p_evt);
+
+NRF_FSTORAGE_DEF(nrf_fstorage_t m_uploadFs) =
+{
+  .evt_handler = uploadFsEventHandler
+};
+
+/*!
+ * @brief Upload state.
+ *
+ * @field size      - the upload's length in bytes, 0 until one is started
+ * @field crc       - its CRC-32
+ * @field next      - the offset of the next block, written or being written
+ * @field eraseAddr - the next page to erase
+ * @field eraseEnd  - the end of the pages the upload needs
+ * @field pageSize  - the flash erase unit
+ * @field erasing   - true while a page is being erased
+ * @field writing   - true while a block is being written
+ * @field failed    - true once a flash operation has failed
+ */
+static struct
+{
+  uint32_t size;
+  uint32_t crc;
+  uint32_t next;
+  uint32_t eraseAddr;
+  uint32_t eraseEnd;
+  uint32_t pageSize;
+  volatile bool erasing;
+  volatile bool writing;
+  volatile bool failed;
+} m_upload;
+
+static bool
+pageBlank(uint32_t pageAddr)
+{
+  uint32_t words[UPLOAD_READ_WORDS];
+
+  for (uint32_t addr = pageAddr; addr < pageAddr + m_upload.pageSize; addr += sizeof(words))
+  {
+    (void) nrf_fstorage_read(&m_uploadFs, addr, words, sizeof(words));
+    for (uint8_t i = 0; i < UPLOAD_READ_WORDS; i++)
+      if (words[i] != UINT32_MAX)
+        return false;
+  }
+  return true;
+}
+
+/*!
+ * @brief Queue the erase of the next page that needs it, if any.
+ *
+ * @note Call with the state locked and no operation queued.
+ */
+static void
+eraseStep(void)
+{
+  while (m_upload.eraseAddr < m_upload.eraseEnd && pageBlank(m_upload.eraseAddr))
+    m_upload.eraseAddr += m_upload.pageSize;
+  if (m_upload.eraseAddr == m_upload.eraseEnd)
+    return;
+
+  ret_code_t err_code = nrf_fstorage_erase(&m_uploadFs, m_upload.eraseAddr, 1, NULL);
+  if (err_code == NRF_SUCCESS)
+  {
+    m_upload.erasing = true;
+    m_upload.eraseAddr += m_upload.pageSize;
+  }
+  else
+  {
+    NRF_LOG_INFO("upload: erase not queued, 0x%x", err_code);
+    m_upload.failed = true;
+  }
+}
+
+static void
+uploadFsEventHandler(nrf_fstorage_evt_t *p_evt)
+{
+  CRITICAL_REGION_ENTER();
+  if (p_evt->result != NRF_SUCCESS)
+  {
+    NRF_LOG_INFO("upload: flash operation failed, 0x%x", p_evt->result);
+    m_upload.failed = true;
+  }
+
+  switch (p_evt->id)
+  {
+    case NRF_FSTORAGE_EVT_WRITE_RESULT:
+      m_upload.writing = false;
+    break;
+    case NRF_FSTORAGE_EVT_ERASE_RESULT:
+      m_upload.erasing = false;
+      if (!m_upload.failed)
+        eraseStep();
+    break;
+    default:
+    break;
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+void
+uploadInit(uint32_t startAddr, uint32_t endAddr)
+{
+  ret_code_t err_code;
+
+  m_uploadFs.start_addr = startAddr;
+  m_uploadFs.end_addr = endAddr;
+  err_code = nrf_fstorage_init(&m_uploadFs, &nrf_fstorage_sd, NULL);
+  APP_ERROR_CHECK(err_code);
+
+  m_upload.pageSize = m_uploadFs.p_flash_info->erase_unit;
+}
+
+uint32_t
+uploadCapacity(void)
+{
+  return m_uploadFs.end_addr - m_uploadFs.start_addr;
+}
+
+bool
+uploadStart(uint32_t size, uint32_t crc)
+{
+  bool started;
+
+  if (size == 0 || size > uploadCapacity())
+    return false;
+
+  CRITICAL_REGION_ENTER();
+  if (m_upload.size == size && m_upload.crc == crc && !m_upload.failed)
+    started = true;
+  else if (m_upload.erasing || m_upload.writing)
+    started = false;
+  else
+  {
+    m_upload.size = size;
+    m_upload.crc = crc;
+    m_upload.next = 0;
+    m_upload.failed = false;
+    m_upload.eraseAddr = m_uploadFs.start_addr;
+    m_upload.eraseEnd = m_uploadFs.start_addr +
+        ((size + m_upload.pageSize - 1) / m_upload.pageSize) * m_upload.pageSize;
+    eraseStep();
+    started = !m_upload.failed;
+  }
+  CRITICAL_REGION_EXIT();
+
+  return started;
+}
+
+bool
+uploadBusy(void)
+{
+  return m_upload.erasing || m_upload.writing;
+}
+
+bool
+uploadFailed(void)
+{
+  return m_upload.failed;
+}
+
+uint32_t
+uploadNext(void)
+{
+  return m_upload.next;
+}
+
+uint32_t
+uploadSize(void)
+{
+  return m_upload.size;
+}
+
+bool
+uploadWrite(void const *data, uint32_t offset, uint16_t length)
+{
+  bool queued = false;
+
+  CRITICAL_REGION_ENTER();
+  if (!m_upload.failed && !m_upload.erasing && !m_upload.writing &&
+      offset == m_upload.next && length > 0 && offset + length <= m_upload.size &&
+      (length % sizeof(uint32_t) == 0 || offset + length == m_upload.size))
+  {
+    uint32_t padded = (length + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+    ret_code_t err_code = nrf_fstorage_write(&m_uploadFs, m_uploadFs.start_addr + offset,
+                                             data, padded, NULL);
+    if (err_code == NRF_SUCCESS)
+    {
+      m_upload.writing = true;
+      m_upload.next += length;
+      queued = true;
+    }
+    else
+      NRF_LOG_INFO("upload: write not queued, 0x%x", err_code);
+  }
+  CRITICAL_REGION_EXIT();
+
+  return queued;
+}
+
+bool
+uploadVerify(uint32_t *crc)
+{
+  uint32_t words[UPLOAD_READ_WORDS];
+  uint32_t computed = 0;
+
+  *crc = 0;
+  if (m_upload.size == 0 || uploadBusy())
+    return false;
+
+  for (uint32_t offset = 0; offset < m_upload.size; offset += sizeof(words))
+  {
+    uint32_t length = (m_upload.size - offset < sizeof(words)) ? m_upload.size - offset : sizeof(words);
+    (void) nrf_fstorage_read(&m_uploadFs, m_uploadFs.start_addr + offset, words, sizeof(words));
+    computed = crc32_compute((uint8_t const *) words, length, (offset == 0) ? NULL : &computed);
+  }
+  *crc = computed;
+
+  return !m_upload.failed && m_upload.next == m_upload.size && computed == m_upload.crc;
+}
+
+#endif // COMMAND_UPLOAD_ENABLED
@@ -0,0 +1,99 @@
+/*!
+ * @file upload.h
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Uploads streamed into a flash region
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#ifndef _UPLOAD_H
+#define _UPLOAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdk_config.h"
+
+/*!
+ * @brief Set up the flash region uploads go to.
+ *
+ * @details E.g. a region reserved in the linker script, written through
+ * nrf_fstorage once the SoftDevice is enabled. An upload in the region is
+ * not picked up again after a reset; it is started over.
+ *
+ * @param startAddr - the first byte of the region, page aligned
+ * @param endAddr   - the byte after the region, page aligned
+ */
+void uploadInit(uint32_t startAddr, uint32_t endAddr);
+
+/*!
+ * @brief The largest upload the region takes, in bytes.
+ */
+uint32_t uploadCapacity(void);
+
+/*!
+ * @brief Start an upload, or carry on with the one under way.
+ *
+ * @details An upload of the same size and CRC that has not failed is
+ * carried on from uploadNext(), e.g. after the link dropped. Otherwise the
+ * pages the upload needs are erased in the background, all before its
+ * first block, so that the erases do not hold up the blocks; see
+ * uploadBusy(). Pages already blank are left alone.
+ *
+ * @param size - the upload's length in bytes
+ * @param crc  - the CRC-32 of the whole upload, as crc32_compute()
+ * @return true if started or carried on, false if the size is 0 or does not
+ *         fit, or an erase could not be queued
+ */
+bool uploadStart(uint32_t size, uint32_t crc);
+
+/*!
+ * @brief Whether a flash operation of the upload is under way.
+ */
+bool uploadBusy(void);
+
+/*!
+ * @brief Whether the upload failed: a flash operation did.
+ */
+bool uploadFailed(void);
+
+/*!
+ * @brief The offset of the next block the upload takes.
+ */
+uint32_t uploadNext(void);
+
+/*!
+ * @brief The upload's size, or 0 if none has been started.
+ */
+uint32_t uploadSize(void);
+
+/*!
+ * @brief Write the next block of the upload.
+ *
+ * @details The write goes on in the background; the data must be left alone
+ * until uploadBusy() is false.
+ *
+ * @param data   - the block, word aligned and padded with 0xFF to a whole
+ *                 number of words
+ * @param offset - where it goes in the upload; must be uploadNext()
+ * @param length - its length; a whole number of words unless it is the last
+ * @return true if the write is queued, false if the block is out of place
+ *         or the upload is busy or failed
+ */
+bool uploadWrite(void const *data, uint32_t offset, uint16_t length);
+
+/*!
+ * @brief Check the upload in flash against the CRC it was started with.
+ *
+ * @param[out] crc - the CRC-32 of what is in flash
+ * @return true if the whole upload is written and its CRC matches
+ */
+bool uploadVerify(uint32_t *crc);
+
+#endif // _UPLOAD_H
@@ -63,9 +63,13 @@
 #include "nrf_sdh_ble.h"
 #include "boards.h"
 #include "app_timer.h"
+#include "app_util_platform.h"
 #include "ble_lbs.h"
 #include "nrf_ble_gatt.h"
 #include "nrf_ble_qwr.h"
+#include "ble_radio_notification.h"
+#include "peer_manager.h"
+#include "peer_manager_handler.h"
 #include "nrf_pwr_mgmt.h"
 #include "nrf_delay.h"
 
@@ -75,6 +79,10 @@
 
 #include "ble_cmd.h"
 #include "command.h"
+#include "param.h"
+#include "journal.h"
+#include "upload.h"
+#include "retain.h"
 
 #define ADVERTISING_LED                 BSP_BOARD_LED_0                         // Is on when device is advertising.
 #define CONNECTED_LED                   BSP_BOARD_LED_1                         // Is on when device has connected.
@@ -84,18 +92,16 @@
 #define DEVICE_NAME                     "Peripheral1"                           // Name of device. Will be included in the advertising data.
 
 #define CMD_SERVICE_UUID_TYPE           BLE_UUID_TYPE_VENDOR_BEGIN              // UUID type for the Command Service (vendor specific).
+#define STATUS_COMPANY_ID               0xFFFF                                  // Company identifier of the status record in the manufacturer specific data; 0xFFFF is reserved for testing.
 
 #define APP_BLE_OBSERVER_PRIO           3                                       // Application's BLE observer priority. You shouldn't need to modify this value.
 #define APP_BLE_CONN_CFG_TAG            1                                       // A tag identifying the SoftDevice BLE configuration.
 
-#define APP_ADV_INTERVAL                64                                      // The advertising interval (in units of 0.625 ms; this value corresponds to 40 ms).
-#define APP_ADV_DURATION                BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED   // The advertising time-out (in units of seconds). When set to 0, we will never time out.
+#define APP_ADV_SLOW_DURATION           BLE_GAP_ADV_TIMEOUT_GENERAL_UNLIMITED   // The slow advertising time-out (in units of 10 ms). When set to 0, we will never time out.
+#define APP_ADV_DIRECTED_DURATION       BLE_GAP_ADV_TIMEOUT_HIGH_DUTY_MAX       // How long to advertise directed to the last central after losing it (in units of 10 ms; this value corresponds to 1.28 seconds).
 
-
-#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(100, UNIT_1_25_MS)        // Minimum acceptable connection interval (0.5 seconds).
-#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(200, UNIT_1_25_MS)        // Maximum acceptable connection interval (1 second).
-#define SLAVE_LATENCY                   0                                       // Slave latency.
-#define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(4000, UNIT_10_MS)         // Connection supervisory time-out (4 seconds).
+// The advertising intervals, fast advertising duration and preferred connection parameters are
+// runtime parameters (see param.h), settable with the PARAMETERS command.
 
 #define FIRST_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(20000)                  // Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (15 seconds).
 #define NEXT_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(5000)                   // Time between each call to sd_ble_gap_conn_param_update after the first call (5 seconds).
@@ -105,6 +111,26 @@
 
 #define DEAD_BEEF                       0xDEADBEEF                              // Value used as error code on stack dump, can be used to identify stack location on stack unwind.
 
+#define SEC_PARAM_BOND                  1                                       // Perform bonding.
+#define SEC_PARAM_MITM                  0                                       // Man In The Middle protection not required.
+#define SEC_PARAM_LESC                  0                                       // LE Secure Connections not enabled.
+#define SEC_PARAM_KEYPRESS              0                                       // Keypress notifications not enabled.
+#define SEC_PARAM_IO_CAPABILITIES       BLE_GAP_IO_CAPS_NONE                    // No I/O capabilities.
+#define SEC_PARAM_OOB                   0                                       // Out Of Band data not available.
+#define SEC_PARAM_MIN_KEY_SIZE          7                                       // Minimum encryption key size.
+#define SEC_PARAM_MAX_KEY_SIZE          16                                      // Maximum encryption key size.
+
+#define FAST_BLINK_INTERVAL_MS          50                                      // LED toggle interval for FAST_BLINK.
+#define SLOW_BLINK_INTERVAL_MS          250                                     // LED toggle interval for SLOW_BLINK and ALT_BLINK.
+
+#define BOOT_TIMER_TIMEOUT              APP_TIMER_TICKS(20000)                  // Longer than start up takes; boot notices only reach 16.7 s.
+#define BOOT_RTC_FREQUENCY              (APP_TIMER_CLOCK_FREQ / (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)) // RTC ticks per second.
+
+#define RESET_WARM_MASK                 (POWER_RESETREAS_RESETPIN_Msk | \
+                                         POWER_RESETREAS_DOG_Msk | \
+                                         POWER_RESETREAS_SREQ_Msk | \
+                                         POWER_RESETREAS_LOCKUP_Msk)            // Reset reasons that keep RAM.
+
 
 BLE_LBS_DEF(m_lbs);                                                             // LED Button Service instance.
 NRF_BLE_GATT_DEF(m_gatt);                                                       // GATT module instance.
@@ -113,6 +139,17 @@ NRF_BLE_QWR_DEF(m_qwr);
 //static bool connected;
 
 static bool m_connected;
+static bool m_conn_params_stale;                                                // Whether the connection parameters module has yet to take up parameters set while connected.
+
+APP_TIMER_DEF(m_blink_timer);                                                   // Steps the LED pattern of the last blink command.
+static command_id_t m_blink_command = NO_COMMAND;                               // The command whose LED pattern is showing.
+static bool m_blink_phase;                                                      // Which half of the ALT_BLINK pattern is showing.
+
+static bool m_resumed;                                                          // Whether the state from before a warm reset was resumed.
+static bool m_resuming;                                                         // Showing the resumed pattern until the link is back.
+static bool m_resume_link;                                                      // Whether a link was up when the reset came.
+static uint32_t m_boot_us[BOOT_STAGES];                                         // When each start up stage was done, in us since main() started.
+APP_TIMER_DEF(m_boot_timer);                                                    // Keeps the RTC running while the later start up stages are timed.
 
 static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID;                        // Handle of the current connection.
 static uint16_t   m_ble_cmd_max_data_len = BLE_GATT_ATT_MTU_DEFAULT - 3;        // Maximum length of data (in bytes) that can be transmitted to the peer by the Nordic UART service module.
@@ -121,21 +158,32 @@ static ble_uuid_t m_adv_uuids[]          =
     {BLE_UUID_CMD_SERVICE, CMD_SERVICE_UUID_TYPE}
 };
 
+/**@brief Advertising phases, each started when the one before it times out. */
+typedef enum
+{
+  ADV_PHASE_DIRECTED,                                                           // High duty directed to the last central, after losing it.
+  ADV_PHASE_FAST,                                                               // After boot, a disconnect or directed timing out.
+  ADV_PHASE_SLOW                                                                // Once nobody connected while fast.
+} adv_phase_t;
+
 static uint8_t m_adv_handle = BLE_GAP_ADV_SET_HANDLE_NOT_SET;                   // Advertising handle used to identify an advertising set.
-static uint8_t m_enc_advdata[BLE_GAP_ADV_SET_DATA_SIZE_MAX];                    // Buffer for storing an encoded advertising set.
-static uint8_t m_enc_scan_response_data[BLE_GAP_ADV_SET_DATA_SIZE_MAX];         // Buffer for storing an encoded scan data.
+static adv_phase_t m_adv_phase;                                                 // The advertising phase running or last run.
+static ble_gap_addr_t m_peer_addr;                                              // Address of the last connected central.
+static uint8_t m_enc_advdata[2][BLE_GAP_ADV_SET_DATA_SIZE_MAX];                 // Buffers for storing an encoded advertising set; the SoftDevice uses one while the other is refilled.
+static uint8_t m_enc_scan_response_data[2][BLE_GAP_ADV_SET_DATA_SIZE_MAX];      // Buffers for storing an encoded scan data, likewise.
+static uint8_t m_adv_status_changes;                                            // Change count of the status record being advertised.
 
 /**@brief Struct that contains pointers to the encoded advertising data. */
 static ble_gap_adv_data_t m_adv_data =
 {
     .adv_data =
     {
-        .p_data = m_enc_advdata,
+        .p_data = m_enc_advdata[0],
         .len    = BLE_GAP_ADV_SET_DATA_SIZE_MAX
     },
     .scan_rsp_data =
     {
-        .p_data = m_enc_scan_response_data,
+        .p_data = m_enc_scan_response_data[0],
         .len    = BLE_GAP_ADV_SET_DATA_SIZE_MAX
 
     }
@@ -168,6 +216,97 @@ static void leds_init(void)
 }
 
 
+/**@brief Function for showing the next step of the LED pattern.
+ *
+ * @details Sets the LEDs for the blink command showing and, if it blinks,
+ * starts the timer for the next step.
+ */
+static void blink_step(void)
+{
+  uint32_t interval_ms = 0;
+
+  switch (m_blink_command)
+  {
+  case FAST_BLINK:
+    bsp_board_led_invert(BLINK_LED_1);
+    bsp_board_led_off(BLINK_LED_2);
+    interval_ms = FAST_BLINK_INTERVAL_MS;
+    break;
+  case SLOW_BLINK:
+    bsp_board_led_invert(BLINK_LED_2);
+    bsp_board_led_off(BLINK_LED_1);
+    interval_ms = SLOW_BLINK_INTERVAL_MS;
+    break;
+  case ALT_BLINK:
+    m_blink_phase = !m_blink_phase;
+    if (m_blink_phase)
+    {
+      bsp_board_led_on(BLINK_LED_1);
+      bsp_board_led_off(BLINK_LED_2);
+    }
+    else
+    {
+      bsp_board_led_off(BLINK_LED_1);
+      bsp_board_led_on(BLINK_LED_2);
+    }
+    interval_ms = SLOW_BLINK_INTERVAL_MS;
+    break;
+  default:
+    bsp_board_led_off(BLINK_LED_1);
+    bsp_board_led_off(BLINK_LED_2);
+    break;
+  }
+
+  if (interval_ms > 0)
+  {
+    ret_code_t err_code = app_timer_start(m_blink_timer, APP_TIMER_TICKS(interval_ms), NULL);
+    APP_ERROR_CHECK(err_code);
+  }
+}
+
+
+/**@brief Function for handling the LED pattern timer timeout.
+ */
+static void blink_timeout_handler(void * p_context)
+{
+  UNUSED_PARAMETER(p_context);
+  CRITICAL_REGION_ENTER();
+  blink_step();
+  CRITICAL_REGION_EXIT();
+}
+
+
+/**@brief Function for handling the boot timer timeout.
+ *
+ * @details Nothing to do; the timer only keeps the RTC running.
+ */
+static void boot_timeout_handler(void * p_context)
+{
+  UNUSED_PARAMETER(p_context);
+}
+
+
+/**@brief Function for showing the LED pattern of the current command.
+ *
+ * @details Called once commands have run; a new pattern shows at once rather
+ *          than when the last one's step is done.
+ */
+static void leds_update(void)
+{
+  CRITICAL_REGION_ENTER();
+  command_id_t command = (m_connected || m_resuming) ? currentCommand() : NO_COMMAND;
+  if (command != m_blink_command)
+  {
+    ret_code_t err_code = app_timer_stop(m_blink_timer);
+    APP_ERROR_CHECK(err_code);
+    m_blink_command = command;
+    m_blink_phase = false;
+    blink_step();
+  }
+  CRITICAL_REGION_EXIT();
+}
+
+
 /**@brief Function for the Timer initialization.
  *
  * @details Initializes the timer module.
@@ -177,6 +316,27 @@ static void timers_init(void)
   // Initialize timer module, making it use the scheduler
   ret_code_t err_code = app_timer_init();
   APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_create(&m_blink_timer, APP_TIMER_MODE_SINGLE_SHOT, blink_timeout_handler);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = app_timer_create(&m_boot_timer, APP_TIMER_MODE_SINGLE_SHOT, boot_timeout_handler);
+  APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for reading the preferred connection parameters from the runtime parameters.
+ *
+ * @param[out] p_conn_params  The preferred connection parameters.
+ */
+static void conn_params_get(ble_gap_conn_params_t * p_conn_params)
+{
+  memset(p_conn_params, 0, sizeof(*p_conn_params));
+
+  p_conn_params->min_conn_interval = paramGet(PARAM_CONN_INTERVAL_MIN);
+  p_conn_params->max_conn_interval = paramGet(PARAM_CONN_INTERVAL_MAX);
+  p_conn_params->slave_latency     = paramGet(PARAM_SLAVE_LATENCY);
+  p_conn_params->conn_sup_timeout  = paramGet(PARAM_CONN_SUP_TIMEOUT);
 }
 
 
@@ -198,12 +358,7 @@ static void gap_params_init(void)
       strlen(DEVICE_NAME));
   APP_ERROR_CHECK(err_code);
 
-  memset(&gap_conn_params, 0, sizeof(gap_conn_params));
-
-  gap_conn_params.min_conn_interval = MIN_CONN_INTERVAL;
-  gap_conn_params.max_conn_interval = MAX_CONN_INTERVAL;
-  gap_conn_params.slave_latency     = SLAVE_LATENCY;
-  gap_conn_params.conn_sup_timeout  = CONN_SUP_TIMEOUT;
+  conn_params_get(&gap_conn_params);
 
   err_code = sd_ble_gap_ppcp_set(&gap_conn_params);
   APP_ERROR_CHECK(err_code);
@@ -239,51 +394,109 @@ static void gatt_init(void)
 }
 
 
-/**@brief Function for initializing the Advertising functionality.
+/**@brief Function for encoding the advertising data.
  *
- * @details Encodes the required advertising data and passes it to the stack.
- *          Also builds a structure to be passed to the stack when starting advertising.
+ * @details The advertising data carries the command status record as manufacturer specific
+ *          data, so a monitor can follow the device with a passive scan rather than connecting:
+ *
+ *          +-Company ID-+-Command-+-Errors-+-Changes-+
+ *          | 0xFFFF LE  | 1 B     | 1 B    | 1 B     |
+ *          +------------+---------+--------+---------+
+ *
+ *          Errors are COMMAND_ERROR_ flags; Changes counts changes to the other two.
+ *
+ * @param[out] p_adv_data  Advertising data, pointing at the buffers to encode into.
+ * @param[in]  p_record    Status record to advertise.
  */
-static void advertising_init(void)
+static void advertising_data_encode(ble_gap_adv_data_t * p_adv_data, command_status_record_t const * p_record)
 {
-  ret_code_t    err_code;
-  ble_advdata_t advdata;
-  ble_advdata_t srdata;
+  ret_code_t               err_code;
+  ble_advdata_t            advdata;
+  ble_advdata_t            srdata;
+  ble_advdata_manuf_data_t manuf_data;
+  uint8_t                  status[] = { p_record->command, p_record->errors, p_record->changes };
 
   //    ble_uuid_t adv_uuids[] = {{LBS_UUID_SERVICE, m_lbs.uuid_type}};
 
   // Build and set advertising data.
   memset(&advdata, 0, sizeof(advdata));
 
-  advdata.name_type          = BLE_ADVDATA_FULL_NAME;
-  advdata.include_appearance = true;
-  advdata.flags              = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+  manuf_data.company_identifier = STATUS_COMPANY_ID;
+  manuf_data.data.p_data        = status;
+  manuf_data.data.size          = sizeof(status);
+
+  advdata.name_type             = BLE_ADVDATA_FULL_NAME;
+  advdata.include_appearance    = true;
+  advdata.flags                 = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+  advdata.p_manuf_specific_data = &manuf_data;
 
 
   memset(&srdata, 0, sizeof(srdata));
   srdata.uuids_complete.uuid_cnt = sizeof(m_adv_uuids) / sizeof(m_adv_uuids[0]);
   srdata.uuids_complete.p_uuids  = m_adv_uuids;
 
-  err_code = ble_advdata_encode(&advdata, m_adv_data.adv_data.p_data, &m_adv_data.adv_data.len);
+  p_adv_data->adv_data.len      = BLE_GAP_ADV_SET_DATA_SIZE_MAX;
+  p_adv_data->scan_rsp_data.len = BLE_GAP_ADV_SET_DATA_SIZE_MAX;
+
+  err_code = ble_advdata_encode(&advdata, p_adv_data->adv_data.p_data, &p_adv_data->adv_data.len);
   APP_ERROR_CHECK(err_code);
 
-  err_code = ble_advdata_encode(&srdata, m_adv_data.scan_rsp_data.p_data, &m_adv_data.scan_rsp_data.len);
+  err_code = ble_advdata_encode(&srdata, p_adv_data->scan_rsp_data.p_data, &p_adv_data->scan_rsp_data.len);
   APP_ERROR_CHECK(err_code);
+}
 
-  ble_gap_adv_params_t adv_params;
 
-  // Set advertising parameters.
-  memset(&adv_params, 0, sizeof(adv_params));
+/**@brief Function for initializing the Advertising functionality.
+ *
+ * @details Encodes the required advertising data. The advertising parameters are set per phase
+ *          by advertising_start().
+ */
+static void advertising_init(void)
+{
+  command_status_record_t record = commandStatusRecord();
 
-  adv_params.primary_phy     = BLE_GAP_PHY_1MBPS;
-  adv_params.duration        = APP_ADV_DURATION;
-  adv_params.properties.type = BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED;
-  adv_params.p_peer_addr     = NULL;
-  adv_params.filter_policy   = BLE_GAP_ADV_FP_ANY;
-  adv_params.interval        = APP_ADV_INTERVAL;
+  advertising_data_encode(&m_adv_data, &record);
+  m_adv_status_changes = record.changes;
+}
+
+
+/**@brief Function for advertising the latest status record.
+ *
+ * @details Called from the main loop. When the record has changed, it is encoded into the
+ *          buffers the SoftDevice is not using, and the SoftDevice switches to them without
+ *          advertising stopping. While connected, or advertising directed, which carries no
+ *          data, the new data is kept for the next advertising phase.
+ */
+static void advertising_status_update(void)
+{
+  ret_code_t              err_code = NRF_SUCCESS;
+  command_status_record_t record   = commandStatusRecord();
+
+  if (record.changes == m_adv_status_changes)
+  {
+    return;
+  }
 
-  err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &m_adv_data, &adv_params);
+  uint8_t const      next     = (m_adv_data.adv_data.p_data == m_enc_advdata[0]) ? 1 : 0;
+  ble_gap_adv_data_t adv_data =
+  {
+      .adv_data      = { .p_data = m_enc_advdata[next] },
+      .scan_rsp_data = { .p_data = m_enc_scan_response_data[next] }
+  };
+
+  advertising_data_encode(&adv_data, &record);
+
+  // BLE events may change the advertising phase
+  CRITICAL_REGION_ENTER();
+  if (m_conn_handle == BLE_CONN_HANDLE_INVALID && m_adv_phase != ADV_PHASE_DIRECTED)
+  {
+    err_code = sd_ble_gap_adv_set_configure(&m_adv_handle, &adv_data, NULL);
+  }
+  m_adv_data = adv_data;
+  CRITICAL_REGION_EXIT();
   APP_ERROR_CHECK(err_code);
+
+  m_adv_status_changes = record.changes;
 }
 
 
@@ -299,10 +512,32 @@ static void nrf_qwr_error_handler(uint32_t nrf_error)
   APP_ERROR_HANDLER(nrf_error);
 }
 
+/**@brief Function for handling the urgent command tier interrupt.
+ *
+ * @details Runs the urgent commands the RX path queued, preempting whatever
+ *          thread tier command the main loop is running.
+ */
+void SWI3_EGU3_IRQHandler(void)
+{
+  commandUrgentRun();
+  leds_update();
+}
+
+
+/**@brief Function for pending the urgent command tier interrupt.
+ */
+static void command_urgent_pend(void)
+{
+  NVIC_SetPendingIRQ(SWI3_EGU3_IRQn);
+}
+
+
 /**@brief Function for handling the data from the Command Service.
  *
  * @details This function will process the data received from the Client and
- * send to the raw command processor. If the command is valid, execute it.
+ * send to the raw command processor. If the command is valid, hand it to its
+ * tier: urgent commands run from the SWI3 interrupt as soon as this returns,
+ * others from the main loop.
  *
  * @param[in] p_evt Service event.
  */
@@ -320,6 +555,19 @@ static void cmd_data_handler(ble_cmd_evt_t * p_evt)
     if (validCommandReceived())
       executeCommand();
   }
+  else if (p_evt->type == BLE_CMD_EVT_TX_RDY)
+  {
+    commandTxReady();
+  }
+  else if (p_evt->type == BLE_CMD_EVT_COMM_STARTED)
+  {
+    commandCommStarted();
+  }
+  else if (p_evt->type == BLE_CMD_EVT_COMM_STOPPED)
+  {
+    // Notifications off without disconnecting; the session waits for them
+    commandCommPaused();
+  }
 
 }
 
@@ -336,11 +584,191 @@ static void services_init(void)
   err_code = nrf_ble_qwr_init(&m_qwr, &qwr_init);
   APP_ERROR_CHECK(err_code);
 
+  commandInit(command_urgent_pend);
+
+  // app_timer owns SWI0, radio notifications SWI1 and the SoftDevice SWI2, SWI4 and SWI5;
+  // SWI_DISABLE3 keeps the SWI driver off SWI3
+  NVIC_ClearPendingIRQ(SWI3_EGU3_IRQn);
+  NVIC_SetPriority(SWI3_EGU3_IRQn, COMMAND_URGENT_IRQ_PRIORITY);
+  NVIC_EnableIRQ(SWI3_EGU3_IRQn);
+
   err_code = ble_cmd_init(cmd_data_handler, &m_conn_handle);
   APP_ERROR_CHECK(err_code);
 }
 
 
+#if PEER_MANAGER_ENABLED
+static uint32_t m_gatt_db_hash;                                                 // Hash of the local GATT database, as given to bonded centrals.
+
+/**@brief Function for computing a hash of the local GATT database.
+ *
+ * @details Walks the attribute table, so any change to the services the firmware adds, e.g. after
+ *          an update, gives a different hash. The hash is FNV-1a over each attribute's handle and
+ *          UUID.
+ */
+static uint32_t gatt_db_hash_compute(void)
+{
+  uint32_t            hash = 2166136261UL;
+  ble_uuid_t          uuid;
+  ble_gatts_attr_md_t md;
+
+  for (uint16_t handle = BLE_GATT_HANDLE_START;
+       sd_ble_gatts_attr_get(handle, &uuid, &md) == NRF_SUCCESS;
+       handle++)
+  {
+    uint8_t const bytes[] =
+    {
+      (uint8_t) handle, (uint8_t) (handle >> 8),
+      (uint8_t) uuid.uuid, (uint8_t) (uuid.uuid >> 8),
+      uuid.type
+    };
+
+    for (uint8_t i = 0; i < sizeof(bytes); i++)
+    {
+      hash ^= bytes[i];
+      hash *= 16777619UL;
+    }
+  }
+
+  return hash;
+}
+
+
+/**@brief Function for storing the GATT database hash with a bonded central.
+ */
+static void gatt_db_hash_store(pm_peer_id_t peer_id)
+{
+  ret_code_t err_code = pm_peer_data_app_data_store(peer_id,
+                                                    (uint8_t const *) &m_gatt_db_hash,
+                                                    sizeof(m_gatt_db_hash),
+                                                    NULL);
+  // Storage full is retried once pm_handler_flash_clean() has made room
+  if (err_code != NRF_ERROR_STORAGE_FULL)
+  {
+    APP_ERROR_CHECK(err_code);
+  }
+}
+
+
+/**@brief Function for checking a reconnecting central's cached GATT database.
+ *
+ * @details A bonded central keeps its CCCDs, restored by the Peer Manager, and the database it
+ *          discovered, so it can send commands without discovering services again. If the
+ *          database it was given no longer matches, Service Changed is indicated so it does.
+ */
+static void gatt_db_hash_check(pm_peer_id_t peer_id)
+{
+  uint32_t stored_hash = 0;
+  uint32_t length      = sizeof(stored_hash);
+
+  if (pm_peer_data_app_data_load(peer_id, (uint8_t *) &stored_hash, &length) == NRF_SUCCESS &&
+      length == sizeof(stored_hash) && stored_hash == m_gatt_db_hash)
+  {
+    return;
+  }
+
+  NRF_LOG_INFO("GATT database changed for peer %d", peer_id);
+  pm_local_database_has_changed();
+  gatt_db_hash_store(peer_id);
+}
+
+
+/**@brief Function for handling Peer Manager events.
+ *
+ * @param[in] p_evt  Peer Manager event.
+ */
+static void pm_evt_handler(pm_evt_t const * p_evt)
+{
+  pm_handler_on_pm_evt(p_evt);
+  pm_handler_flash_clean(p_evt);
+
+  switch (p_evt->evt_id)
+  {
+  case PM_EVT_BONDED_PEER_CONNECTED:
+    gatt_db_hash_check(p_evt->peer_id);
+    break;
+
+  case PM_EVT_CONN_SEC_SUCCEEDED:
+    if (p_evt->params.conn_sec_succeeded.procedure == PM_CONN_SEC_PROCEDURE_BONDING)
+    {
+      gatt_db_hash_store(p_evt->peer_id);
+    }
+    break;
+
+  case PM_EVT_CONN_SEC_CONFIG_REQ:
+  {
+    // A central that lost its keys may bond again
+    pm_conn_sec_config_t const config = { .allow_repairing = true };
+    pm_conn_sec_config_reply(p_evt->conn_handle, &config);
+  } break;
+
+  default:
+    break;
+  }
+}
+#endif
+
+
+/**@brief Function for initializing the Peer Manager.
+ *
+ * @details With PEER_MANAGER_ENABLED, centrals may bond (Just Works). The Peer Manager stores
+ *          each bonded central's system attributes, i.e. its CCCDs, and restores them when it
+ *          reconnects, and answers the security requests the application used to refuse.
+ *          Must be called once the services have been added.
+ */
+static void peer_manager_init(void)
+{
+#if PEER_MANAGER_ENABLED
+  ble_gap_sec_params_t sec_param;
+  ret_code_t           err_code;
+
+  err_code = pm_init();
+  APP_ERROR_CHECK(err_code);
+
+  memset(&sec_param, 0, sizeof(ble_gap_sec_params_t));
+
+  // Security parameters to be used for all security procedures.
+  sec_param.bond           = SEC_PARAM_BOND;
+  sec_param.mitm           = SEC_PARAM_MITM;
+  sec_param.lesc           = SEC_PARAM_LESC;
+  sec_param.keypress       = SEC_PARAM_KEYPRESS;
+  sec_param.io_caps        = SEC_PARAM_IO_CAPABILITIES;
+  sec_param.oob            = SEC_PARAM_OOB;
+  sec_param.min_key_size   = SEC_PARAM_MIN_KEY_SIZE;
+  sec_param.max_key_size   = SEC_PARAM_MAX_KEY_SIZE;
+  sec_param.kdist_own.enc  = 1;
+  sec_param.kdist_own.id   = 1;
+  sec_param.kdist_peer.enc = 1;
+  sec_param.kdist_peer.id  = 1;
+
+  err_code = pm_sec_params_set(&sec_param);
+  APP_ERROR_CHECK(err_code);
+
+  err_code = pm_register(pm_evt_handler);
+  APP_ERROR_CHECK(err_code);
+
+  m_gatt_db_hash = gatt_db_hash_compute();
+#endif
+}
+
+
+/**@brief Function for initializing radio notifications.
+ *
+ * @details With COMMAND_RADIO_ALIGN_ENABLED the command engine is told before
+ *          and after each connection event, so it can fit its work around
+ *          them. Must be called once the SoftDevice is enabled.
+ */
+static void radio_notification_init(void)
+{
+#if COMMAND_RADIO_ALIGN_ENABLED
+  ret_code_t err_code = ble_radio_notification_init(APP_IRQ_PRIORITY_LOW,
+                                                    COMMAND_RADIO_ALIGN_DISTANCE,
+                                                    commandRadioNotification);
+  APP_ERROR_CHECK(err_code);
+#endif
+}
+
+
 /**@brief Function for handling the Connection Parameters Module.
  *
  * @details This function will be called for all events in the Connection Parameters Module that
@@ -397,15 +825,100 @@ static void conn_params_init(void)
 }
 
 
-/**@brief Function for starting advertising.
+/**@brief Function for applying a runtime parameter set with the PARAMETERS command.
+ *
+ * @details Connection parameters are preferred at once and, while connected, requested of the
+ *          central; the Connection Parameters module takes them up for later connections once
+ *          disconnected. Advertising parameters apply from the next advertising phase, and the
+ *          coalescing delay the next time coalescing is turned on.
+ *
+ * @param[in] id     The parameter set.
+ * @param[in] value  Its new value.
  */
-static void advertising_start(void)
+static void param_changed(param_id_t id, uint32_t value)
+{
+  ret_code_t            err_code;
+  ble_gap_conn_params_t gap_conn_params;
+
+  switch (id)
+  {
+  case PARAM_CONN_INTERVAL_MIN:
+  case PARAM_CONN_INTERVAL_MAX:
+  case PARAM_SLAVE_LATENCY:
+  case PARAM_CONN_SUP_TIMEOUT:
+    conn_params_get(&gap_conn_params);
+    err_code = sd_ble_gap_ppcp_set(&gap_conn_params);
+    APP_ERROR_CHECK(err_code);
+
+    if (m_conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+      conn_params_init();
+      break;
+    }
+    m_conn_params_stale = true;
+    // Busy if an update is under way; the new parameters then apply from the next connection
+    err_code = ble_conn_params_change_conn_params(m_conn_handle, &gap_conn_params);
+    if (err_code != NRF_SUCCESS)
+    {
+      NRF_LOG_INFO("Connection parameter update not requested, error 0x%X", err_code);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+
+/**@brief Function for starting an advertising phase.
+ *
+ * @details Fast advertising connects a central quickly right after boot or a disconnect, slow
+ *          advertising saves power when nobody is around, and high duty directed advertising
+ *          gets a central that lost the link back within a few milliseconds. Each phase has a
+ *          duration; when it times out, BLE_GAP_EVT_ADV_SET_TERMINATED starts the next.
+ *
+ * @param[in] phase  Advertising phase to start.
+ */
+static void advertising_start(adv_phase_t phase)
 {
   ret_code_t           err_code;
+  ble_gap_adv_params_t adv_params;
+
+  memset(&adv_params, 0, sizeof(adv_params));
+
+  adv_params.primary_phy     = BLE_GAP_PHY_1MBPS;
+  adv_params.filter_policy   = BLE_GAP_ADV_FP_ANY;
+  adv_params.properties.type = BLE_GAP_ADV_TYPE_CONNECTABLE_SCANNABLE_UNDIRECTED;
+
+  switch (phase)
+  {
+  case ADV_PHASE_DIRECTED:
+    // The interval is set by the SoftDevice, at most 3.75 ms; no advertising data is sent
+    adv_params.properties.type = BLE_GAP_ADV_TYPE_CONNECTABLE_NONSCANNABLE_DIRECTED_HIGH_DUTY_CYCLE;
+    adv_params.p_peer_addr     = &m_peer_addr;
+    adv_params.duration        = APP_ADV_DIRECTED_DURATION;
+    break;
+
+  case ADV_PHASE_FAST:
+    adv_params.interval        = paramGet(PARAM_ADV_FAST_INTERVAL);
+    adv_params.duration        = paramGet(PARAM_ADV_FAST_DURATION);
+    break;
+
+  case ADV_PHASE_SLOW:
+    adv_params.interval        = paramGet(PARAM_ADV_SLOW_INTERVAL);
+    adv_params.duration        = APP_ADV_SLOW_DURATION;
+    break;
+  }
+
+  err_code = sd_ble_gap_adv_set_configure(&m_adv_handle,
+                                          (phase == ADV_PHASE_DIRECTED) ? NULL : &m_adv_data,
+                                          &adv_params);
+  APP_ERROR_CHECK(err_code);
 
   err_code = sd_ble_gap_adv_start(m_adv_handle, APP_BLE_CONN_CFG_TAG);
   APP_ERROR_CHECK(err_code);
 
+  m_adv_phase = phase;
   bsp_board_led_on(ADVERTISING_LED);
 }
 
@@ -426,23 +939,61 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
     bsp_board_led_on(CONNECTED_LED);
     bsp_board_led_off(ADVERTISING_LED);
     m_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+    // As the central used it; a resolvable address is good for some minutes yet
+    m_peer_addr = p_ble_evt->evt.gap_evt.params.connected.peer_addr;
+#if COMMAND_RETAIN_ENABLED
+    retainLink(true, &m_peer_addr);
+#endif
     err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
     APP_ERROR_CHECK(err_code);
     APP_ERROR_CHECK(err_code);
     m_connected = true;
+    m_resuming = false;
     break;
 
   case BLE_GAP_EVT_DISCONNECTED:
-    NRF_LOG_INFO("Disconnected");
+  {
+    uint8_t const reason = p_ble_evt->evt.gap_evt.params.disconnected.reason;
+
+    NRF_LOG_INFO("Disconnected, reason 0x%02X", reason);
     bsp_board_led_off(CONNECTED_LED);
     m_conn_handle = BLE_CONN_HANDLE_INVALID;
-    advertising_start();
+    // A central that lost the link, rather than hanging up, is likely still looking for us
+    if (reason == BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION ||
+        reason == BLE_HCI_REMOTE_DEV_TERMINATION_DUE_TO_POWER_OFF ||
+        reason == BLE_HCI_LOCAL_HOST_TERMINATED_CONNECTION)
+    {
+      advertising_start(ADV_PHASE_FAST);
+    }
+    else
+    {
+      advertising_start(ADV_PHASE_DIRECTED);
+    }
     m_connected = false;
+    if (m_conn_params_stale)
+    {
+      m_conn_params_stale = false;
+      conn_params_init();
+    }
+    // Keep what the central has not yet heard back about, in case it resumes
+    commandCommStopped();
     setCurrentCommand(NO_COMMAND);
-    bsp_board_led_off(BLINK_LED_1);
-    bsp_board_led_off(BLINK_LED_2);
+#if COMMAND_RETAIN_ENABLED
+    retainLink(false, &m_peer_addr);
+#endif
+    leds_update();
+  } break;
+
+  case BLE_GAP_EVT_ADV_SET_TERMINATED:
+    if (p_ble_evt->evt.gap_evt.params.adv_set_terminated.reason ==
+        BLE_GAP_EVT_ADV_SET_TERMINATED_REASON_TIMEOUT)
+    {
+      NRF_LOG_INFO("Advertising phase %d timed out", m_adv_phase);
+      advertising_start((m_adv_phase == ADV_PHASE_DIRECTED) ? ADV_PHASE_FAST : ADV_PHASE_SLOW);
+    }
     break;
 
+#if !PEER_MANAGER_ENABLED
   case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
     // Pairing not supported
     err_code = sd_ble_gap_sec_params_reply(m_conn_handle,
@@ -451,6 +1002,7 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
         NULL);
     APP_ERROR_CHECK(err_code);
     break;
+#endif
 
   case BLE_GAP_EVT_PHY_UPDATE_REQUEST:
   {
@@ -464,11 +1016,13 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
     APP_ERROR_CHECK(err_code);
   } break;
 
+#if !PEER_MANAGER_ENABLED
   case BLE_GATTS_EVT_SYS_ATTR_MISSING:
     // No system attributes have been stored.
     err_code = sd_ble_gatts_sys_attr_set(m_conn_handle, NULL, 0, 0);
     APP_ERROR_CHECK(err_code);
     break;
+#endif
 
   case BLE_GATTC_EVT_TIMEOUT:
     // Disconnect on GATT Client timeout event.
@@ -523,7 +1077,16 @@ static void log_init(void)
 {
   ret_code_t err_code = NRF_LOG_INIT(NULL);
   APP_ERROR_CHECK(err_code);
+}
 
+
+/**@brief Function for initializing the log backends.
+ *
+ * @details Deferred until advertising has started. Logging is in place, so anything logged before
+ *          is dropped.
+ */
+static void log_backends_init(void)
+{
   NRF_LOG_DEFAULT_BACKENDS_INIT();
 }
 
@@ -544,80 +1107,208 @@ static void power_management_init(void)
  */
 static void idle_state_handle(void)
 {
-  //  if (NRF_LOG_PROCESS() == false)
-  //  {
-  //    nrf_pwr_mgmt_run();
-  //  }
+  if (NRF_LOG_PROCESS() == false)
+  {
+    nrf_pwr_mgmt_run();
+  }
+}
+
+
+/**@brief Function for loading the runtime parameters.
+ *
+ * @details Waits for them to load from flash, since the GAP, advertising and connection parameters
+ *          set up next are taken from them.
+ */
+static void params_init(void)
+{
+  paramInit(param_changed);
+
+  while (!paramLoaded())
+  {
+    idle_state_handle();
+  }
+}
+
+
+/**@brief Function for initializing the command journal.
+ *
+ * @details The journal takes the flash pages reserved for it in the linker script, below those
+ *          FDS uses at the end of the application area. Must be called once the SoftDevice is
+ *          enabled.
+ */
+static void journal_init(void)
+{
+#if COMMAND_JOURNAL_ENABLED
+  extern uint32_t __start_journal;
+  extern uint32_t __stop_journal;
+
+  journalInit((uint32_t) &__start_journal, (uint32_t) &__stop_journal, m_resumed,
+              m_resumed ? m_boot_us[BOOT_STAGE_RESUME] : 0);
+#endif
+}
+
+
+/**@brief Function for initializing uploads.
+ *
+ * @details Uploads go to the flash pages reserved for them in the linker script, below the
+ *          journal. Must be called once the SoftDevice is enabled.
+ */
+static void upload_init(void)
+{
+#if COMMAND_UPLOAD_ENABLED
+  extern uint32_t __start_upload;
+  extern uint32_t __stop_upload;
+
+  uploadInit((uint32_t) &__start_upload, (uint32_t) &__stop_upload);
+#endif
+}
+
+
+/**@brief Function for resuming the state from before a warm reset.
+ *
+ * @details The LED pattern of the command last run shows again at once, before the SoftDevice
+ *          is enabled; it steps once the low frequency clock runs. Must be called before the
+ *          SoftDevice is enabled, which takes over the reset reason.
+ */
+static void state_resume(void)
+{
+#if COMMAND_RETAIN_ENABLED
+  uint32_t reason = NRF_POWER->RESETREAS;
+
+  NRF_POWER->RESETREAS = reason;
+  m_resumed = retainInit((reason & RESET_WARM_MASK) != 0);
+  if (m_resumed)
+  {
+    retain_state_t state = retainState();
+
+    m_resuming = true;
+    setCurrentCommand((command_id_t) state.command);
+    leds_update();
+    m_resume_link = state.connected;
+    m_peer_addr = state.peer;
+  }
+#endif
+}
+
+
+/**@brief Function for starting to advertise once start up is far enough along.
+ */
+static void advertising_begin(void)
+{
+  // Look first for a central that had a link up when the reset came
+  advertising_start(m_resume_link ? ADV_PHASE_DIRECTED : ADV_PHASE_FAST);
+}
+
+
+/**@brief Function for starting to time the later start up stages on the RTC.
+ *
+ * @details Call once the SoftDevice has started the LF clock. app_timer stops the RTC while no
+ *          timer runs, so the boot timer runs until start up is done.
+ *
+ * @return The RTC counter to time the later stages from.
+ */
+static uint32_t boot_rtc_start(void)
+{
+  ret_code_t err_code = app_timer_start(m_boot_timer, BOOT_TIMER_TIMEOUT, NULL);
+  APP_ERROR_CHECK(err_code);
+
+  return app_timer_cnt_get();
+}
+
+
+/**@brief Function for reading the time since boot_rtc_start().
+ *
+ * @param[in] from_ticks  The RTC counter boot_rtc_start() returned.
+ *
+ * @return The time since, in us.
+ */
+static uint32_t boot_rtc_us(uint32_t from_ticks)
+{
+  uint32_t ticks = app_timer_cnt_diff_compute(app_timer_cnt_get(), from_ticks);
+
+  return (uint32_t) (((uint64_t) ticks * 1000000) / BOOT_RTC_FREQUENCY);
 }
 
 
+/**@brief The start up stages, in the order they run.
+ *
+ * @details Whatever is not needed to resume or to take a connection comes after advertising has
+ *          started; a central can't use any of it until it has connected and found the service.
+ *          Power management is set up before the parameters load, as that waits in
+ *          idle_state_handle().
+ */
+static void (* const m_boot_stages[BOOT_STAGES])(void) =
+{
+  [BOOT_STAGE_LOG]                = log_init,
+  [BOOT_STAGE_LEDS]               = leds_init,
+  [BOOT_STAGE_TIMERS]             = timers_init,
+  [BOOT_STAGE_RESUME]             = state_resume,
+  [BOOT_STAGE_BLE_STACK]          = ble_stack_init,
+  [BOOT_STAGE_POWER]              = power_management_init,
+  [BOOT_STAGE_PARAMS]             = params_init,
+  [BOOT_STAGE_GAP]                = gap_params_init,
+  [BOOT_STAGE_GATT]               = gatt_init,
+  [BOOT_STAGE_SERVICES]           = services_init,
+  [BOOT_STAGE_ADVERTISING_DATA]   = advertising_init,
+  [BOOT_STAGE_CONN_PARAMS]        = conn_params_init,
+  [BOOT_STAGE_PEER_MANAGER]       = peer_manager_init,
+  [BOOT_STAGE_ADVERTISING]        = advertising_begin,
+  [BOOT_STAGE_LOG_BACKENDS]       = log_backends_init,
+  [BOOT_STAGE_RADIO_NOTIFICATION] = radio_notification_init,
+  [BOOT_STAGE_JOURNAL]            = journal_init,
+  [BOOT_STAGE_UPLOAD]             = upload_init
+};
+
+
 /**@brief Function for application main entry.
  */
 int main(void)
 {
   m_connected = false;
 
+  // Time start up on the cycle counter until the SoftDevice has started the LF clock, and on the
+  // RTC from there; the cycle counter stops while the CPU sleeps, as it does loading the parameters
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  uint32_t lf_ticks = 0;
+
   // Initialize.
-  log_init();
-  leds_init();
-  timers_init();
   //    buttons_init();
-  power_management_init();
-  ble_stack_init();
-  gap_params_init();
-  gatt_init();
-  services_init();
-  advertising_init();
-  conn_params_init();
+  for (uint8_t stage = 0; stage < BOOT_STAGES; stage++)
+  {
+    m_boot_stages[stage]();
+    if (stage <= BOOT_STAGE_BLE_STACK)
+    {
+      m_boot_us[stage] = DWT->CYCCNT / (SystemCoreClock / 1000000);
+    }
+    else
+    {
+      m_boot_us[stage] = m_boot_us[BOOT_STAGE_BLE_STACK] + boot_rtc_us(lf_ticks);
+    }
+    if (stage == BOOT_STAGE_BLE_STACK)
+    {
+      lf_ticks = boot_rtc_start();
+    }
+  }
+  (void) app_timer_stop(m_boot_timer);
+  commandBootProfile(m_boot_us);
 
   // Start execution.
-  NRF_LOG_INFO("Simple Command started.");
-  advertising_start();
+  NRF_LOG_INFO("Simple Command started, advertising after %u us.", m_boot_us[BOOT_STAGE_ADVERTISING]);
+  if (m_resumed)
+  {
+    NRF_LOG_INFO("Resumed command 0x%02X in %u us", currentCommand(), m_boot_us[BOOT_STAGE_RESUME]);
+  }
 
-  // Enter main loop.
+  // Enter main loop. Thread tier commands run here, preempted by the urgent
+  // tier and BLE events; the LEDs are driven from the blink timer.
   for (;;)
   {
+    commandThreadRun();
+    leds_update();
+    advertising_status_update();
     idle_state_handle();
-    if (m_connected) // TODO move into idle_state_handle
-    {
-      command_id_t cc = currentCommand();
-      switch(cc)
-      {
-      case NO_COMMAND:
-      case OFF:
-      case ABORT:
-        bsp_board_led_off(BLINK_LED_1);
-        bsp_board_led_off(BLINK_LED_2);
-        nrf_delay_ms(100);
-        break;
-      case FAST_BLINK:
-        bsp_board_led_invert(BLINK_LED_1);
-        bsp_board_led_off(BLINK_LED_2);
-        nrf_delay_ms(50);
-        break;
-      case SLOW_BLINK:
-        bsp_board_led_invert(BLINK_LED_2);
-        bsp_board_led_off(BLINK_LED_1);
-        nrf_delay_ms(250);
-        break;
-      case ALT_BLINK:
-        bsp_board_led_on(BLINK_LED_1);
-        bsp_board_led_off(BLINK_LED_2);
-        nrf_delay_ms(250);
-        bsp_board_led_off(BLINK_LED_1);
-        bsp_board_led_on(BLINK_LED_2);
-        nrf_delay_ms(250);
-        break;
-      default:
-        bsp_board_led_off(BLINK_LED_1);
-        bsp_board_led_off(BLINK_LED_2);
-        nrf_delay_ms(100);
-        break;
-      }
-    } else
-    {
-      nrf_delay_ms(100);
-    }
   }
 }
 
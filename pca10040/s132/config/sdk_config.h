@@ -56,6 +56,171 @@
 #define BSP_BTN_BLE_ENABLED 1
 #endif
 
+// <h> Simple Command
+
+//==========================================================
+// <o> COMMAND_ARG_POOL_SMALL_SIZE - Bytes in each small argument block  <4-4095> 
+// <i> Most commands have short or no arguments; these fit a small block.
+
+#ifndef COMMAND_ARG_POOL_SMALL_SIZE
+#define COMMAND_ARG_POOL_SMALL_SIZE 32
+#endif
+
+// <o> COMMAND_ARG_POOL_SMALL_COUNT - Number of small argument blocks  <1-255> 
+
+
+#ifndef COMMAND_ARG_POOL_SMALL_COUNT
+#define COMMAND_ARG_POOL_SMALL_COUNT 4
+#endif
+
+// <o> COMMAND_ARG_POOL_MEDIUM_SIZE - Bytes in each medium argument block  <4-4095> 
+
+
+#ifndef COMMAND_ARG_POOL_MEDIUM_SIZE
+#define COMMAND_ARG_POOL_MEDIUM_SIZE 256
+#endif
+
+// <o> COMMAND_ARG_POOL_MEDIUM_COUNT - Number of medium argument blocks  <1-255> 
+
+
+#ifndef COMMAND_ARG_POOL_MEDIUM_COUNT
+#define COMMAND_ARG_POOL_MEDIUM_COUNT 2
+#endif
+
+// <o> COMMAND_ARG_POOL_LARGE_SIZE - Bytes in each large argument block  <4-4095> 
+// <i> The longest argument the board accepts.
+
+#ifndef COMMAND_ARG_POOL_LARGE_SIZE
+#define COMMAND_ARG_POOL_LARGE_SIZE 1024
+#endif
+
+// <o> COMMAND_ARG_POOL_LARGE_COUNT - Number of large argument blocks  <1-255> 
+
+
+#ifndef COMMAND_ARG_POOL_LARGE_COUNT
+#define COMMAND_ARG_POOL_LARGE_COUNT 1
+#endif
+
+// <o> COMMAND_RX_QUEUE_SIZE - Number of received commands queued  <1-255> 
+// <i> Commands wait here until a response buffer frees up to run them. The
+// <i> central is granted credits for the entries free.
+
+#ifndef COMMAND_RX_QUEUE_SIZE
+#define COMMAND_RX_QUEUE_SIZE 4
+#endif
+
+// <o> COMMAND_RESPONSE_BUFFER_COUNT - Number of response buffers  <1-255> 
+// <i> Responses queue here while earlier ones are sent, so the next command
+// <i> can run before the previous response has gone out.
+
+#ifndef COMMAND_RESPONSE_BUFFER_COUNT
+#define COMMAND_RESPONSE_BUFFER_COUNT 2
+#endif
+
+// <o> COMMAND_RESPONSE_BUFFER_SIZE - Bytes in each response buffer  <20-9999> 
+// <i> The longest formatted response. Constant, echoed and generated
+// <i> responses are not copied and are not limited by this.
+
+#ifndef COMMAND_RESPONSE_BUFFER_SIZE
+#define COMMAND_RESPONSE_BUFFER_SIZE 128
+#endif
+
+// <o> COMMAND_RESPONSE_COALESCE_DELAY_MS - Default response coalescing delay  <0-255> 
+// <i> While the COALESCE_RESPONSES command has turned coalescing on, a short
+// <i> response waits up to this long for others to share its notification.
+
+#ifndef COMMAND_RESPONSE_COALESCE_DELAY_MS
+#define COMMAND_RESPONSE_COALESCE_DELAY_MS 5
+#endif
+
+// <o> COMMAND_URGENT_IRQ_PRIORITY  - Urgent command tier interrupt priority
+// <i> Urgent commands (LED changes, ABORT, time sync) run from the SWI3
+// <i> interrupt at this priority, preempting the long commands run from the
+// <i> main loop. Priorities 0,1,4,5 (nRF52) are reserved for SoftDevice.
+// <2=> 2 
+// <3=> 3 
+// <6=> 6 
+// <7=> 7 
+
+#ifndef COMMAND_URGENT_IRQ_PRIORITY
+#define COMMAND_URGENT_IRQ_PRIORITY 6
+#endif
+
+// <q> COMMAND_RADIO_ALIGN_ENABLED  - Align command work with connection events
+// <i> Subscribe to SoftDevice radio notifications so that responses held
+// <i> back for coalescing are queued before each connection event, and
+// <i> thread tier commands start after it.
+
+#ifndef COMMAND_RADIO_ALIGN_ENABLED
+#define COMMAND_RADIO_ALIGN_ENABLED 0
+#endif
+
+// <o> COMMAND_RADIO_ALIGN_DISTANCE  - Radio notification distance
+// <i> How long before a connection event the notification comes; long
+// <i> enough to queue the responses held back.
+// <1=> 800 us 
+// <2=> 1740 us 
+// <3=> 2680 us 
+// <4=> 3620 us 
+// <5=> 4560 us 
+// <6=> 5500 us 
+
+#ifndef COMMAND_RADIO_ALIGN_DISTANCE
+#define COMMAND_RADIO_ALIGN_DISTANCE 2
+#endif
+
+// <e> COMMAND_JOURNAL_ENABLED - Journal the commands run in flash
+// <i> Each command run is recorded in flash pages reserved in the linker
+// <i> script, for reading back with the JOURNAL_READ command.
+//==========================================================
+#ifndef COMMAND_JOURNAL_ENABLED
+#define COMMAND_JOURNAL_ENABLED 1
+#endif
+// <o> COMMAND_JOURNAL_BUFFER_ENTRIES - Journal entries buffered in RAM  <1-255> 
+// <i> Entries wait here for flash; while it is full, new ones are dropped.
+
+#ifndef COMMAND_JOURNAL_BUFFER_ENTRIES
+#define COMMAND_JOURNAL_BUFFER_ENTRIES 16
+#endif
+
+// <o> COMMAND_JOURNAL_FLUSH_ENTRIES - Journal entries written together  <1-255> 
+// <i> Entries are written once this many are buffered, or when the link
+// <i> drops. Fewer, longer writes take less of the SoftDevice's time.
+
+#ifndef COMMAND_JOURNAL_FLUSH_ENTRIES
+#define COMMAND_JOURNAL_FLUSH_ENTRIES 8
+#endif
+
+// </e>
+
+// <e> COMMAND_UPLOAD_ENABLED - Stream uploads into flash
+// <i> The UPLOAD command writes uploads too large for one command to a
+// <i> flash region reserved in the linker script.
+//==========================================================
+#ifndef COMMAND_UPLOAD_ENABLED
+#define COMMAND_UPLOAD_ENABLED 1
+#endif
+// <o> COMMAND_UPLOAD_BLOCK_SIZE - Largest upload block, in bytes  <4-4076> 
+// <i> A multiple of 4. Two blocks are buffered in RAM, one arriving while
+// <i> the other is written.
+
+#ifndef COMMAND_UPLOAD_BLOCK_SIZE
+#define COMMAND_UPLOAD_BLOCK_SIZE 1024
+#endif
+
+// </e>
+
+// <q> COMMAND_RETAIN_ENABLED  - Resume the command state after a warm reset
+// <i> The command last run, response options and the last central are
+// <i> kept in a RAM section the startup code leaves alone, with a CRC-32.
+
+#ifndef COMMAND_RETAIN_ENABLED
+#define COMMAND_RETAIN_ENABLED 1
+#endif
+
+// </h> 
+//==========================================================
+
 // <h> nRF_BLE 
 
 //==========================================================
@@ -123,7 +288,7 @@
 // <e> PEER_MANAGER_ENABLED - peer_manager - Peer Manager
 //==========================================================
 #ifndef PEER_MANAGER_ENABLED
-#define PEER_MANAGER_ENABLED 0
+#define PEER_MANAGER_ENABLED 1
 #endif
 // <o> PM_MAX_REGISTRANTS - Number of event handlers that can be registered. 
 #ifndef PM_MAX_REGISTRANTS
@@ -6390,7 +6555,7 @@
 // <e> FDS_ENABLED - fds - Flash data storage module
 //==========================================================
 #ifndef FDS_ENABLED
-#define FDS_ENABLED 0
+#define FDS_ENABLED 1
 #endif
 // <h> Pages - Virtual page settings
 
@@ -6912,7 +7077,7 @@
 // <e> NRF_FSTORAGE_ENABLED - nrf_fstorage - Flash abstraction library
 //==========================================================
 #ifndef NRF_FSTORAGE_ENABLED
-#define NRF_FSTORAGE_ENABLED 0
+#define NRF_FSTORAGE_ENABLED 1
 #endif
 // <h> nrf_fstorage - Common settings
 
@@ -12015,7 +12180,7 @@
  
 
 #ifndef NRF_SDH_BLE_SERVICE_CHANGED
-#define NRF_SDH_BLE_SERVICE_CHANGED 0
+#define NRF_SDH_BLE_SERVICE_CHANGED 1
 #endif
 
 // </h> 
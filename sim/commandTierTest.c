@@ -0,0 +1,462 @@
+/*!
+ * @file commandTierTest.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Host test of how commands are classed, queued and given a tier
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * The scheduling functions are static, so the test includes command.c and
+ * checks them directly. The response, arg pool and other command modules
+ * are linked as they are; the SoftDevice, flash and timers are stand-ins
+ * that do nothing, and the journal stand-in records the order commands ran
+ * in.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../command/command.c"
+
+/*!
+ * @brief The class and tier each command ID is expected in, with a short arg.
+ */
+static struct
+{
+  command_id_t commandID;
+  command_class_t commandClass;
+  command_tier_t tier;
+} const m_expected[] =
+{
+  { FAST_BLINK,         COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_URGENT },
+  { SLOW_BLINK,         COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_URGENT },
+  { ALT_BLINK,          COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_URGENT },
+  { OFF,                COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_URGENT },
+  { THROUGHPUT_TEST,    COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { ECHO,               COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_THREAD },
+  { TIME_SYNC,          COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { TIME_STAMPING,      COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { RX_CAPTURE,         COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { ARG_POOL_STATUS,    COMMAND_CLASS_INTERACTIVE, COMMAND_TIER_THREAD },
+  { ARG_CHECKSUM,       COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { STREAM_TEST,        COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { COALESCE_RESPONSES, COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { SUBSCRIBE,          COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { RESUME,             COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { PARAMETERS,         COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+  { JOURNAL_READ,       COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { UPLOAD,             COMMAND_CLASS_BULK,        COMMAND_TIER_THREAD },
+  { ABORT,              COMMAND_CLASS_CONTROL,     COMMAND_TIER_URGENT },
+};
+
+#define RUN_LOG_SIZE 32
+
+// The commands run, in order, as the journal saw them
+static uint8_t m_ran[RUN_LOG_SIZE];
+static uint8_t m_ranCount;
+
+static unsigned m_pends;
+static unsigned m_failed;
+
+static void
+check(bool passed, char const *what)
+{
+  if (!passed)
+  {
+    printf("FAIL %s\n", what);
+    m_failed++;
+  }
+}
+
+static void
+urgentPend(void)
+{
+  m_pends++;
+}
+
+/*!
+ * @brief Start over as if from reset, with a central listening.
+ */
+static void
+reset(command_pend_t pend)
+{
+  m_ranCount = 0;
+  m_pends = 0;
+  commandInit(pend);
+  commandCommStarted();
+}
+
+/*!
+ * @brief Receive a command whose arg is all in one write.
+ */
+static void
+receive(command_id_t commandID, uint16_t argLength)
+{
+  uint8_t raw[COMMAND_ID_FIELD_LENGTH + COMMAND_ARG_LENGTH_FIELD_LENGTH + COMMAND_ARG_DATA_FIELD_MAX_LENGTH];
+  char digits[8];
+
+  raw[0] = commandID;
+  snprintf(digits, sizeof(digits), "%03X", argLength);
+  memcpy(raw + COMMAND_ID_FIELD_LENGTH, digits, COMMAND_ARG_LENGTH_FIELD_LENGTH);
+  memset(raw + COMMAND_ID_FIELD_LENGTH + COMMAND_ARG_LENGTH_FIELD_LENGTH, '0', argLength);
+  receiveRawCommand(raw, COMMAND_ID_FIELD_LENGTH + COMMAND_ARG_LENGTH_FIELD_LENGTH + argLength);
+}
+
+/*!
+ * @brief Take the next command for a tier without running it.
+ *
+ * @return its ID, or NO_COMMAND if none was taken
+ */
+static command_id_t
+take(command_tier_t tier)
+{
+  command_rx_t rx;
+
+  if (!commandTake(tier, &rx))
+    return NO_COMMAND;
+  releaseArgData(&rx.command);
+  m_responsesReserved -= responsesNeeded(rx.command.commandID);
+  return rx.command.commandID;
+}
+
+/*!
+ * @brief Each command ID is classed and tiered as expected, and any with
+ * a long arg is bulk in the thread tier.
+ */
+static void
+testClasses(void)
+{
+  for (size_t i = 0; i < sizeof(m_expected) / sizeof(m_expected[0]); i++)
+  {
+    char what[64];
+    command_tier_t tier;
+
+    command_class_t commandClass = commandClassFor(m_expected[i].commandID, 0, &tier);
+    snprintf(what, sizeof(what), "class of 0x%02X", m_expected[i].commandID);
+    check(commandClass == m_expected[i].commandClass, what);
+    snprintf(what, sizeof(what), "tier of 0x%02X", m_expected[i].commandID);
+    check(tier == m_expected[i].tier, what);
+
+    commandClass = commandClassFor(m_expected[i].commandID, COMMAND_ARG_POOL_SMALL_SIZE + 1, &tier);
+    snprintf(what, sizeof(what), "class of 0x%02X with a long arg", m_expected[i].commandID);
+    check(commandClass == COMMAND_CLASS_BULK && tier == COMMAND_TIER_THREAD, what);
+  }
+}
+
+/*!
+ * @brief The thread tier takes interactive commands ahead of bulk ones, in
+ * the order each class received them.
+ */
+static void
+testClassOrder(void)
+{
+  reset(urgentPend);
+  receive(STREAM_TEST, 8);
+  receive(ECHO, 4);
+  receive(JOURNAL_READ, 0);
+  receive(ARG_POOL_STATUS, 0);
+
+  check(take(COMMAND_TIER_THREAD) == ECHO, "first interactive taken first");
+  check(take(COMMAND_TIER_THREAD) == ARG_POOL_STATUS, "second interactive taken next");
+  check(take(COMMAND_TIER_THREAD) == STREAM_TEST, "first bulk taken after the interactive ones");
+  check(take(COMMAND_TIER_THREAD) == JOURNAL_READ, "second bulk taken last");
+  check(take(COMMAND_TIER_THREAD) == NO_COMMAND, "nothing left");
+  check(m_rxQueueCount == 0, "queue count back to 0");
+}
+
+/*!
+ * @brief A bulk command passed over COMMAND_CLASS_PASS_LIMIT times is taken
+ * ahead of the interactive commands still waiting.
+ */
+static void
+testPassLimit(void)
+{
+  reset(urgentPend);
+  receive(STREAM_TEST, 8);
+
+  unsigned interactive = 0;
+  command_id_t taken;
+  do
+  {
+    // Keep an interactive command waiting
+    if (m_classQueues[COMMAND_CLASS_INTERACTIVE].count == 0)
+      receive(ARG_POOL_STATUS, 0);
+    taken = take(COMMAND_TIER_THREAD);
+    if (taken == ARG_POOL_STATUS)
+      interactive++;
+  } while (taken == ARG_POOL_STATUS && interactive <= COMMAND_CLASS_PASS_LIMIT);
+
+  check(taken == STREAM_TEST, "bulk taken once passed over");
+  check(interactive == COMMAND_CLASS_PASS_LIMIT, "bulk passed over COMMAND_CLASS_PASS_LIMIT times");
+  check(take(COMMAND_TIER_THREAD) == ARG_POOL_STATUS, "interactive taken again after");
+}
+
+/*!
+ * @brief Urgent commands are queued apart from thread work, pend the
+ * software interrupt, and run before the thread work queued ahead of them.
+ */
+static void
+testUrgentFirst(void)
+{
+  reset(urgentPend);
+  receive(ECHO, 4);
+  receive(STREAM_TEST, 8);
+  receive(OFF, 0);
+  receive(TIME_STAMPING, 1);
+
+  check(m_urgentQueue.count == 2, "urgent commands on the urgent queue");
+  check(m_classQueues[COMMAND_CLASS_INTERACTIVE].count == 1 &&
+        m_classQueues[COMMAND_CLASS_BULK].count == 1, "thread commands on their class queues");
+
+  executeCommand();
+  check(m_pends == 1, "urgent commands pend the interrupt");
+  check(m_ranCount == 0, "nothing runs before the interrupt");
+
+  // The interrupt runs the urgent commands only, the main loop the rest
+  commandUrgentRun();
+  check(m_ranCount == 2 && m_ran[0] == OFF && m_ran[1] == TIME_STAMPING,
+      "urgent commands run in the order received");
+  check(take(COMMAND_TIER_URGENT) == NO_COMMAND, "urgent queue empty");
+
+  commandThreadRun();
+  check(m_ranCount == 4 && m_ran[2] == ECHO && m_ran[3] == STREAM_TEST,
+      "thread commands run after, by class");
+}
+
+/*!
+ * @brief Thread work is never taken from the urgent queue, nor urgent
+ * commands from the class queues.
+ */
+static void
+testTiersApart(void)
+{
+  reset(urgentPend);
+  receive(ECHO, 4);
+  check(take(COMMAND_TIER_URGENT) == NO_COMMAND, "thread command not taken as urgent");
+
+  receive(ABORT, 0);
+  check(take(COMMAND_TIER_THREAD) == ECHO, "thread tier takes its own command");
+  check(take(COMMAND_TIER_THREAD) == NO_COMMAND, "urgent command not taken by the thread tier");
+  check(take(COMMAND_TIER_URGENT) == ABORT, "urgent tier takes it");
+}
+
+/*!
+ * @brief With no interrupt to pend, executeCommand() runs urgent commands
+ * at once, and leaves thread work for the main loop.
+ */
+static void
+testNoPend(void)
+{
+  reset(NULL);
+  receive(ECHO, 4);
+  receive(FAST_BLINK, 0);
+
+  executeCommand();
+  check(m_ranCount == 1 && m_ran[0] == FAST_BLINK, "urgent command run without a pend");
+  check(m_classQueues[COMMAND_CLASS_INTERACTIVE].count == 1, "thread command still queued");
+}
+
+/*!
+ * @brief An urgent command too long for a small arg block falls back to the
+ * thread tier as bulk.
+ */
+static void
+testLongUrgent(void)
+{
+  reset(urgentPend);
+  receive(PARAMETERS, COMMAND_ARG_POOL_SMALL_SIZE + 1);
+
+  check(m_urgentQueue.count == 0, "long urgent command not on the urgent queue");
+  check(m_classQueues[COMMAND_CLASS_BULK].count == 1, "long urgent command queued as bulk");
+  executeCommand();
+  check(m_pends == 0, "no interrupt pended for it");
+}
+
+int
+main(void)
+{
+  testClasses();
+  testClassOrder();
+  testPassLimit();
+  testUrgentFirst();
+  testTiersApart();
+  testNoPend();
+  testLongUrgent();
+
+  if (m_failed > 0)
+  {
+    printf("%u checks failed\n", m_failed);
+    return EXIT_FAILURE;
+  }
+  printf("ok   command classes, tiers and queue order\n");
+  return EXIT_SUCCESS;
+}
+
+// SoftDevice, flash and timer stand-ins -------------------------------------
+
+uint32_t
+ble_cmd_data_send(char *p_data, uint16_t *p_length)
+{
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+app_timer_create(app_timer_id_t const *p_timer_id, app_timer_mode_t mode,
+                 app_timer_timeout_handler_t timeout_handler)
+{
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void *p_context)
+{
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+app_timer_stop(app_timer_id_t timer_id)
+{
+  return NRF_SUCCESS;
+}
+
+uint32_t
+app_timer_cnt_get(void)
+{
+  return 0;
+}
+
+uint32_t
+app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from)
+{
+  return (ticks_to - ticks_from) & 0xFFFFFF;
+}
+
+void
+app_util_critical_region_enter(uint8_t *p_nested)
+{
+}
+
+void
+app_util_critical_region_exit(uint8_t nested)
+{
+}
+
+void
+app_error_handler_bare(ret_code_t error_code)
+{
+  fprintf(stderr, "commandTierTest: firmware error 0x%x\n", (unsigned) error_code);
+  exit(EXIT_FAILURE);
+}
+
+uint32_t
+sd_app_evt_wait(void)
+{
+  return NRF_SUCCESS;
+}
+
+param_info_t const *
+paramInfo(param_id_t id)
+{
+  return NULL;
+}
+
+uint32_t
+paramGet(param_id_t id)
+{
+  return 0;
+}
+
+bool
+paramSet(param_id_t id, uint32_t value)
+{
+  return false;
+}
+
+void
+journalRecord(uint8_t commandID, uint8_t status, uint16_t request,
+              uint32_t timeMs, uint32_t durationUs)
+{
+  if (m_ranCount < RUN_LOG_SIZE)
+    m_ran[m_ranCount++] = commandID;
+}
+
+void
+journalRadioIdle(void)
+{
+}
+
+void
+journalFlush(void)
+{
+}
+
+uint32_t
+journalNext(void)
+{
+  return 0;
+}
+
+uint32_t
+journalDropped(void)
+{
+  return 0;
+}
+
+bool
+journalEntry(uint32_t sequence, journal_entry_t *entry)
+{
+  return false;
+}
+
+uint32_t
+journalOldest(void)
+{
+  return 0;
+}
+
+bool
+uploadStart(uint32_t size, uint32_t crc)
+{
+  return false;
+}
+
+bool
+uploadBusy(void)
+{
+  return false;
+}
+
+bool
+uploadFailed(void)
+{
+  return false;
+}
+
+uint32_t
+uploadNext(void)
+{
+  return 0;
+}
+
+uint32_t
+uploadSize(void)
+{
+  return 0;
+}
+
+bool
+uploadWrite(void const *data, uint32_t offset, uint16_t length)
+{
+  return false;
+}
+
+bool
+uploadVerify(uint32_t *crc)
+{
+  return false;
+}
@@ -0,0 +1,2495 @@
+/*!
+ * @file linkSim.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Deterministic BLE link simulator for the command engine
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ *
+ * @details The real ble_cmd.c and command engine are built for the host and
+ * driven through stand-ins for the SoftDevice, app_timer, FDS and fstorage
+ * calls they make.
+ * The link is modelled as a sequence of connection events, each carrying up
+ * to a fixed number of packet exchanges; a notification is fragmented into
+ * link layer packets according to the data length, and the SoftDevice's
+ * notification queue holds a fixed number of notifications. Packets are
+ * lost with a fixed probability from a seeded generator and retransmitted,
+ * so a given set of parameters always gives the same result.
+ *
+ * Time only advances when the link runs or the firmware spends it: every
+ * sd_ble_gatts_hvx() call costs HVX_CALL_US, and sd_app_evt_wait() runs the
+ * link until something happens. As on the device, BLE and timer events that
+ * occur while a handler is running are held until it returns.
+ *
+ * The command tiers run as on the device: urgent commands as soon as the
+ * handler that queued them returns, and thread tier commands from the main
+ * loop when no event is waiting. A thread tier command is preempted by
+ * events and urgent commands whenever it spends time outside a critical
+ * region; the delay from the write completing an urgent command to the
+ * command running is reported.
+ *
+ * Optionally the firmware gets radio notifications a fixed distance before
+ * and right after each connection event, as with COMMAND_RADIO_ALIGN_ENABLED.
+ * For each workload command, the central notes whether its first response
+ * started in the connection event after the one that delivered the command,
+ * or was pushed out to a later one.
+ *
+ * The simulated central issues the workload with up to a fixed number of
+ * commands outstanding, optionally also keeping to the RX credits the
+ * peripheral grants, splitting each command into writes of ATT MTU - 3
+ * bytes, and counts a command done when it has received the expected number
+ * of dataAvailable framed, streamed or packed responses.
+ *
+ * A background bulk command, e.g. a long STREAM_TEST or ARG_CHECKSUM, can
+ * run alongside the workload to see how well the workload's commands cut
+ * in: its writes go only when no workload write is waiting, and its
+ * response is the one streamed or starting "argChecksum:" or "throughput:".
+ * The background command may instead be a SUBSCRIBE, whose "subscribed:"
+ * response counts as its own; event notices that follow are counted.
+ *
+ * The central can also be made to set up the connection as a real one
+ * does before its first command: a new central discovers the services, a
+ * round trip per connection event, then enables notifications, while a
+ * bonded one, as with PEER_MANAGER_ENABLED, only re-encrypts the link and
+ * finds its CCCD restored. The time from connecting to the first response
+ * is reported.
+ *
+ * Instead of a command workload, linkSim can model how soon a central that
+ * lost the link finds the peripheral again under an advertising profile,
+ * and what advertising costs in current. The central scans one advertising
+ * channel per scan window, cycling through the three, and connects on the
+ * first advertising PDU that falls wholly inside a window on its channel.
+ *
+ * Alternatively the central replays an RX capture dumped by the RX_CAPTURE
+ * command, making each captured write at its recorded time, optionally
+ * accelerated. A write that does not start with MORE_ARG_DATA starts a
+ * command.
+ *
+ * The link can be made to drop once during the workload, losing whatever
+ * was on its way, the central reconnecting LINK_GAP_US later. The central
+ * either resumes the session with RESUME, matching the carried responses to
+ * its requests and then sending again those left unanswered, or starts a
+ * new one, sending again everything unanswered at once, the background
+ * command included.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <getopt.h>
+
+#include "ble.h"
+#include "app_timer.h"
+#include "nrf_soc.h"
+#include "fds.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+
+#include "ble_cmd.h"
+#include "command.h"
+#include "response.h"
+#include "param.h"
+#include "journal.h"
+#include "upload.h"
+#include "crc32.h"
+
+// ble_cmd.c's characteristic UUIDs
+#define INVOKE_CHARACTERISTIC_UUID   0x0002
+#define RESPONSE_CHARACTERISTIC_UUID 0x0003
+
+#define CONN_HANDLE         0
+#define T_IFS_US            150
+#define HVX_CALL_US         10      // CPU time of one sd_ble_gatts_hvx() call
+#define L2CAP_ATT_OVERHEAD  7       // L2CAP header + notification opcode and handle
+#define LL_PACKET_OVERHEAD  10      // preamble, access address, header, CRC
+#define MAX_ATT_PAYLOAD     247
+#define UPLINK_QUEUE_SIZE   4096
+#define EVENT_QUEUE_SIZE    4096
+#define MAX_TIMERS          8
+#define STALL_EVENTS        1000    // connection events without progress before giving up
+#define CAPTURE_HEADER_SIZE 5       // RX_CAPTURE dump record: ticks (4 B LE), length (1 B)
+#define RTC_TICKS_MASK      0xFFFFFF
+#define ENCRYPTION_EVENTS   3       // LL_ENC_REQ/RSP, LL_START_ENC_REQ/RSP round trips
+#define LINK_GAP_US         500000  // from a dropped link to the central reconnecting
+
+// The upload region and journal, as the pca10040 linker script; nRF52832
+// timings
+#define UPLOAD_START_ADDR   0x71000
+#define UPLOAD_END_ADDR     0x79000
+#define JOURNAL_START_ADDR  0x79000
+#define JOURNAL_END_ADDR    0x7D000
+#define FLASH_PAGE_SIZE     4096
+#define FLASH_WORD_US       41      // to write a word
+#define FLASH_ERASE_US      85000   // to erase a page
+#define FSTORAGE_QUEUE_SIZE 4       // NRF_FSTORAGE_SD_QUEUE_SIZE
+
+// Advertising, as main.c's advertising_start()
+#define ADV_FIXED_INTERVAL_US    40000    // before adaptive advertising
+#define ADV_FAST_INTERVAL_US     20000
+#define ADV_FAST_DURATION_US     30000000
+#define ADV_SLOW_INTERVAL_US     1022500
+#define ADV_DIRECTED_DURATION_US 1280000
+#define ADV_DIRECTED_INTERVAL_US 3750     // high duty: each channel at least this often
+#define ADV_DELAY_MAX_US         10000    // advDelay, random per undirected event
+#define ADV_IND_PAYLOAD          33       // AdvA + 27 B advertising data, with the status record
+#define ADV_DIRECT_IND_PAYLOAD   12       // AdvA + TargetA
+#define ADV_CHANNEL_SPACING_US   700      // between an event's PDUs on 37, 38 and 39
+#define ADV_GIVE_UP_US           600000000
+
+// nRF52832 with the DC/DC converter, 0 dBm, from the product specification
+#define RADIO_TX_MA              5.3
+#define RADIO_RX_MA              5.4
+#define RADIO_RAMP_US            140      // per PDU, at about the RX current
+#define RADIO_LISTEN_US          250      // after each PDU, for a scan or connect request
+#define ADV_EVENT_OVERHEAD_UC    1.1      // HFXO start and SoftDevice CPU time per event
+#define SLEEP_UA                 1.9      // System ON, RTC running, RAM retained
+
+typedef struct
+{
+  uint32_t connIntervalUs;
+  uint8_t  packetsPerEvent;
+  uint16_t attMtu;
+  uint16_t llPayload;
+  double   lossRate;
+  uint8_t  hvnQueueSize;
+  uint32_t seed;
+  uint32_t radioDistanceUs;
+  uint8_t  discoveryRoundTrips;
+  bool     bonded;
+} link_params_t;
+
+typedef enum
+{
+  ADV_PROFILE_NONE,
+  ADV_PROFILE_FIXED,       // 40 ms, as before adaptive advertising
+  ADV_PROFILE_ADAPTIVE,    // fast, then slow once the fast phase times out
+  ADV_PROFILE_DIRECTED     // high duty directed, then adaptive
+} adv_profile_t;
+
+typedef struct
+{
+  adv_profile_t profile;
+  uint64_t centralDelayUs;   // from the disconnect until the central scans
+  uint32_t scanWindowUs;
+  uint32_t scanIntervalUs;
+} adv_workload_t;
+
+typedef struct
+{
+  uint8_t  commandID;
+  uint16_t argLength;
+  char const *arg;
+  uint32_t count;
+  uint8_t  window;
+  uint8_t  responses;
+  char const *captureFile;
+  double   acceleration;
+  int      coalesceMs;
+  bool     credits;
+  bool     background;
+  uint8_t  bgCommandID;
+  uint16_t bgArgLength;
+  char const *bgArg;
+  uint64_t dropUs;
+  bool     resume;
+  uint32_t uploadBytes;
+  bool     bootProfile;
+} workload_t;
+
+// The central's part in resuming a session over a new link
+typedef enum
+{
+  CENTRAL_RESUME_NONE,
+  CENTRAL_RESUME_AWAIT_NOTICE, // reconnected; waiting for the session notice
+  CENTRAL_RESUME_SENT,         // RESUME sent; waiting for its reply
+  CENTRAL_RESUME_CARRIED       // resumed; carried responses are coming
+} central_resume_t;
+
+// A write or notification on its way over the link
+typedef struct
+{
+  uint8_t  data[MAX_ATT_PAYLOAD];
+  uint16_t length;
+  uint16_t bytesLeft;   // L2CAP bytes still to go over the air
+  int32_t  command;     // the workload command this write completes, or -1
+} pdu_t;
+
+// Writes waiting to go over the link
+typedef struct
+{
+  pdu_t  * pdus;
+  uint32_t head;
+  uint32_t count;
+} uplink_t;
+
+// A captured write and when to replay it
+typedef struct
+{
+  uint64_t timeUs;
+  uint16_t length;
+  uint8_t  data[MAX_ATT_PAYLOAD];
+} replay_write_t;
+
+// An event waiting for the firmware's handler context to be free
+typedef enum
+{
+  SIM_EVT_CONNECTED,
+  SIM_EVT_DISCONNECTED,
+  SIM_EVT_WRITE,
+  SIM_EVT_HVN_TX_COMPLETE,
+  SIM_EVT_TIMER,
+  SIM_EVT_RADIO,
+  SIM_EVT_FLASH,
+  SIM_EVT_FSTORAGE
+} sim_evt_type_t;
+
+typedef struct
+{
+  sim_evt_type_t type;
+  uint64_t       timeUs;
+  uint16_t       handle;
+  uint16_t       length;
+  uint8_t        data[MAX_ATT_PAYLOAD];
+  uint8_t        timer;
+  bool           radioActive;
+  fds_evt_t          flash;
+  nrf_fstorage_evt_t fstorage;
+  nrf_fstorage_evt_handler_t fstorageHandler;
+} sim_evt_t;
+
+typedef struct
+{
+  app_timer_id_t              id;
+  app_timer_timeout_handler_t handler;
+  app_timer_mode_t            mode;
+  bool                        active;
+  uint64_t                    expiryUs;
+  uint32_t                    periodUs;
+  void                      * context;
+} sim_timer_t;
+
+typedef struct
+{
+  uint64_t connectionEvents;
+  uint64_t packetsSent;
+  uint64_t packetsLost;
+  uint64_t notifications;
+  uint64_t notificationBytes;
+  uint64_t hvxRefused;
+  uint64_t creditGrants;
+  uint64_t eventNotices;
+  uint64_t eventNoticeBytes;
+  uint64_t bootNotices;
+  uint64_t bootStages;
+  uint64_t bootMismatches;
+  uint64_t writes;
+  uint64_t latencySumUs;
+  uint64_t latencyMinUs;
+  uint64_t latencyMaxUs;
+  uint64_t urgentRuns;
+  uint64_t urgentPreemptions;
+  uint64_t urgentSumUs;
+  uint64_t urgentMinUs;
+  uint64_t urgentMaxUs;
+  uint64_t nextEvent;
+  uint64_t pushedOut;
+  uint64_t eventsLateSum;
+  uint64_t eventsLateMax;
+  uint64_t droppedUs;
+  uint64_t carriedResponses;
+  uint64_t sentAgain;
+  bool     resumed;
+} sim_stats_t;
+
+static link_params_t m_link =
+{
+  .connIntervalUs  = 30000,
+  .packetsPerEvent = 4,
+  .attMtu          = 23,
+  .llPayload       = 27,
+  .lossRate        = 0.0,
+  .hvnQueueSize    = 1,
+  .seed            = 1,
+  .radioDistanceUs = 0,
+  .discoveryRoundTrips = 0,
+  .bonded          = false
+};
+
+static workload_t m_workload =
+{
+  .commandID = ECHO,
+  .argLength = 16,
+  .arg       = NULL,
+  .count     = 100,
+  .window    = 1,
+  .responses = 2,
+  .captureFile  = NULL,
+  .acceleration = 1.0,
+  .coalesceMs   = -1,
+  .credits      = false,
+  .background   = false,
+  .dropUs       = 0,
+  .resume       = false,
+  .uploadBytes  = 0,
+  .bootProfile  = false
+};
+
+// A start up profile for -G, as main.c might time it; the SoftDevice waits
+// for the LF clock, and the upload region is skipped
+static uint32_t const m_bootStageUs[BOOT_STAGES] =
+{
+  [BOOT_STAGE_LOG]                 = 180,
+  [BOOT_STAGE_LEDS]                = 240,
+  [BOOT_STAGE_TIMERS]              = 410,
+  [BOOT_STAGE_RESUME]              = 455,
+  [BOOT_STAGE_BLE_STACK]           = 251300,
+  [BOOT_STAGE_POWER]               = 251340,
+  [BOOT_STAGE_PARAMS]              = 262870,
+  [BOOT_STAGE_GAP]                 = 263410,
+  [BOOT_STAGE_GATT]                = 263520,
+  [BOOT_STAGE_SERVICES]            = 264980,
+  [BOOT_STAGE_ADVERTISING_DATA]    = 265330,
+  [BOOT_STAGE_CONN_PARAMS]         = 265390,
+  [BOOT_STAGE_PEER_MANAGER]        = 281200,
+  [BOOT_STAGE_ADVERTISING]         = 281760,
+  [BOOT_STAGE_LOG_BACKENDS]        = 283050,
+  [BOOT_STAGE_RADIO_NOTIFICATION]  = 283120,
+  [BOOT_STAGE_JOURNAL]             = 297400,
+  [BOOT_STAGE_UPLOAD]              = 0
+};
+
+static bool m_bootReceived[BOOT_STAGES];
+
+static adv_workload_t m_adv =
+{
+  .profile        = ADV_PROFILE_NONE,
+  .centralDelayUs = 0,
+  .scanWindowUs   = 50000,
+  .scanIntervalUs = 100000
+};
+
+static bool m_verbose;
+
+static uint64_t m_nowUs;
+static uint64_t m_nextAnchorUs;
+static bool     m_radioNotified;
+static uint32_t m_random;
+
+static pdu_t    m_hvnQueue[UINT8_MAX];
+static uint8_t  m_hvnHead;
+static uint8_t  m_hvnCount;
+
+static uplink_t m_uplink;
+static uplink_t m_bgUplink;
+
+static sim_evt_t * m_events;
+static uint32_t    m_eventHead;
+static uint32_t    m_eventCount;
+
+static sim_timer_t m_timers[MAX_TIMERS];
+static uint8_t     m_timerCount;
+
+// Flash holds one record, written at once; FDS events other than
+// FDS_EVT_INIT are sent from the SoC event handler once the call returns
+static struct
+{
+  fds_cb_t     handler;
+  uint16_t     fileId;
+  uint16_t     key;
+  uint32_t     data[PARAM_COUNT];
+  fds_header_t header;
+  bool         written;
+} m_flash;
+
+// A queued flash operation, and the fstorage instance it is for
+typedef struct
+{
+  nrf_fstorage_evt_handler_t handler;
+  nrf_fstorage_evt_t         evt;
+  uint64_t                   durationUs;
+} sim_flash_op_t;
+
+// The flash behind fstorage. Operations run one at a time in the order
+// queued, taking the flash timings; each takes effect as it ends, so the
+// data written is read then, and its result is sent from the SoC event
+// handler.
+static struct
+{
+  uint8_t        data[JOURNAL_END_ADDR - UPLOAD_START_ADDR];
+  sim_flash_op_t ops[FSTORAGE_QUEUE_SIZE];
+  uint8_t        head;
+  uint8_t        count;
+  uint64_t       doneUs;
+  uint32_t       writes;
+  uint32_t       erases;
+} m_fstorage;
+
+static void fstorageDone();
+
+static sim_stats_t m_stats;
+
+// Firmware context: in a handler, in a critical region, running the thread tier
+static bool     m_inHandler;
+static uint8_t  m_criticalDepth;
+static bool     m_inThread;
+static bool     m_urgentPending;
+static uint64_t m_urgentPendUs;
+static uint64_t m_eventUs;
+
+// The command service under test, found through the stand-ins ble_cmd_init() calls
+static ble_cmd_t * m_cmd;
+static uint16_t    m_rxHandle;
+static uint16_t    m_txCccdHandle;
+static uint16_t    m_nextHandle = 1;
+static uint16_t    m_connHandle = BLE_CONN_HANDLE_INVALID;
+static uint32_t    m_linkContext[8];
+static bool        m_linkDown;
+static bool        m_linkDropped;
+static uint64_t    m_reconnectUs;
+
+// Central side
+static uint64_t * m_issueUs;
+static uint64_t * m_deliverEvent;
+static uint32_t   m_issued;
+static uint32_t   m_completed;
+static uint16_t   m_responseBytesLeft;
+static bool       m_inResponse;
+static bool       m_inStream;
+static bool       m_streamIsBg;
+static bool       m_responseStarted;
+static bool       m_responseIsBg;
+static bool       m_bgIssued;
+static bool       m_bgSendAgain;   // the link dropped before its response
+static bool       m_bgDone;
+static uint64_t   m_bgIssueUs;
+static uint64_t   m_bgDoneUs;
+static uint8_t  * m_responsesOf;       // responses received to each command
+static uint32_t * m_awaiting;          // commands sent over this link awaiting responses, oldest first
+static uint32_t   m_awaitHead;
+static uint32_t   m_awaitCount;
+static int32_t    m_responseTarget;    // the command the framed response being received answers
+static int32_t    m_streamTarget;      // the command the stream being received answers
+static uint16_t * m_requestOf;         // each command's request number
+static bool     * m_unanswered;        // sent over a link that dropped, with no response yet
+static uint16_t   m_nextRequest;
+static int32_t    m_carriedTarget;     // the command the next response answers, if carried
+static uint32_t   m_sessionToken;
+static central_resume_t m_resume;
+static bool       m_sendAgainPending;
+static uint64_t   m_lastProgressEvent;
+static bool       m_creditGranted;
+static uint16_t   m_creditLimit;
+static uint16_t   m_creditArgEach;
+static uint16_t   m_creditArgMax;
+static bool       m_centralReady;
+static uint8_t    m_setupEventsLeft;
+static bool       m_firstResponse;
+static uint64_t   m_firstResponseUs;
+static replay_write_t * m_replay;
+static uint32_t   m_replayCount;
+static uint32_t   m_replayNext;
+static uint8_t  * m_uploadImage;       // what an upload workload uploads
+static uint32_t   m_uploadCrc;
+static char       m_uploadArg[4096];   // the arg of the upload command being queued
+
+/*!
+ * @brief xorshift32, so runs are repeatable for a given seed
+ */
+static uint32_t
+nextRandom()
+{
+  m_random ^= m_random << 13;
+  m_random ^= m_random >> 17;
+  m_random ^= m_random << 5;
+  return m_random;
+}
+
+static bool
+packetLost()
+{
+  return m_link.lossRate > 0 &&
+      (nextRandom() / (double) UINT32_MAX) < m_link.lossRate;
+}
+
+static uint32_t
+airTimeUs(uint16_t payload)
+{
+  return (payload + LL_PACKET_OVERHEAD) * 8;
+}
+
+static void
+pushEvent(sim_evt_t const *evt)
+{
+  if (m_eventCount == EVENT_QUEUE_SIZE)
+  {
+    fprintf(stderr, "linkSim: event queue overflow\n");
+    exit(EXIT_FAILURE);
+  }
+  m_events[(m_eventHead + m_eventCount) % EVENT_QUEUE_SIZE] = *evt;
+  m_eventCount++;
+}
+
+// Central ----------------------------------------------------------------
+
+static void
+queueWrite(uplink_t *uplink, uint8_t const *data, uint16_t length)
+{
+  if (uplink->count == UPLINK_QUEUE_SIZE)
+  {
+    fprintf(stderr, "linkSim: uplink queue overflow\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pdu_t *pdu = &uplink->pdus[(uplink->head + uplink->count) % UPLINK_QUEUE_SIZE];
+  memcpy(pdu->data, data, length);
+  pdu->length = length;
+  pdu->bytesLeft = length + L2CAP_ATT_OVERHEAD;
+  pdu->command = -1;
+  uplink->count++;
+}
+
+/*!
+ * @brief Split a command into writes of ATT MTU - 3 bytes.
+ *
+ * @details The first write carries the header, the rest go as More Arg Data.
+ */
+static void
+queueCommand(uplink_t *uplink, uint8_t commandID, char const *arg, uint16_t argLength)
+{
+  uint16_t writeLength = m_link.attMtu - 3;
+  uint8_t command[4 + 4095];
+  uint16_t length = 4 + argLength;
+
+  command[0] = commandID;
+  sprintf((char *) command + 1, "%03X", argLength);
+  for (uint16_t i = 0; i < argLength; i++)
+    command[4 + i] = arg ? arg[i] : 'a' + (i % 26);
+
+  uint16_t offset = 0;
+  while (offset < length)
+  {
+    uint8_t write[MAX_ATT_PAYLOAD];
+    uint16_t chunk;
+    if (offset == 0)
+    {
+      chunk = (length < writeLength) ? length : writeLength;
+      queueWrite(uplink, command, chunk);
+    }
+    else
+    {
+      chunk = (length - offset < writeLength - 1) ? length - offset : writeLength - 1;
+      write[0] = MORE_ARG_DATA;
+      memcpy(write + 1, command + offset, chunk);
+      queueWrite(uplink, write, chunk + 1);
+    }
+    offset += chunk;
+  }
+}
+
+/*!
+ * @brief A workload command's arg: the same for every command, or for an
+ * upload, S, then each block, then F.
+ *
+ * @return the arg length
+ */
+static uint16_t
+workloadArg(uint32_t command, char const **arg)
+{
+  if (m_workload.uploadBytes == 0)
+  {
+    *arg = m_workload.arg;
+    return m_workload.argLength;
+  }
+
+  *arg = m_uploadArg;
+  if (command == 0)
+    return (uint16_t) sprintf(m_uploadArg, "S%08X%08X", m_workload.uploadBytes, m_uploadCrc);
+  if (command == m_workload.count - 1)
+    return (uint16_t) sprintf(m_uploadArg, "F");
+
+  uint32_t offset = (command - 1) * m_workload.argLength;
+  uint32_t length = m_workload.uploadBytes - offset;
+  if (length > m_workload.argLength)
+    length = m_workload.argLength;
+  int header = sprintf(m_uploadArg, "B%08X%08X", offset,
+                       crc32_compute(m_uploadImage + offset, length, NULL));
+  memcpy(m_uploadArg + header, m_uploadImage + offset, length);
+  return (uint16_t) (header + length);
+}
+
+static void
+centralCommandDone(uint64_t timeUs, uint32_t command)
+{
+  uint64_t latency = timeUs - m_issueUs[command];
+
+  m_stats.latencySumUs += latency;
+  if (m_completed == 0 || latency < m_stats.latencyMinUs)
+    m_stats.latencyMinUs = latency;
+  if (latency > m_stats.latencyMaxUs)
+    m_stats.latencyMaxUs = latency;
+
+  if (m_verbose)
+    printf("%10.3f ms  command %u done, latency %.3f ms\n",
+        timeUs / 1000.0, command, latency / 1000.0);
+
+  m_completed++;
+  if (m_awaitCount > 0 && m_awaiting[m_awaitHead] == command)
+  {
+    m_awaitHead = (m_awaitHead + 1) % m_workload.count;
+    m_awaitCount--;
+  }
+}
+
+/*!
+ * @brief Note a workload command as sent, awaiting its responses.
+ */
+static void
+centralAwait(uint32_t command)
+{
+  m_responsesOf[command] = 0;
+  m_requestOf[command] = m_nextRequest;
+  m_awaiting[(m_awaitHead + m_awaitCount) % m_workload.count] = command;
+  m_awaitCount++;
+}
+
+/*!
+ * @brief The command a response starting now answers: the one a carried
+ * mark named, else the oldest awaiting one; -1 if none.
+ */
+static int32_t
+centralTarget()
+{
+  int32_t target = m_carriedTarget;
+
+  if (target >= 0)
+  {
+    m_carriedTarget = -1;
+    return target;
+  }
+  return (m_awaitCount > 0) ? (int32_t) m_awaiting[m_awaitHead] : -1;
+}
+
+/*!
+ * @brief Note which connection event a workload command's first response
+ * started in, relative to the one that delivered the command.
+ */
+static void
+centralResponseStart(int32_t target)
+{
+  if (target < 0 || m_responsesOf[target] > 0 || m_deliverEvent[target] == 0)
+    return;
+
+  uint64_t late = m_stats.connectionEvents - m_deliverEvent[target];
+  if (late <= 1)
+    m_stats.nextEvent++;
+  else
+  {
+    m_stats.pushedOut++;
+    m_stats.eventsLateSum += late - 1;
+    if (late - 1 > m_stats.eventsLateMax)
+      m_stats.eventsLateMax = late - 1;
+  }
+}
+
+/*!
+ * @brief Count a response received in full.
+ *
+ * @param background - true if it is the background command's response
+ * @param target     - the workload command it answers, or -1 if none
+ */
+static void
+centralResponseDone(uint64_t timeUs, bool background, int32_t target)
+{
+  if (background)
+  {
+    m_bgDone = true;
+    m_bgDoneUs = timeUs;
+    if (m_verbose)
+      printf("%10.3f ms  background command done, %.3f ms\n",
+          timeUs / 1000.0, (timeUs - m_bgIssueUs) / 1000.0);
+  }
+  else
+  {
+    if (!m_firstResponse)
+    {
+      m_firstResponse = true;
+      m_firstResponseUs = timeUs;
+    }
+    if (target >= 0 && ++m_responsesOf[target] == m_workload.responses)
+      centralCommandDone(timeUs, (uint32_t) target);
+  }
+}
+
+static bool
+backgroundPending()
+{
+  return m_bgIssued && !m_bgDone;
+}
+
+static uint16_t
+readLittleEndian16(uint8_t const *data)
+{
+  return data[0] | (data[1] << 8);
+}
+
+static uint32_t
+readLittleEndian32(uint8_t const *data)
+{
+  return readLittleEndian16(data) | ((uint32_t) readLittleEndian16(data + 2) << 16);
+}
+
+/*!
+ * @brief Whether the next command keeps to the credits granted.
+ */
+static bool
+centralHasCredit()
+{
+  if (!m_workload.credits)
+    return true;
+
+  if (!m_creditGranted || (int16_t) (m_creditLimit - (uint16_t) (m_issued + m_bgIssued)) <= 0)
+    return false;
+
+  // Checksummed as it arrives, one at a time
+  if (m_workload.commandID == ARG_CHECKSUM)
+    return m_issued == m_completed;
+
+  // Upload blocks go to their own buffers
+  if (m_workload.uploadBytes > 0)
+    return true;
+
+  return m_workload.argLength <= m_creditArgEach ||
+      (m_issued == m_completed && m_workload.argLength <= m_creditArgMax);
+}
+
+/*!
+ * @brief Send again the workload commands that went unanswered over a link
+ * that dropped, keeping their issue times.
+ */
+static void
+centralSendAgain()
+{
+  m_sendAgainPending = false;
+  for (uint32_t i = 0; i < m_issued; i++)
+  {
+    if (!m_unanswered[i])
+      continue;
+    m_unanswered[i] = false;
+    if (m_responsesOf[i] >= m_workload.responses)
+      continue;
+    char const *arg;
+    uint16_t argLength = workloadArg(i, &arg);
+    queueCommand(&m_uplink, m_workload.commandID, arg, argLength);
+    m_uplink.pdus[(m_uplink.head + m_uplink.count - 1) % UPLINK_QUEUE_SIZE].command = i;
+    m_deliverEvent[i] = 0;
+    centralAwait(i);
+    m_nextRequest++;
+    m_stats.sentAgain++;
+  }
+}
+
+/*!
+ * @brief Act on a session notice.
+ *
+ * @details Reconnected with resumption on, the central resumes a session
+ * offered with the token it had; once resumed it waits for the carried
+ * responses to end before sending anything again. Otherwise the session
+ * is new and numbers requests from 0.
+ */
+static void
+centralSession(uint32_t token, bool carried)
+{
+  switch (m_resume)
+  {
+    case CENTRAL_RESUME_AWAIT_NOTICE:
+      if (carried && token == m_sessionToken)
+      {
+        char arg[9];
+        sprintf(arg, "%08X", (unsigned) token);
+        queueCommand(&m_uplink, RESUME, arg, 8);
+        m_nextRequest++;
+        m_resume = CENTRAL_RESUME_SENT;
+        return;
+      }
+    break;
+    case CENTRAL_RESUME_SENT:
+      if (carried)
+      {
+        m_resume = CENTRAL_RESUME_CARRIED;
+        m_stats.resumed = true;
+        return;
+      }
+    break;
+    default:
+      // The notice of a new connection, or of a session started without
+      // resuming
+      m_sessionToken = token;
+      return;
+  }
+
+  m_sessionToken = token;
+  m_nextRequest = 0;
+  m_resume = CENTRAL_RESUME_NONE;
+  centralSendAgain();
+}
+
+/*!
+ * @brief Check a boot notice's times against those reported.
+ */
+static void
+centralBootNotice(uint8_t const *data, uint16_t length)
+{
+  uint32_t stage = data[1];
+
+  m_stats.bootNotices++;
+  for (uint16_t offset = 2; offset + 3 <= length && stage < BOOT_STAGES; offset += 3, stage++)
+  {
+    uint32_t us = data[offset] | (data[offset + 1] << 8) | ((uint32_t) data[offset + 2] << 16);
+    if (us != m_bootStageUs[stage])
+      m_stats.bootMismatches++;
+    if (!m_bootReceived[stage])
+      m_stats.bootStages++;
+    m_bootReceived[stage] = true;
+  }
+}
+
+static void
+centralReceive(uint8_t const *data, uint16_t length, uint64_t timeUs)
+{
+  static char const header[] = "dataAvailable:";
+  static char const streamHeader[] = "dataStream:";
+  uint16_t headerLength = sizeof(header) - 1;
+
+  m_stats.notifications++;
+  m_stats.notificationBytes += length;
+  m_lastProgressEvent = m_stats.connectionEvents;
+
+  // A framed response cannot be cut into
+  if (m_inResponse)
+  {
+    if (!m_responseStarted)
+    {
+      static char const checksum[] = "argChecksum:";
+      static char const throughput[] = "throughput:";
+      static char const subscribed[] = "subscribed:";
+      m_responseStarted = true;
+      m_responseIsBg = backgroundPending() &&
+          ((length >= sizeof(checksum) - 1 && memcmp(data, checksum, sizeof(checksum) - 1) == 0) ||
+           (length >= sizeof(throughput) - 1 && memcmp(data, throughput, sizeof(throughput) - 1) == 0) ||
+           (length >= sizeof(subscribed) - 1 && memcmp(data, subscribed, sizeof(subscribed) - 1) == 0));
+    }
+    m_responseBytesLeft -= (length < m_responseBytesLeft) ? length : m_responseBytesLeft;
+    if (m_responseBytesLeft == 0)
+    {
+      m_inResponse = false;
+      centralResponseDone(timeUs, m_responseIsBg, m_responseTarget);
+    }
+    return;
+  }
+
+  // Anything but a stream flag is a response cutting in
+  if (m_inStream && length > 0 &&
+      (data[0] == RESPONSE_STREAM_MORE || data[0] == RESPONSE_STREAM_END))
+  {
+    if (data[0] == RESPONSE_STREAM_END)
+    {
+      m_inStream = false;
+      centralResponseDone(timeUs, m_streamIsBg, m_streamTarget);
+    }
+    return;
+  }
+
+  if (length >= 9 && data[0] == COMMAND_CREDIT_MARK)
+  {
+    m_creditLimit = readLittleEndian16(data + 1);
+    m_creditArgEach = readLittleEndian16(data + 5);
+    m_creditArgMax = readLittleEndian16(data + 7);
+    m_creditGranted = true;
+    m_stats.creditGrants++;
+  }
+  else if (length >= 2 && data[0] == COMMAND_EVENT_MARK)
+  {
+    m_stats.eventNotices++;
+    m_stats.eventNoticeBytes += length;
+  }
+  else if (length >= 6 && data[0] == COMMAND_SESSION_MARK)
+    centralSession(readLittleEndian32(data + 1), data[5] != 0);
+  else if (length >= 2 && data[0] == COMMAND_BOOT_MARK)
+    centralBootNotice(data, length);
+  else if (length == 3 && data[0] == RESPONSE_CARRIED)
+  {
+    uint16_t request = readLittleEndian16(data + 1);
+    m_carriedTarget = -1;
+    for (uint32_t i = 0; i < m_issued; i++)
+      if (m_requestOf[i] == request && m_responsesOf[i] < m_workload.responses)
+        m_carriedTarget = (int32_t) i;
+    m_stats.carriedResponses++;
+  }
+  else if (length == 1 && data[0] == RESPONSE_CARRIED)
+  {
+    // The carried responses are all in; whatever is still unanswered was lost
+    m_resume = CENTRAL_RESUME_NONE;
+    centralSendAgain();
+  }
+  else if (length > 0 && data[0] == RESPONSE_PACKED)
+  {
+    // Each packed record is a whole response
+    for (uint16_t offset = 1; offset < length; offset += 1 + data[offset])
+    {
+      int32_t target = centralTarget();
+      centralResponseStart(target);
+      centralResponseDone(timeUs, false, target);
+    }
+  }
+  else if (length >= headerLength + 4 && memcmp(data, header, headerLength) == 0)
+  {
+    char digits[5];
+    memcpy(digits, data + headerLength, 4);
+    digits[4] = '\0';
+    m_responseBytesLeft = (uint16_t) atoi(digits);
+    m_responseStarted = false;
+    m_responseTarget = centralTarget();
+    if (!backgroundPending())
+      centralResponseStart(m_responseTarget);
+    m_inResponse = (m_responseBytesLeft > 0);
+    if (m_responseBytesLeft == 0)
+      centralResponseDone(timeUs, false, m_responseTarget);
+  }
+  else if (length == sizeof(streamHeader) - 1 && memcmp(data, streamHeader, length) == 0)
+  {
+    m_inStream = true;
+    m_streamIsBg = backgroundPending();
+    m_streamTarget = centralTarget();
+    if (!m_streamIsBg)
+      centralResponseStart(m_streamTarget);
+  }
+  // Anything else is unframed data, e.g. from THROUGHPUT_TEST
+}
+
+static void
+centralReplay()
+{
+  while (m_replayNext < m_replayCount && m_replay[m_replayNext].timeUs <= m_nowUs)
+  {
+    replay_write_t const *write = &m_replay[m_replayNext++];
+
+    if (write->length > m_link.attMtu - 3)
+    {
+      fprintf(stderr, "linkSim: captured write of %u bytes exceeds ATT MTU %u\n",
+          write->length, m_link.attMtu);
+      exit(EXIT_FAILURE);
+    }
+
+    queueWrite(&m_uplink, write->data, write->length);
+    if (write->data[0] != MORE_ARG_DATA)
+    {
+      centralAwait(m_issued);
+      m_nextRequest++;
+      m_issueUs[m_issued++] = m_nowUs;
+    }
+
+    // Gaps in the capture are not stalls
+    m_lastProgressEvent = m_stats.connectionEvents;
+  }
+}
+
+/*!
+ * @brief Take the connection a connection event further towards the
+ * central being able to use the service.
+ *
+ * @details A new central discovers the services and then enables
+ * notifications; a bonded one re-encrypts the link, its CCCD restored from
+ * the bond.
+ */
+static void
+centralSetup()
+{
+  if (m_centralReady)
+    return;
+
+  // Each round trip takes a connection event
+  if (m_setupEventsLeft > 0)
+  {
+    m_setupEventsLeft--;
+    m_lastProgressEvent = m_stats.connectionEvents;
+    return;
+  }
+
+  if (!m_link.bonded)
+  {
+    sim_evt_t cccd = { .type = SIM_EVT_WRITE, .timeUs = m_nowUs, .handle = m_txCccdHandle,
+                       .length = 2, .data = { 0x01, 0x00 } };
+    pushEvent(&cccd);
+  }
+  m_centralReady = true;
+
+  // Back after the link dropped; unless resuming, send again whatever went
+  // unanswered
+  if (m_sendAgainPending && m_resume == CENTRAL_RESUME_NONE)
+    centralSendAgain();
+}
+
+/*!
+ * @brief Connect, the central setting up the connection from the next
+ * connection event.
+ *
+ * @details Unless the connection setup is modelled, the central enables
+ * notifications at once.
+ */
+static void
+centralConnect(uint64_t timeUs)
+{
+  sim_evt_t connected = { .type = SIM_EVT_CONNECTED, .timeUs = timeUs };
+
+  pushEvent(&connected);
+  m_setupEventsLeft = m_link.bonded ? ENCRYPTION_EVENTS : m_link.discoveryRoundTrips;
+  if (m_setupEventsLeft == 0 && !m_link.bonded)
+    centralSetup();
+}
+
+static void
+centralIssue()
+{
+  // Nothing new until the session is settled
+  if (!m_centralReady ||
+      m_resume == CENTRAL_RESUME_AWAIT_NOTICE || m_resume == CENTRAL_RESUME_SENT)
+    return;
+
+  if (m_replay != NULL)
+  {
+    centralReplay();
+    return;
+  }
+
+  // The background command goes first, then the workload cuts in
+  if (m_workload.background && !m_bgIssued)
+  {
+    if (m_workload.credits && (!m_creditGranted || (int16_t) (m_creditLimit - (uint16_t) m_issued) <= 0))
+      return;
+    queueCommand(&m_bgUplink, m_workload.bgCommandID, m_workload.bgArg, m_workload.bgArgLength);
+    m_nextRequest++;
+    m_bgIssued = true;
+    // Timed from when it was first sent
+    if (m_bgSendAgain)
+      m_stats.sentAgain++;
+    else
+      m_bgIssueUs = m_nowUs;
+    m_bgSendAgain = false;
+  }
+
+  while (m_issued < m_workload.count &&
+         m_issued - m_completed < m_workload.window &&
+         centralHasCredit())
+  {
+    char const *arg;
+    uint16_t argLength = workloadArg(m_issued, &arg);
+    queueCommand(&m_uplink, m_workload.commandID, arg, argLength);
+    m_uplink.pdus[(m_uplink.head + m_uplink.count - 1) % UPLINK_QUEUE_SIZE].command = m_issued;
+    centralAwait(m_issued);
+    m_nextRequest++;
+    m_issueUs[m_issued++] = m_nowUs;
+  }
+}
+
+/*!
+ * @brief Drop the link at the coming connection event.
+ *
+ * @details Notifications and writes on their way are lost, as is whatever
+ * the central had of a response. The central notes what went unanswered.
+ */
+static void
+linkDrop()
+{
+  sim_evt_t disconnected = { .type = SIM_EVT_DISCONNECTED, .timeUs = m_nextAnchorUs };
+
+  m_linkDown = true;
+  m_linkDropped = true;
+  m_reconnectUs = m_nextAnchorUs + LINK_GAP_US;
+  m_stats.droppedUs = m_nextAnchorUs;
+  pushEvent(&disconnected);
+
+  m_hvnHead = 0;
+  m_hvnCount = 0;
+  m_uplink.head = 0;
+  m_uplink.count = 0;
+  m_bgUplink.head = 0;
+  m_bgUplink.count = 0;
+
+  m_inResponse = false;
+  m_inStream = false;
+  m_carriedTarget = -1;
+  m_awaitCount = 0;
+  for (uint32_t i = 0; i < m_issued; i++)
+    if (m_responsesOf[i] < m_workload.responses)
+      m_unanswered[i] = true;
+  if (backgroundPending())
+  {
+    m_bgIssued = false;
+    m_bgSendAgain = true;
+  }
+  m_centralReady = false;
+
+  if (m_verbose)
+    printf("%10.3f ms  link dropped, %u commands unanswered\n",
+        m_nextAnchorUs / 1000.0, m_issued - m_completed);
+}
+
+/*!
+ * @brief Reconnect after the link dropped.
+ */
+static void
+linkReconnect()
+{
+  m_linkDown = false;
+  m_sendAgainPending = true;
+  if (m_workload.resume)
+    m_resume = CENTRAL_RESUME_AWAIT_NOTICE;
+  else
+    m_nextRequest = 0;
+
+  if (m_verbose)
+    printf("%10.3f ms  reconnected\n", m_nextAnchorUs / 1000.0);
+
+  centralConnect(m_nextAnchorUs);
+}
+
+// Link -------------------------------------------------------------------
+
+static uint16_t
+nextFragment(pdu_t const *pdu)
+{
+  return (pdu->bytesLeft < m_link.llPayload) ? pdu->bytesLeft : m_link.llPayload;
+}
+
+/*!
+ * @brief The uplink queue to send from next; background writes only go
+ * when no workload write is waiting, once started.
+ */
+static uplink_t *
+nextUplink()
+{
+  pdu_t const *bgHead = &m_bgUplink.pdus[m_bgUplink.head];
+
+  if (m_bgUplink.count > 0 && bgHead->bytesLeft < bgHead->length + L2CAP_ATT_OVERHEAD)
+    return &m_bgUplink;
+  if (m_uplink.count > 0)
+    return &m_uplink;
+  if (m_bgUplink.count > 0)
+    return &m_bgUplink;
+  return NULL;
+}
+
+/*!
+ * @brief Run one connection event.
+ *
+ * @details Each exchange carries the central's next uplink fragment and the
+ * peripheral's next notification fragment. The event ends when neither side
+ * has more data, after packetsPerEvent exchanges, or when the next exchange
+ * would run into the following anchor point.
+ *
+ * @return when the event ended
+ */
+static uint64_t
+connectionEvent(uint64_t anchorUs)
+{
+  uint64_t t = anchorUs;
+
+  m_stats.connectionEvents++;
+
+  for (uint8_t exchange = 0; exchange < m_link.packetsPerEvent; exchange++)
+  {
+    uplink_t *uplink = nextUplink();
+    bool up = uplink != NULL;
+    bool down = m_hvnCount > 0;
+
+    if (!up && !down && exchange > 0)
+      break;
+
+    uint16_t upBytes = up ? nextFragment(&uplink->pdus[uplink->head]) : 0;
+    uint16_t downBytes = down ? nextFragment(&m_hvnQueue[m_hvnHead]) : 0;
+    uint32_t exchangeUs = airTimeUs(upBytes) + T_IFS_US + airTimeUs(downBytes) + T_IFS_US;
+
+    if (t + exchangeUs > anchorUs + m_link.connIntervalUs)
+      break;
+    t += exchangeUs;
+
+    if (up)
+    {
+      m_stats.packetsSent++;
+      pdu_t *pdu = &uplink->pdus[uplink->head];
+      if (packetLost())
+        m_stats.packetsLost++;
+      else if ((pdu->bytesLeft -= upBytes) == 0)
+      {
+        sim_evt_t evt = { .type = SIM_EVT_WRITE, .timeUs = t, .handle = m_rxHandle, .length = pdu->length };
+        memcpy(evt.data, pdu->data, pdu->length);
+        pushEvent(&evt);
+        m_stats.writes++;
+        if (pdu->command >= 0)
+          m_deliverEvent[pdu->command] = m_stats.connectionEvents;
+        uplink->head = (uplink->head + 1) % UPLINK_QUEUE_SIZE;
+        uplink->count--;
+      }
+    }
+
+    if (down)
+    {
+      m_stats.packetsSent++;
+      pdu_t *pdu = &m_hvnQueue[m_hvnHead];
+      if (packetLost())
+        m_stats.packetsLost++;
+      else if ((pdu->bytesLeft -= downBytes) == 0)
+      {
+        centralReceive(pdu->data, pdu->length, t);
+        sim_evt_t evt = { .type = SIM_EVT_HVN_TX_COMPLETE, .timeUs = t };
+        pushEvent(&evt);
+        m_hvnHead = (m_hvnHead + 1) % m_link.hvnQueueSize;
+        m_hvnCount--;
+      }
+    }
+  }
+
+  return t;
+}
+
+/*!
+ * @brief When the next radio notification before a connection event is due,
+ * or UINT64_MAX if none is.
+ */
+static uint64_t
+radioActiveDueUs()
+{
+  if (m_link.radioDistanceUs == 0 || m_radioNotified || m_linkDown)
+    return UINT64_MAX;
+  return (m_nextAnchorUs > m_link.radioDistanceUs) ? m_nextAnchorUs - m_link.radioDistanceUs : 0;
+}
+
+/*!
+ * @brief When the firmware next has something to handle if left idle: a
+ * radio notification, a timer or a connection event.
+ */
+static uint64_t
+nextWakeUs()
+{
+  uint64_t wakeUs = m_nextAnchorUs;
+  uint64_t radioUs = radioActiveDueUs();
+
+  if (radioUs < wakeUs)
+    wakeUs = radioUs;
+  for (uint8_t i = 0; i < m_timerCount; i++)
+    if (m_timers[i].active && m_timers[i].expiryUs < wakeUs)
+      wakeUs = m_timers[i].expiryUs;
+  if (m_fstorage.count > 0 && m_fstorage.doneUs < wakeUs)
+    wakeUs = m_fstorage.doneUs;
+  return (wakeUs > m_nowUs) ? wakeUs : m_nowUs;
+}
+
+/*!
+ * @brief Run the link and timers up to a point in time.
+ */
+static void
+runUntil(uint64_t timeUs)
+{
+  while (m_nextAnchorUs <= timeUs || radioActiveDueUs() <= timeUs)
+  {
+    uint64_t radioUs = radioActiveDueUs();
+    if (radioUs <= m_nextAnchorUs)
+    {
+      sim_evt_t evt = { .type = SIM_EVT_RADIO, .timeUs = radioUs, .radioActive = true };
+      pushEvent(&evt);
+      m_radioNotified = true;
+      continue;
+    }
+
+    // The central keeps issuing while the firmware is busy
+    if (m_nextAnchorUs > m_nowUs)
+      m_nowUs = m_nextAnchorUs;
+
+    // The link drops once, with no connection events until the central
+    // reconnects
+    if (m_workload.dropUs > 0 && !m_linkDropped && m_nextAnchorUs >= m_workload.dropUs)
+      linkDrop();
+    if (m_linkDown && m_nextAnchorUs >= m_reconnectUs)
+      linkReconnect();
+    if (m_linkDown)
+    {
+      if (m_radioNotified)
+      {
+        sim_evt_t evt = { .type = SIM_EVT_RADIO, .timeUs = m_nextAnchorUs, .radioActive = false };
+        pushEvent(&evt);
+        m_radioNotified = false;
+      }
+      m_nextAnchorUs += m_link.connIntervalUs;
+      continue;
+    }
+
+    if (m_connHandle != BLE_CONN_HANDLE_INVALID)
+    {
+      centralSetup();
+      centralIssue();
+    }
+    uint64_t endUs = connectionEvent(m_nextAnchorUs);
+    m_nextAnchorUs += m_link.connIntervalUs;
+
+    if (m_link.radioDistanceUs > 0)
+    {
+      sim_evt_t evt = { .type = SIM_EVT_RADIO, .timeUs = endUs, .radioActive = false };
+      pushEvent(&evt);
+      m_radioNotified = false;
+    }
+  }
+
+  for (uint8_t i = 0; i < m_timerCount; i++)
+  {
+    sim_timer_t *timer = &m_timers[i];
+    while (timer->active && timer->expiryUs <= timeUs)
+    {
+      sim_evt_t evt = { .type = SIM_EVT_TIMER, .timeUs = timer->expiryUs, .timer = i };
+      pushEvent(&evt);
+      if (timer->mode == APP_TIMER_MODE_REPEATED)
+        timer->expiryUs += timer->periodUs;
+      else
+        timer->active = false;
+    }
+  }
+
+  while (m_fstorage.count > 0 && m_fstorage.doneUs <= timeUs)
+    fstorageDone();
+
+  if (timeUs > m_nowUs)
+    m_nowUs = timeUs;
+}
+
+// Firmware side ----------------------------------------------------------
+
+/*!
+ * @brief As main.c's command_urgent_pend(), pending the urgent tier.
+ */
+static void
+urgentPend()
+{
+  // Latency counts from when the write arrived, not when it was handled
+  if (!m_urgentPending)
+    m_urgentPendUs = m_eventUs;
+  m_urgentPending = true;
+}
+
+/*!
+ * @brief As main.c's SWI3_EGU3_IRQHandler(), run once the handler that
+ * pended it returns.
+ */
+static void
+urgentRun()
+{
+  if (!m_urgentPending)
+    return;
+  m_urgentPending = false;
+
+  uint64_t latency = m_nowUs - m_urgentPendUs;
+  m_stats.urgentSumUs += latency;
+  if (m_stats.urgentRuns == 0 || latency < m_stats.urgentMinUs)
+    m_stats.urgentMinUs = latency;
+  if (latency > m_stats.urgentMaxUs)
+    m_stats.urgentMaxUs = latency;
+  m_stats.urgentRuns++;
+  if (m_inThread)
+    m_stats.urgentPreemptions++;
+
+  if (m_verbose)
+    printf("%10.3f ms  urgent tier run%s, latency %.3f ms\n", m_nowUs / 1000.0,
+        m_inThread ? " preempting thread tier" : "", latency / 1000.0);
+
+  m_inHandler = true;
+  commandUrgentRun();
+  m_inHandler = false;
+}
+
+static void
+cmdDataHandler(ble_cmd_evt_t * p_evt)
+{
+  // As main.c's cmd_data_handler()
+  if (p_evt->type == BLE_CMD_EVT_RX_DATA)
+  {
+    receiveRawCommand(p_evt->params.rx_data.p_data, p_evt->params.rx_data.length);
+
+    if (validCommandReceived())
+      executeCommand();
+  }
+  else if (p_evt->type == BLE_CMD_EVT_TX_RDY)
+  {
+    commandTxReady();
+  }
+  else if (p_evt->type == BLE_CMD_EVT_COMM_STARTED)
+  {
+    commandCommStarted();
+  }
+  else if (p_evt->type == BLE_CMD_EVT_COMM_STOPPED)
+  {
+    commandCommPaused();
+  }
+}
+
+static void
+dispatch(sim_evt_t const *evt)
+{
+  static uint8_t buffer[sizeof(ble_evt_t) + MAX_ATT_PAYLOAD];
+  ble_evt_t *p_ble_evt = (ble_evt_t *) buffer;
+
+  if (evt->timeUs > m_nowUs)
+    m_nowUs = evt->timeUs;
+  m_eventUs = evt->timeUs;
+
+  memset(buffer, 0, sizeof(buffer));
+  m_inHandler = true;
+
+  switch (evt->type)
+  {
+    case SIM_EVT_CONNECTED:
+      m_connHandle = CONN_HANDLE;
+      p_ble_evt->header.evt_id = BLE_GAP_EVT_CONNECTED;
+      p_ble_evt->evt.gap_evt.conn_handle = CONN_HANDLE;
+      ble_cmd_on_ble_evt(p_ble_evt, m_cmd);
+    break;
+    case SIM_EVT_DISCONNECTED:
+      // As main.c's BLE_GAP_EVT_DISCONNECTED handling; the next link's
+      // context starts with notifications off
+      m_connHandle = BLE_CONN_HANDLE_INVALID;
+      memset(m_linkContext, 0, sizeof(m_linkContext));
+      commandCommStopped();
+      setCurrentCommand(NO_COMMAND);
+    break;
+    case SIM_EVT_WRITE:
+      p_ble_evt->header.evt_id = BLE_GATTS_EVT_WRITE;
+      p_ble_evt->evt.gatts_evt.conn_handle = CONN_HANDLE;
+      p_ble_evt->evt.gatts_evt.params.write.handle = evt->handle;
+      p_ble_evt->evt.gatts_evt.params.write.len = evt->length;
+      memcpy(p_ble_evt->evt.gatts_evt.params.write.data, evt->data, evt->length);
+      ble_cmd_on_ble_evt(p_ble_evt, m_cmd);
+    break;
+    case SIM_EVT_HVN_TX_COMPLETE:
+      p_ble_evt->header.evt_id = BLE_GATTS_EVT_HVN_TX_COMPLETE;
+      p_ble_evt->evt.gatts_evt.conn_handle = CONN_HANDLE;
+      p_ble_evt->evt.gatts_evt.params.hvn_tx_complete.count = 1;
+      ble_cmd_on_ble_evt(p_ble_evt, m_cmd);
+    break;
+    case SIM_EVT_TIMER:
+      m_timers[evt->timer].handler(m_timers[evt->timer].context);
+    break;
+    case SIM_EVT_RADIO:
+      // As main.c's radio notification handler
+      commandRadioNotification(evt->radioActive);
+    break;
+    case SIM_EVT_FLASH:
+      // As FDS's SoC event handler
+      m_flash.handler(&evt->flash);
+    break;
+    case SIM_EVT_FSTORAGE:
+    {
+      // As fstorage's SoC event handler
+      nrf_fstorage_evt_t fstorageEvt = evt->fstorage;
+      evt->fstorageHandler(&fstorageEvt);
+    }
+    break;
+  }
+
+  m_inHandler = false;
+  urgentRun();
+}
+
+/*!
+ * @brief Handle the next waiting event.
+ *
+ * @return false if no event was waiting
+ */
+static bool
+dispatchNext()
+{
+  if (m_eventCount == 0)
+    return false;
+
+  sim_evt_t evt = m_events[m_eventHead];
+  m_eventHead = (m_eventHead + 1) % EVENT_QUEUE_SIZE;
+  m_eventCount--;
+  dispatch(&evt);
+  return true;
+}
+
+/*!
+ * @brief Let events and the urgent tier preempt the thread tier, if it can
+ * be preempted here.
+ */
+static void
+preempt()
+{
+  if (m_inHandler || m_criticalDepth > 0)
+    return;
+
+  while (dispatchNext())
+    ;
+  urgentRun();
+}
+
+// SoftDevice and SDK stand-ins ----------------------------------------------
+
+uint32_t
+sd_ble_uuid_vs_add(ble_uuid128_t const * p_vs_uuid, uint8_t * p_uuid_type)
+{
+  // ble_cmd_init() hands us the address of its instance's uuid_type
+  m_cmd = (ble_cmd_t *) ((uint8_t *) p_uuid_type - offsetof(ble_cmd_t, uuid_type));
+  *p_uuid_type = BLE_UUID_TYPE_VENDOR_BEGIN;
+  return NRF_SUCCESS;
+}
+
+uint32_t
+sd_ble_gatts_service_add(uint8_t type, ble_uuid_t const * p_uuid, uint16_t * p_handle)
+{
+  *p_handle = m_nextHandle++;
+  return NRF_SUCCESS;
+}
+
+uint32_t
+characteristic_add(uint16_t                   service_handle,
+                   ble_add_char_params_t    * p_char_props,
+                   ble_gatts_char_handles_t * p_char_handle)
+{
+  memset(p_char_handle, 0, sizeof(ble_gatts_char_handles_t));
+  p_char_handle->value_handle = m_nextHandle++;
+  p_char_handle->cccd_handle = m_nextHandle++;
+
+  if (p_char_props->uuid == INVOKE_CHARACTERISTIC_UUID)
+    m_rxHandle = p_char_handle->value_handle;
+  else if (p_char_props->uuid == RESPONSE_CHARACTERISTIC_UUID)
+    m_txCccdHandle = p_char_handle->cccd_handle;
+
+  return NRF_SUCCESS;
+}
+
+uint32_t
+sd_ble_gatts_value_get(uint16_t conn_handle, uint16_t handle, ble_gatts_value_t * p_value)
+{
+  memset(p_value->p_value, 0, p_value->len);
+
+  // A bonded central's CCCD is restored when it connects
+  if (m_link.bonded && handle == m_txCccdHandle && p_value->len >= 1)
+    p_value->p_value[0] = 0x01;
+  return NRF_SUCCESS;
+}
+
+uint32_t
+sd_ble_gatts_hvx(uint16_t conn_handle, ble_gatts_hvx_params_t const * p_hvx_params)
+{
+  // Let the radio run while the firmware spends CPU time on the call
+  runUntil(m_nowUs + HVX_CALL_US);
+  preempt();
+
+  if (conn_handle != m_connHandle)
+    return BLE_ERROR_INVALID_CONN_HANDLE;
+
+  if (*p_hvx_params->p_len > m_link.attMtu - 3)
+    return NRF_ERROR_DATA_SIZE;
+
+  if (m_hvnCount == m_link.hvnQueueSize)
+  {
+    m_stats.hvxRefused++;
+    return NRF_ERROR_RESOURCES;
+  }
+
+  pdu_t *pdu = &m_hvnQueue[(m_hvnHead + m_hvnCount) % m_link.hvnQueueSize];
+  memcpy(pdu->data, p_hvx_params->p_data, *p_hvx_params->p_len);
+  pdu->length = *p_hvx_params->p_len;
+  pdu->bytesLeft = pdu->length + L2CAP_ATT_OVERHEAD;
+  m_hvnCount++;
+
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+blcm_link_ctx_get(blcm_link_ctx_storage_t const * const p_link_ctx_storage,
+                  uint16_t                        const conn_handle,
+                  void                         ** const pp_ctx_data)
+{
+  if (conn_handle != m_connHandle)
+    return NRF_ERROR_NOT_FOUND;
+
+  *pp_ctx_data = m_linkContext;
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+app_timer_create(app_timer_id_t const * p_timer_id,
+                 app_timer_mode_t       mode,
+                 app_timer_timeout_handler_t timeout_handler)
+{
+  if (m_timerCount == MAX_TIMERS)
+    return NRF_ERROR_NO_MEM;
+
+  sim_timer_t *timer = &m_timers[m_timerCount++];
+  timer->id = *p_timer_id;
+  timer->handler = timeout_handler;
+  timer->mode = mode;
+  timer->active = false;
+  return NRF_SUCCESS;
+}
+
+static sim_timer_t *
+findTimer(app_timer_id_t timer_id)
+{
+  for (uint8_t i = 0; i < m_timerCount; i++)
+    if (m_timers[i].id == timer_id)
+      return &m_timers[i];
+  return NULL;
+}
+
+ret_code_t
+app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context)
+{
+  sim_timer_t *timer = findTimer(timer_id);
+  if (timer == NULL)
+    return NRF_ERROR_INVALID_PARAM;
+
+  timer->periodUs = (uint32_t) (((uint64_t) timeout_ticks * 1000000) / APP_TIMER_CLOCK_FREQ);
+  timer->expiryUs = m_nowUs + timer->periodUs;
+  timer->context = p_context;
+  timer->active = true;
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+app_timer_stop(app_timer_id_t timer_id)
+{
+  sim_timer_t *timer = findTimer(timer_id);
+  if (timer == NULL)
+    return NRF_ERROR_INVALID_PARAM;
+
+  timer->active = false;
+  return NRF_SUCCESS;
+}
+
+uint32_t
+app_timer_cnt_get(void)
+{
+  return (uint32_t) ((m_nowUs * APP_TIMER_CLOCK_FREQ) / 1000000) & 0xFFFFFF;
+}
+
+uint32_t
+app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from)
+{
+  return (ticks_to - ticks_from) & 0xFFFFFF;
+}
+
+void
+app_util_critical_region_enter(uint8_t *p_nested)
+{
+  m_criticalDepth++;
+}
+
+void
+app_util_critical_region_exit(uint8_t nested)
+{
+  // Interrupts held off by the region are taken as it ends
+  if (--m_criticalDepth == 0)
+    preempt();
+}
+
+void
+app_error_handler_bare(ret_code_t error_code)
+{
+  fprintf(stderr, "linkSim: firmware error 0x%x\n", (unsigned) error_code);
+  exit(EXIT_FAILURE);
+}
+
+uint32_t
+sd_app_evt_wait(void)
+{
+  // Sleep until the next connection event or timer
+  runUntil(nextWakeUs());
+  preempt();
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+fds_register(fds_cb_t cb)
+{
+  m_flash.handler = cb;
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+fds_init(void)
+{
+  // As when FDS is up already
+  fds_evt_t evt = { .id = FDS_EVT_INIT, .result = NRF_SUCCESS };
+  m_flash.handler(&evt);
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+fds_record_find(uint16_t file_id, uint16_t record_key, fds_record_desc_t * p_desc,
+                fds_find_token_t * p_token)
+{
+  if (!m_flash.written || file_id != m_flash.fileId || record_key != m_flash.key)
+    return FDS_ERR_NOT_FOUND;
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+fds_record_open(fds_record_desc_t * p_desc, fds_flash_record_t * p_flash_record)
+{
+  p_flash_record->p_header = &m_flash.header;
+  p_flash_record->p_data = m_flash.data;
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+fds_record_close(fds_record_desc_t * p_desc)
+{
+  return NRF_SUCCESS;
+}
+
+static ret_code_t
+flashWrite(fds_record_t const * p_record, fds_evt_id_t id)
+{
+  uint32_t words = p_record->data.length_words;
+
+  if (words > PARAM_COUNT)
+    return FDS_ERR_NO_SPACE_IN_FLASH;
+  memcpy(m_flash.data, p_record->data.p_data, words * sizeof(uint32_t));
+  m_flash.fileId = p_record->file_id;
+  m_flash.key = p_record->key;
+  m_flash.header.length_words = (uint16_t) words;
+  m_flash.written = true;
+
+  sim_evt_t evt = { .type = SIM_EVT_FLASH, .timeUs = m_nowUs };
+  evt.flash.id = id;
+  evt.flash.result = NRF_SUCCESS;
+  evt.flash.write.file_id = p_record->file_id;
+  evt.flash.write.record_key = p_record->key;
+  pushEvent(&evt);
+  return NRF_SUCCESS;
+}
+
+ret_code_t
+fds_record_write(fds_record_desc_t * p_desc, fds_record_t const * p_record)
+{
+  return flashWrite(p_record, FDS_EVT_WRITE);
+}
+
+ret_code_t
+fds_record_update(fds_record_desc_t * p_desc, fds_record_t const * p_record)
+{
+  return flashWrite(p_record, FDS_EVT_UPDATE);
+}
+
+ret_code_t
+fds_gc(void)
+{
+  return NRF_SUCCESS;
+}
+
+nrf_fstorage_api_t nrf_fstorage_sd;
+
+static nrf_fstorage_info_t const m_fstorageInfo =
+{
+  .erase_unit   = FLASH_PAGE_SIZE,
+  .program_unit = sizeof(uint32_t),
+  .rmap         = true,
+  .wmap         = false
+};
+
+ret_code_t
+nrf_fstorage_init(nrf_fstorage_t * p_fs, nrf_fstorage_api_t * p_api, void * p_param)
+{
+  if (p_fs->start_addr < UPLOAD_START_ADDR || p_fs->end_addr > JOURNAL_END_ADDR ||
+      p_fs->start_addr >= p_fs->end_addr)
+    return NRF_ERROR_INVALID_PARAM;
+  p_fs->p_api = p_api;
+  p_fs->p_flash_info = &m_fstorageInfo;
+  memset(&m_fstorage.data[p_fs->start_addr - UPLOAD_START_ADDR], 0xFF, p_fs->end_addr - p_fs->start_addr);
+  return NRF_SUCCESS;
+}
+
+static bool
+fstorageInRange(nrf_fstorage_t const * p_fs, uint32_t addr, uint32_t len)
+{
+  return addr >= p_fs->start_addr && addr + len <= p_fs->end_addr;
+}
+
+ret_code_t
+nrf_fstorage_read(nrf_fstorage_t const * p_fs, uint32_t addr, void * p_dest, uint32_t len)
+{
+  if (!fstorageInRange(p_fs, addr, len))
+    return NRF_ERROR_INVALID_ADDR;
+  memcpy(p_dest, &m_fstorage.data[addr - UPLOAD_START_ADDR], len);
+  return NRF_SUCCESS;
+}
+
+/*!
+ * @brief Queue a flash operation taking durationUs.
+ */
+static ret_code_t
+fstorageQueue(nrf_fstorage_t const * p_fs, nrf_fstorage_evt_id_t id, uint32_t addr,
+              void const * p_src, uint32_t len, void * p_param, uint64_t durationUs)
+{
+  if (m_fstorage.count == FSTORAGE_QUEUE_SIZE)
+    return NRF_ERROR_NO_MEM;
+
+  sim_flash_op_t *op = &m_fstorage.ops[(m_fstorage.head + m_fstorage.count) % FSTORAGE_QUEUE_SIZE];
+  op->handler = p_fs->evt_handler;
+  op->evt = (nrf_fstorage_evt_t) { .id = id, .result = NRF_SUCCESS, .addr = addr,
+                                   .p_src = p_src, .len = len, .p_param = p_param };
+  op->durationUs = durationUs;
+  if (m_fstorage.count == 0)
+    m_fstorage.doneUs = m_nowUs + durationUs;
+  m_fstorage.count++;
+  return NRF_SUCCESS;
+}
+
+/*!
+ * @brief End the flash operation at the head of the queue.
+ */
+static void
+fstorageDone()
+{
+  sim_flash_op_t *op = &m_fstorage.ops[m_fstorage.head];
+  uint8_t *flash = &m_fstorage.data[op->evt.addr - UPLOAD_START_ADDR];
+
+  if (op->evt.id == NRF_FSTORAGE_EVT_WRITE_RESULT)
+  {
+    // Programming only clears bits
+    uint8_t const *src = op->evt.p_src;
+    for (uint32_t i = 0; i < op->evt.len; i++)
+      flash[i] &= src[i];
+    m_fstorage.writes++;
+  }
+  else
+  {
+    memset(flash, 0xFF, op->evt.len * FLASH_PAGE_SIZE);
+    m_fstorage.erases++;
+  }
+
+  sim_evt_t evt = { .type = SIM_EVT_FSTORAGE, .timeUs = m_fstorage.doneUs, .fstorage = op->evt,
+                    .fstorageHandler = op->handler };
+  pushEvent(&evt);
+
+  m_fstorage.head = (m_fstorage.head + 1) % FSTORAGE_QUEUE_SIZE;
+  m_fstorage.count--;
+  if (m_fstorage.count > 0)
+    m_fstorage.doneUs += m_fstorage.ops[m_fstorage.head].durationUs;
+}
+
+ret_code_t
+nrf_fstorage_write(nrf_fstorage_t const * p_fs, uint32_t dest, void const * p_src, uint32_t len,
+                   void * p_param)
+{
+  if (!fstorageInRange(p_fs, dest, len) || len % sizeof(uint32_t) != 0)
+    return NRF_ERROR_INVALID_ADDR;
+  return fstorageQueue(p_fs, NRF_FSTORAGE_EVT_WRITE_RESULT, dest, p_src, len, p_param,
+                       (uint64_t) len / sizeof(uint32_t) * FLASH_WORD_US);
+}
+
+ret_code_t
+nrf_fstorage_erase(nrf_fstorage_t const * p_fs, uint32_t page_addr, uint32_t len, void * p_param)
+{
+  if (page_addr % FLASH_PAGE_SIZE != 0 || !fstorageInRange(p_fs, page_addr, len * FLASH_PAGE_SIZE))
+    return NRF_ERROR_INVALID_ADDR;
+  return fstorageQueue(p_fs, NRF_FSTORAGE_EVT_ERASE_RESULT, page_addr, NULL, len, p_param,
+                       (uint64_t) len * FLASH_ERASE_US);
+}
+
+// Advertising ------------------------------------------------------------
+
+/*!
+ * @brief The advertising phase running at a time after the disconnect.
+ *
+ * @param[out] intervalUs - the interval, without advDelay
+ * @param[out] endUs      - when the phase times out, or UINT64_MAX
+ * @return true if the phase is high duty directed
+ */
+static bool
+advPhaseAt(uint64_t timeUs, uint32_t *intervalUs, uint64_t *endUs)
+{
+  uint64_t startUs = 0;
+
+  switch (m_adv.profile)
+  {
+    case ADV_PROFILE_FIXED:
+      *intervalUs = ADV_FIXED_INTERVAL_US;
+      *endUs = UINT64_MAX;
+      return false;
+    case ADV_PROFILE_DIRECTED:
+      if (timeUs < ADV_DIRECTED_DURATION_US)
+      {
+        *intervalUs = ADV_DIRECTED_INTERVAL_US;
+        *endUs = ADV_DIRECTED_DURATION_US;
+        return true;
+      }
+      startUs = ADV_DIRECTED_DURATION_US;
+      // fall through
+    default:
+      if (timeUs < startUs + ADV_FAST_DURATION_US)
+      {
+        *intervalUs = ADV_FAST_INTERVAL_US;
+        *endUs = startUs + ADV_FAST_DURATION_US;
+      }
+      else
+      {
+        *intervalUs = ADV_SLOW_INTERVAL_US;
+        *endUs = UINT64_MAX;
+      }
+      return false;
+  }
+}
+
+/*!
+ * @brief The charge of one advertising event, in uC.
+ *
+ * @details A high duty directed phase keeps the HFXO running, so its events
+ * carry no start overhead.
+ */
+static double
+advEventChargeUc(bool directed)
+{
+  uint32_t txUs = airTimeUs(directed ? ADV_DIRECT_IND_PAYLOAD : ADV_IND_PAYLOAD);
+  double pduUc = ((RADIO_RAMP_US + RADIO_LISTEN_US) * RADIO_RX_MA + txUs * RADIO_TX_MA) / 1000;
+
+  return 3 * pduUc + (directed ? 0 : ADV_EVENT_OVERHEAD_UC);
+}
+
+/*!
+ * @brief The average current of an advertising phase, in uA.
+ */
+static double
+advPhaseCurrentUa(bool directed, uint32_t intervalUs)
+{
+  double periodUs = intervalUs + (directed ? 0 : ADV_DELAY_MAX_US / 2.0);
+  return advEventChargeUc(directed) / periodUs * 1e6 + SLEEP_UA;
+}
+
+/*!
+ * @brief The average current over a span after the disconnect with no
+ * central around, in uA.
+ */
+static double
+advMeanCurrentUa(uint64_t fromUs, uint64_t toUs)
+{
+  double chargeUc = 0;
+  uint64_t t = fromUs;
+
+  while (t < toUs)
+  {
+    uint32_t intervalUs;
+    uint64_t endUs;
+    bool directed = advPhaseAt(t, &intervalUs, &endUs);
+
+    if (endUs > toUs)
+      endUs = toUs;
+    chargeUc += advPhaseCurrentUa(directed, intervalUs) * (endUs - t) / 1e6;
+    t = endUs;
+  }
+  return chargeUc / ((toUs - fromUs) / 1e6);
+}
+
+/*!
+ * @brief Whether the central's scanner hears a PDU.
+ *
+ * @param rel     - when the PDU starts, from the start of a scan window on
+ *                  the central's first channel
+ * @param channel - 0, 1 or 2 for channel 37, 38 or 39
+ */
+static bool
+advHeard(uint64_t rel, uint8_t channel, uint32_t airUs)
+{
+  uint64_t window = rel / m_adv.scanIntervalUs;
+
+  return window % 3 == channel &&
+      rel % m_adv.scanIntervalUs + airUs <= m_adv.scanWindowUs &&
+      !packetLost();
+}
+
+/*!
+ * @brief Advertise until the central connects.
+ *
+ * @details The central has been scanning for a while when it starts looking,
+ * so its scan cycle is at a random point. A central that comes back later
+ * does so at a random point within a slow advertising interval, as it has
+ * no reason to keep in step with the advertising.
+ *
+ * @return the time from the central starting to look to its connect request
+ */
+static uint64_t
+advReconnectUs()
+{
+  uint64_t scanPhaseUs = nextRandom() % (3 * m_adv.scanIntervalUs);
+  uint64_t centralUs = m_adv.centralDelayUs;
+  uint64_t t = 0;
+
+  if (centralUs > 0)
+    centralUs += nextRandom() % ADV_SLOW_INTERVAL_US;
+
+  while (t < centralUs + ADV_GIVE_UP_US)
+  {
+    uint32_t intervalUs;
+    uint64_t endUs;
+    bool directed = advPhaseAt(t, &intervalUs, &endUs);
+    uint32_t airUs = airTimeUs(directed ? ADV_DIRECT_IND_PAYLOAD : ADV_IND_PAYLOAD);
+    uint32_t spacingUs = directed ? ADV_DIRECTED_INTERVAL_US / 3 : ADV_CHANNEL_SPACING_US;
+
+    for (uint8_t channel = 0; channel < 3; channel++)
+    {
+      uint64_t pduUs = t + channel * spacingUs;
+      if (pduUs >= centralUs && advHeard(pduUs - centralUs + scanPhaseUs, channel, airUs))
+        return pduUs + airUs - centralUs;
+    }
+
+    t += intervalUs + (directed ? 0 : nextRandom() % (ADV_DELAY_MAX_US + 1));
+    // A new phase starts as soon as the last one times out
+    if (t > endUs)
+      t = endUs;
+  }
+  return UINT64_MAX;
+}
+
+static int
+advertisingRun()
+{
+  static char const * const names[] = { "", "fixed", "adaptive", "directed" };
+  uint64_t sumUs = 0, minUs = UINT64_MAX, maxUs = 0;
+  uint32_t found = 0;
+
+  for (uint32_t trial = 0; trial < m_workload.count; trial++)
+  {
+    uint64_t us = advReconnectUs();
+    if (us == UINT64_MAX)
+      continue;
+    found++;
+    sumUs += us;
+    if (us < minUs)
+      minUs = us;
+    if (us > maxUs)
+      maxUs = us;
+    if (m_verbose)
+      printf("%10.3f ms  trial %u reconnected\n", us / 1000.0, trial);
+  }
+
+  printf("advertising: profile %s; central scanning %.1f of every %.1f ms from %.3f s after the disconnect, loss %.3f\n",
+      names[m_adv.profile], m_adv.scanWindowUs / 1000.0, m_adv.scanIntervalUs / 1000.0,
+      m_adv.centralDelayUs / 1e6, m_link.lossRate);
+  if (found > 0)
+    printf("reconnect:   %u of %u trials; min %.3f ms, mean %.3f ms, max %.3f ms\n",
+        found, m_workload.count, minUs / 1000.0, sumUs / 1000.0 / found, maxUs / 1000.0);
+  else
+    printf("reconnect:   none of %u trials\n", m_workload.count);
+  printf("current:     directed %.1f uA, fast %.1f uA, slow %.1f uA, fixed %.1f uA per phase\n",
+      advPhaseCurrentUa(true, ADV_DIRECTED_INTERVAL_US),
+      advPhaseCurrentUa(false, ADV_FAST_INTERVAL_US),
+      advPhaseCurrentUa(false, ADV_SLOW_INTERVAL_US),
+      advPhaseCurrentUa(false, ADV_FIXED_INTERVAL_US));
+  printf("             %.1f uA over the first minute with nobody around, %.1f uA over the first hour\n",
+      advMeanCurrentUa(0, 60000000), advMeanCurrentUa(0, 3600000000ULL));
+
+  return found == m_workload.count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Driver -----------------------------------------------------------------
+
+/*!
+ * @brief Load an RX_CAPTURE dump and schedule its writes.
+ *
+ * @details The first write is replayed one connection interval after
+ * notifications are enabled; later writes keep their recorded spacing,
+ * divided by the acceleration. Ticks are the 24 bit RTC counter, so each gap
+ * is taken modulo 2^24.
+ *
+ * @return the number of commands in the capture
+ */
+static uint32_t
+loadCapture(char const *fileName, double acceleration)
+{
+  FILE *file = fopen(fileName, "rb");
+  if (file == NULL)
+  {
+    perror(fileName);
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t capacity = 64;
+  uint32_t commands = 0;
+  uint32_t lastTicks = 0;
+  uint64_t timeUs = m_link.connIntervalUs;
+  uint8_t header[CAPTURE_HEADER_SIZE];
+
+  m_replay = malloc(capacity * sizeof(replay_write_t));
+  while (m_replay != NULL && fread(header, 1, sizeof(header), file) == sizeof(header))
+  {
+    uint32_t ticks = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t) header[3] << 24);
+    uint16_t length = header[4];
+
+    if (m_replayCount == capacity)
+    {
+      capacity *= 2;
+      m_replay = realloc(m_replay, capacity * sizeof(replay_write_t));
+      if (m_replay == NULL)
+        break;
+    }
+
+    replay_write_t *write = &m_replay[m_replayCount];
+    if (length == 0 || fread(write->data, 1, length, file) != length)
+    {
+      fprintf(stderr, "linkSim: %s: truncated record %u\n", fileName, m_replayCount);
+      exit(EXIT_FAILURE);
+    }
+
+    if (m_replayCount > 0)
+      timeUs += (uint64_t) ((((ticks - lastTicks) & RTC_TICKS_MASK) * 1e6 / APP_TIMER_CLOCK_FREQ) / acceleration);
+    lastTicks = ticks;
+    write->timeUs = timeUs;
+    write->length = length;
+    m_replayCount++;
+
+    if (write->data[0] != MORE_ARG_DATA)
+      commands++;
+  }
+  fclose(file);
+
+  if (m_replay == NULL)
+  {
+    fprintf(stderr, "linkSim: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return commands;
+}
+
+static void
+usage()
+{
+  fprintf(stderr,
+      "usage: linkSim [options]\n"
+      "link:\n"
+      "  -i <ms>     connection interval (%.2f)\n"
+      "  -p <n>      packet exchanges per connection event (%u)\n"
+      "  -m <bytes>  ATT MTU (%u)\n"
+      "  -d <bytes>  link layer payload, 27 without DLE (%u)\n"
+      "  -l <p>      packet loss probability (%.3f)\n"
+      "  -q <n>      SoftDevice notification queue length (%u)\n"
+      "  -s <seed>   random seed (%u)\n"
+      "  -R <us>     radio notifications this long before each connection\n"
+      "              event and after it, as COMMAND_RADIO_ALIGN_ENABLED (off)\n"
+      "  -D <n>      service discovery round trips before the central enables\n"
+      "              notifications (%u)\n"
+      "  -K          the central is bonded: it re-encrypts and its CCCD is\n"
+      "              restored, as PEER_MANAGER_ENABLED\n"
+      "workload:\n"
+      "  -c <hex>    command ID (%02X)\n"
+      "  -a <bytes>  argument length (%u)\n"
+      "  -A <text>   argument text, instead of a generated argument\n"
+      "  -n <n>      number of commands (%u)\n"
+      "  -w <n>      commands the central keeps outstanding (%u)\n"
+      "  -r <n>      framed responses per command (%u)\n"
+      "  -f <file>   replay an RX_CAPTURE dump instead of -c, -a, -A and -n\n"
+      "  -x <factor> replay acceleration (%.1f)\n"
+      "  -C          keep to the RX credits the peripheral grants\n"
+      "  -k <ms>     pack short responses, holding each up to <ms>, as\n"
+      "              COALESCE_RESPONSES does (off)\n"
+      "  -B <hex>    run a bulk command in the background, e.g. 0C\n"
+      "  -b <text>   its argument text, or @<bytes> for a generated argument\n"
+      "  -L <ms>     drop the link once, this far in; the central reconnects\n"
+      "              %u ms later and sends again what went unanswered\n"
+      "  -M          on reconnecting, the central resumes the session\n"
+      "  -U <bytes>  upload this many bytes with UPLOAD, in blocks of -a bytes;\n"
+      "              sets -c and -n\n"
+      "  -G          report a start up profile over the first connection\n"
+      "advertising, instead of a workload:\n"
+      "  -P <name>   reconnect under an advertising profile: fixed (40 ms),\n"
+      "              adaptive (20 ms for 30 s, then 1022.5 ms) or directed\n"
+      "              (high duty for 1.28 s, then adaptive); -n sets the trials\n"
+      "  -T <s>      the central starts looking this long after the disconnect (0)\n"
+      "  -S <w>/<i>  the central scans <w> ms of every <i> ms (50/100)\n"
+      "  -v          trace each command\n",
+      m_link.connIntervalUs / 1000.0, m_link.packetsPerEvent, m_link.attMtu,
+      m_link.llPayload, m_link.lossRate, m_link.hvnQueueSize, m_link.seed,
+      m_link.discoveryRoundTrips, m_workload.commandID, m_workload.argLength, m_workload.count,
+      m_workload.window, m_workload.responses, m_workload.acceleration, LINK_GAP_US / 1000);
+  exit(EXIT_FAILURE);
+}
+
+static void
+parseOptions(int argc, char *argv[])
+{
+  int option;
+
+  while ((option = getopt(argc, argv, "i:p:m:d:l:q:s:R:D:Kc:a:A:n:w:r:f:x:k:B:b:L:MU:GP:T:S:Cv")) != -1)
+  {
+    switch (option)
+    {
+      case 'i': m_link.connIntervalUs = (uint32_t) (atof(optarg) * 1000); break;
+      case 'p': m_link.packetsPerEvent = (uint8_t) atoi(optarg); break;
+      case 'm': m_link.attMtu = (uint16_t) atoi(optarg); break;
+      case 'd': m_link.llPayload = (uint16_t) atoi(optarg); break;
+      case 'l': m_link.lossRate = atof(optarg); break;
+      case 'q': m_link.hvnQueueSize = (uint8_t) atoi(optarg); break;
+      case 's': m_link.seed = (uint32_t) strtoul(optarg, NULL, 0); break;
+      case 'R': m_link.radioDistanceUs = (uint32_t) atoi(optarg); break;
+      case 'D': m_link.discoveryRoundTrips = (uint8_t) atoi(optarg); break;
+      case 'K': m_link.bonded = true; break;
+      case 'c': m_workload.commandID = (uint8_t) strtoul(optarg, NULL, 16); break;
+      case 'a': m_workload.argLength = (uint16_t) atoi(optarg); break;
+      case 'A': m_workload.arg = optarg; m_workload.argLength = (uint16_t) strlen(optarg); break;
+      case 'n': m_workload.count = (uint32_t) atoi(optarg); break;
+      case 'w': m_workload.window = (uint8_t) atoi(optarg); break;
+      case 'r': m_workload.responses = (uint8_t) atoi(optarg); break;
+      case 'f': m_workload.captureFile = optarg; break;
+      case 'x': m_workload.acceleration = atof(optarg); break;
+      case 'k': m_workload.coalesceMs = atoi(optarg); break;
+      case 'B':
+        m_workload.background = true;
+        m_workload.bgCommandID = (uint8_t) strtoul(optarg, NULL, 16);
+      break;
+      case 'b':
+        if (optarg[0] == '@')
+          m_workload.bgArgLength = (uint16_t) atoi(optarg + 1);
+        else
+        {
+          m_workload.bgArg = optarg;
+          m_workload.bgArgLength = (uint16_t) strlen(optarg);
+        }
+      break;
+      case 'L': m_workload.dropUs = (uint64_t) (atof(optarg) * 1000); break;
+      case 'M': m_workload.resume = true; break;
+      case 'U': m_workload.uploadBytes = (uint32_t) strtoul(optarg, NULL, 0); break;
+      case 'G': m_workload.bootProfile = true; break;
+      case 'P':
+        if (strcmp(optarg, "fixed") == 0)
+          m_adv.profile = ADV_PROFILE_FIXED;
+        else if (strcmp(optarg, "adaptive") == 0)
+          m_adv.profile = ADV_PROFILE_ADAPTIVE;
+        else if (strcmp(optarg, "directed") == 0)
+          m_adv.profile = ADV_PROFILE_DIRECTED;
+        else
+          usage();
+      break;
+      case 'T': m_adv.centralDelayUs = (uint64_t) (atof(optarg) * 1e6); break;
+      case 'S':
+      {
+        char *slash;
+        m_adv.scanWindowUs = (uint32_t) (strtod(optarg, &slash) * 1000);
+        if (*slash != '/')
+          usage();
+        m_adv.scanIntervalUs = (uint32_t) (atof(slash + 1) * 1000);
+      } break;
+      case 'C': m_workload.credits = true; break;
+      case 'v': m_verbose = true; break;
+      default: usage();
+    }
+  }
+
+  if (m_link.connIntervalUs == 0 || m_link.packetsPerEvent == 0 ||
+      m_link.attMtu < 23 || m_link.attMtu > MAX_ATT_PAYLOAD ||
+      m_link.llPayload < 27 || m_link.llPayload > 251 ||
+      m_link.hvnQueueSize == 0 || m_workload.window == 0 ||
+      m_workload.responses == 0 || m_workload.argLength > 4095 ||
+      m_workload.bgArgLength > 4095 || (m_workload.background && m_workload.captureFile != NULL) ||
+      m_link.lossRate < 0 || m_link.lossRate >= 1 ||
+      m_workload.acceleration <= 0 || m_workload.coalesceMs > UINT8_MAX ||
+      m_adv.scanIntervalUs == 0 || m_adv.scanWindowUs == 0 ||
+      m_adv.scanWindowUs > m_adv.scanIntervalUs ||
+      (m_workload.dropUs > 0 && (m_workload.credits || m_workload.captureFile != NULL)) ||
+      (m_workload.resume && m_workload.background) ||
+      (m_workload.resume && m_workload.dropUs == 0) ||
+      (m_workload.uploadBytes > 0 &&
+       (m_workload.uploadBytes > UPLOAD_END_ADDR - UPLOAD_START_ADDR || m_workload.argLength == 0 ||
+        m_workload.argLength % sizeof(uint32_t) != 0 || m_workload.arg != NULL ||
+        m_workload.background || m_workload.captureFile != NULL)))
+    usage();
+
+  if (m_workload.uploadBytes > 0)
+  {
+    m_workload.commandID = UPLOAD;
+    m_workload.count = 2 + (m_workload.uploadBytes + m_workload.argLength - 1) / m_workload.argLength;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  parseOptions(argc, argv);
+
+  m_random = m_link.seed ? m_link.seed : 1;
+  if (m_adv.profile != ADV_PROFILE_NONE)
+    return advertisingRun();
+  if (m_workload.captureFile != NULL)
+    m_workload.count = loadCapture(m_workload.captureFile, m_workload.acceleration);
+  if (m_workload.uploadBytes > 0)
+  {
+    m_uploadImage = malloc(m_workload.uploadBytes);
+    if (m_uploadImage == NULL)
+      return EXIT_FAILURE;
+    for (uint32_t i = 0; i < m_workload.uploadBytes; i++)
+      m_uploadImage[i] = (uint8_t) (i * 31 + (i >> 8));
+    m_uploadCrc = crc32_compute(m_uploadImage, m_workload.uploadBytes, NULL);
+  }
+  m_uplink.pdus = calloc(UPLINK_QUEUE_SIZE, sizeof(pdu_t));
+  m_bgUplink.pdus = calloc(UPLINK_QUEUE_SIZE, sizeof(pdu_t));
+  m_events = calloc(EVENT_QUEUE_SIZE, sizeof(sim_evt_t));
+  m_issueUs = calloc(m_workload.count ? m_workload.count : 1, sizeof(uint64_t));
+  m_deliverEvent = calloc(m_workload.count ? m_workload.count : 1, sizeof(uint64_t));
+  m_responsesOf = calloc(m_workload.count ? m_workload.count : 1, sizeof(uint8_t));
+  m_awaiting = calloc(m_workload.count ? m_workload.count : 1, sizeof(uint32_t));
+  m_requestOf = calloc(m_workload.count ? m_workload.count : 1, sizeof(uint16_t));
+  m_unanswered = calloc(m_workload.count ? m_workload.count : 1, sizeof(bool));
+  if (m_uplink.pdus == NULL || m_bgUplink.pdus == NULL || m_events == NULL ||
+      m_issueUs == NULL || m_deliverEvent == NULL || m_responsesOf == NULL ||
+      m_awaiting == NULL || m_requestOf == NULL || m_unanswered == NULL)
+    return EXIT_FAILURE;
+  m_carriedTarget = -1;
+
+  // As main.c's services_init(), with the parameters loaded beforehand
+  paramInit(NULL);
+#if COMMAND_JOURNAL_ENABLED
+  journalInit(JOURNAL_START_ADDR, JOURNAL_END_ADDR, false, 0);
+#endif
+#if COMMAND_UPLOAD_ENABLED
+  uploadInit(UPLOAD_START_ADDR, UPLOAD_END_ADDR);
+#endif
+  commandInit(urgentPend);
+  if (m_workload.bootProfile)
+    commandBootProfile(m_bootStageUs);
+  if (m_workload.coalesceMs >= 0)
+    responseCoalesce(true, (uint16_t) m_workload.coalesceMs);
+  if (ble_cmd_init(cmdDataHandler, &m_connHandle) != NRF_SUCCESS || m_cmd == NULL)
+  {
+    fprintf(stderr, "linkSim: command service initialization failed\n");
+    return EXIT_FAILURE;
+  }
+
+  centralConnect(0);
+  m_nextAnchorUs = m_link.connIntervalUs;
+
+  while (m_completed < m_workload.count || (m_workload.background && !m_bgDone))
+  {
+    if (dispatchNext())
+      continue;
+
+    // As main.c's main loop
+    m_inThread = true;
+    commandThreadRun();
+    m_inThread = false;
+    if (m_eventCount > 0)
+      continue;
+
+    if (m_connHandle != BLE_CONN_HANDLE_INVALID)
+      centralIssue();
+
+    if (m_stats.connectionEvents - m_lastProgressEvent > STALL_EVENTS)
+    {
+      fprintf(stderr, "linkSim: stalled after %u of %u commands%s; responses lost?\n",
+          m_completed, m_workload.count, backgroundPending() ? ", background pending" : "");
+      break;
+    }
+
+    runUntil(nextWakeUs());
+  }
+
+  double seconds = m_nowUs / 1e6;
+  printf("link:     interval %.2f ms, %u exchanges/event, MTU %u, LL payload %u, loss %.3f, HVN queue %u\n",
+      m_link.connIntervalUs / 1000.0, m_link.packetsPerEvent, m_link.attMtu,
+      m_link.llPayload, m_link.lossRate, m_link.hvnQueueSize);
+  if (m_link.radioDistanceUs > 0)
+    printf("radio:    notifications %u us before each connection event\n", m_link.radioDistanceUs);
+  if (m_link.bonded || m_link.discoveryRoundTrips > 0)
+  {
+    if (m_link.bonded)
+      printf("connect:  bonded central, %u encryption round trips, CCCD restored", ENCRYPTION_EVENTS);
+    else
+      printf("connect:  new central, %u discovery round trips, then CCCD write", m_link.discoveryRoundTrips);
+    if (m_firstResponse)
+      printf("; first response %.3f ms after connecting\n", m_firstResponseUs / 1000.0);
+    else
+      printf("; no response\n");
+  }
+  if (m_replay != NULL)
+    printf("workload: replay %s, %u writes, %u commands, acceleration %.1f\n",
+        m_workload.captureFile, m_replayCount, m_workload.count, m_workload.acceleration);
+  else
+    printf("workload: command 0x%02X, arg %u bytes, %u commands, window %u\n",
+        m_workload.commandID, m_workload.argLength, m_workload.count, m_workload.window);
+  if (m_workload.uploadBytes > 0)
+    printf("upload:   %u bytes in %u blocks, %.2f kbit/s; flash %s\n",
+        m_workload.uploadBytes, m_workload.count - 2,
+        seconds > 0 ? m_workload.uploadBytes * 8 / seconds / 1000 : 0,
+        memcmp(m_fstorage.data, m_uploadImage, m_workload.uploadBytes) == 0 ? "matches" : "differs");
+  if (m_workload.background)
+  {
+    printf("background: command 0x%02X, arg %u bytes, ",
+        m_workload.bgCommandID, m_workload.bgArgLength);
+    if (m_bgDone)
+      printf("done in %.3f ms\n", (m_bgDoneUs - m_bgIssueUs) / 1000.0);
+    else
+      printf("not done\n");
+  }
+  printf("time:     %.3f s, %llu connection events\n",
+      seconds, (unsigned long long) m_stats.connectionEvents);
+  printf("commands: %u completed, %.1f per second\n",
+      m_completed, seconds > 0 ? m_completed / seconds : 0);
+  printf("downlink: %llu notifications, %llu bytes, %.2f kbit/s\n",
+      (unsigned long long) m_stats.notifications,
+      (unsigned long long) m_stats.notificationBytes,
+      seconds > 0 ? m_stats.notificationBytes * 8 / seconds / 1000 : 0);
+  printf("uplink:   %llu writes, %llu credit grants\n",
+      (unsigned long long) m_stats.writes, (unsigned long long) m_stats.creditGrants);
+  printf("packets:  %llu sent, %llu lost; %llu hvx refused (queue full)\n",
+      (unsigned long long) m_stats.packetsSent,
+      (unsigned long long) m_stats.packetsLost,
+      (unsigned long long) m_stats.hvxRefused);
+  if (m_completed > 0)
+    printf("latency:  min %.3f ms, mean %.3f ms, max %.3f ms\n",
+        m_stats.latencyMinUs / 1000.0,
+        m_stats.latencySumUs / 1000.0 / m_completed,
+        m_stats.latencyMaxUs / 1000.0);
+  if (m_stats.nextEvent + m_stats.pushedOut > 0)
+    printf("events:   %llu first responses in the next connection event, %llu pushed out, mean %.2f max %llu events late\n",
+        (unsigned long long) m_stats.nextEvent,
+        (unsigned long long) m_stats.pushedOut,
+        m_stats.pushedOut ? (double) m_stats.eventsLateSum / m_stats.pushedOut : 0.0,
+        (unsigned long long) m_stats.eventsLateMax);
+  command_status_record_t status = commandStatusRecord();
+  printf("status:   command 0x%02X, errors 0x%02X, %u changes\n",
+      status.command, status.errors, status.changes);
+  if (m_workload.dropUs > 0)
+    printf("session:  link dropped at %.3f s for %.3f s; %s, %llu carried responses, %llu commands sent again\n",
+        m_stats.droppedUs / 1e6, LINK_GAP_US / 1e6,
+        m_stats.resumed ? "resumed" : "new session",
+        (unsigned long long) m_stats.carriedResponses,
+        (unsigned long long) m_stats.sentAgain);
+  if (m_stats.eventNotices > 0)
+    printf("notices:  %llu event notices, %llu bytes\n",
+        (unsigned long long) m_stats.eventNotices,
+        (unsigned long long) m_stats.eventNoticeBytes);
+  if (m_workload.bootProfile)
+    printf("boot:     %llu stages of %u in %llu notices, %llu differing\n",
+        (unsigned long long) m_stats.bootStages, (unsigned) BOOT_STAGES,
+        (unsigned long long) m_stats.bootNotices,
+        (unsigned long long) m_stats.bootMismatches);
+  if (m_stats.urgentRuns > 0)
+    printf("urgent:   %llu runs, %llu preempting the thread tier; latency min %.3f ms, mean %.3f ms, max %.3f ms\n",
+        (unsigned long long) m_stats.urgentRuns,
+        (unsigned long long) m_stats.urgentPreemptions,
+        m_stats.urgentMinUs / 1000.0,
+        m_stats.urgentSumUs / 1000.0 / m_stats.urgentRuns,
+        m_stats.urgentMaxUs / 1000.0);
+#if COMMAND_JOURNAL_ENABLED
+  printf("journal:  %u entries, %u dropped; %u flash writes, %u page erases\n",
+      journalNext(), journalDropped(), m_fstorage.writes, m_fstorage.erases);
+#endif
+
+  return m_completed == m_workload.count && (!m_workload.background || m_bgDone) ?
+      EXIT_SUCCESS : EXIT_FAILURE;
+}
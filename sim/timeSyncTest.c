@@ -0,0 +1,182 @@
+/*!
+ * @file timeSyncTest.c
+ * @author Simple Command contributors
+ * @date 2026-10-18
+ * @brief Host test of the time sync estimator against a simulated clock
+ *
+ * This file is part of the Simple BLE Commander example.
+ *
+ * Each case runs a device clock with a known skew and offset against the
+ * host clock. It feeds the estimator TIME_SYNC exchanges whose uplink and
+ * downlink delays differ, jittered by up to a connection interval. The host
+ * corrects for the uplink delay as an NTP central would, with half the least
+ * round trip, so the difference between the two least delays goes unseen.
+ * Each case then checks the skew estimate, and the error of timeSyncToHost()
+ * from the last sample through the next epoch.
+ *
+ * The bounds follow from the jitter. The least of n delays spread evenly over
+ * the jitter deviates by about jitter / (n + 1), so that is the noise on each
+ * epoch minimum. A least squares fit over the window then gives the skew to
+ * within that noise over the window's span. Both are allowed four standard
+ * deviations. The time error also allows the half difference in least delays
+ * that the central cannot see, and the skew error run out over an epoch.
+ *
+ * Copyright (C) 2026 by Simple Command contributors
+ *
+ * This software may be modified and distributed under the terms of the
+ * MIT license. See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "timeSync.h"
+
+#define PPB 1000000000LL
+
+/*!
+ * @brief A simulated link and device clock.
+ *
+ * @field name         - printed with the result
+ * @field skewPpb      - how fast the device clock runs against the host's
+ * @field offsetUs     - device time when the host clock reads 0
+ * @field periodUs     - time between sync exchanges
+ * @field uplinkUs     - least delay from the host to the device
+ * @field downlinkUs   - least delay from the device to the host, which only
+ *                      enters through the central's uplink correction
+ * @field jitterUs     - most extra uplink delay, up to a connection interval
+ */
+typedef struct
+{
+  char const *name;
+  int64_t skewPpb;
+  int64_t offsetUs;
+  int64_t periodUs;
+  int64_t uplinkUs;
+  int64_t downlinkUs;
+  int64_t jitterUs;
+} sync_case_t;
+
+static sync_case_t const m_cases[] =
+{
+  { "no skew, 7.5 ms",  0,       123456789,  1000000, 3750, 1250, 7500 },
+  { "+40 ppm, 7.5 ms",  40000,   -5000000,   1000000, 3750, 1250, 7500 },
+  { "-60 ppm, 7.5 ms",  -60000,  987654321,  1000000, 3750, 1250, 7500 },
+  { "+20 ppm, 30 ms",   20000,   42,         4000000, 5000, 2000, 30000 },
+  { "-100 ppm, 30 ms",  -100000, 7000000000, 4000000, 5000, 2000, 30000 },
+};
+
+/*!
+ * @brief Standard deviations of error allowed.
+ */
+#define SIGMAS 4
+
+static uint64_t m_random = 0x9E3779B97F4A7C15ULL;
+
+/*!
+ * @brief Deterministic xorshift, so a failure can be reproduced.
+ */
+static int64_t
+randomBelow(int64_t limit)
+{
+  m_random ^= m_random << 13;
+  m_random ^= m_random >> 7;
+  m_random ^= m_random << 17;
+  return (int64_t) (m_random % (uint64_t) limit);
+}
+
+static int64_t
+deviceAt(sync_case_t const *test, int64_t hostUs)
+{
+  return test->offsetUs + hostUs + (hostUs * test->skewPpb) / PPB;
+}
+
+static int64_t
+absolute(int64_t value)
+{
+  return value < 0 ? -value : value;
+}
+
+/*!
+ * @brief Run one case.
+ *
+ * @return true if the estimate kept within the case's bounds
+ */
+static bool
+runCase(sync_case_t const *test)
+{
+  time_sync_t sync;
+  timeSyncInit(&sync);
+
+  // Fill the window, then run a few epochs more so the oldest minima have
+  // been replaced
+  int64_t const exchanges = TIME_SYNC_EPOCH_SAMPLES * (TIME_SYNC_WINDOW + 3);
+  int64_t hostUs = 0;
+
+  // The central only sees round trips, so takes half the least one as its
+  // uplink correction
+  int64_t const correctionUs = (test->uplinkUs + test->downlinkUs) / 2;
+
+  for (int64_t i = 0; i < exchanges; i++)
+  {
+    hostUs += test->periodUs;
+    int64_t uplink = test->uplinkUs + randomBelow(test->jitterUs);
+    timeSyncAddSample(&sync, hostUs + correctionUs, deviceAt(test, hostUs + uplink));
+  }
+
+  // Noise on each epoch minimum, and on the slope fitted through them
+  double const minimumUs = (double) test->jitterUs / (TIME_SYNC_EPOCH_SAMPLES + 1);
+  double const epochUs = (double) TIME_SYNC_EPOCH_SAMPLES * test->periodUs;
+  double spread = 0;
+  for (int i = 0; i < TIME_SYNC_WINDOW; i++)
+  {
+    double k = i - (TIME_SYNC_WINDOW - 1) / 2.0;
+    spread += k * k;
+  }
+  int64_t const maxSkewError = (int64_t) (SIGMAS * minimumUs / (epochUs * sqrt(spread)) * PPB);
+
+  bool passed = true;
+  int64_t skewError = sync.skewPpb - test->skewPpb;
+  if (absolute(skewError) > maxSkewError)
+    passed = false;
+
+  // Stamps are taken between syncs, so check through the next epoch
+  int64_t worstUs = 0;
+  int64_t const horizonUs = TIME_SYNC_EPOCH_SAMPLES * test->periodUs;
+  int64_t const maxErrorUs = absolute(test->uplinkUs - test->downlinkUs) / 2 +
+      (int64_t) (SIGMAS * minimumUs) + (maxSkewError * horizonUs) / PPB;
+  for (int64_t after = 0; after <= horizonUs; after += test->periodUs / 4)
+  {
+    int64_t trueHostUs = hostUs + after;
+    int64_t estimateUs;
+    if (!timeSyncToHost(&sync, deviceAt(test, trueHostUs), &estimateUs))
+      return false;
+    if (absolute(estimateUs - trueHostUs) > absolute(worstUs))
+      worstUs = estimateUs - trueHostUs;
+  }
+  if (absolute(worstUs) > maxErrorUs)
+    passed = false;
+
+  printf("%-4s %-18s skew %7d ppb (error %+6lld, limit %lld), "
+      "to host error %+6lld us (limit %lld)\n",
+      passed ? "ok" : "FAIL", test->name, (int) sync.skewPpb, (long long) skewError,
+      (long long) maxSkewError, (long long) worstUs, (long long) maxErrorUs);
+  return passed;
+}
+
+int
+main(void)
+{
+  unsigned failed = 0;
+
+  for (size_t i = 0; i < sizeof(m_cases) / sizeof(m_cases[0]); i++)
+    if (!runCase(&m_cases[i]))
+      failed++;
+
+  if (failed > 0)
+    printf("%u of %u cases failed\n", failed, (unsigned) (sizeof(m_cases) / sizeof(m_cases[0])));
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}